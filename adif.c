@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "adif.h"
+
+/*
+	ADIF, the log exchange format.
+	A record is a run of fields like <CALL:4>VU2E, closed by <EOR>. The
+	length before the '>' gives the size of the value, there is no quoting
+	and no escaping. The text before <EOH> is the header, it is skipped.
+
+	The file is mapped whole and the reader hands out fields that point
+	into it, nothing is copied till the caller wants a value. An exported
+	log of 50,000 QSOs is a few megabytes, well within the Pi's memory.
+*/
+
+int adif_open(struct adif_file *f, const char *path){
+	struct stat st;
+
+	memset(f, 0, sizeof(*f));
+	int fd = open(path, O_RDONLY);
+	if (fd < 0){
+		printf("*Error: unable to open %s\n", path);
+		return -1;
+	}
+	if (fstat(fd, &st) || st.st_size == 0){
+		printf("*Error: %s is empty\n", path);
+		close(fd);
+		return -1;
+	}
+	f->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (f->data == MAP_FAILED){
+		printf("*Error: unable to map %s\n", path);
+		f->data = NULL;
+		return -1;
+	}
+	f->length = st.st_size;
+	madvise(f->data, f->length, MADV_SEQUENTIAL);
+
+	//a file that starts with a '<' has no header
+	if (f->data[0] != '<'){
+		char *p = f->data;
+		while ((p = memchr(p, '<', f->length - (p - f->data)))){
+			if (f->length - (p - f->data) >= 5 && !strncasecmp(p, "<EOH>", 5)){
+				f->pos = p + 5 - f->data;
+				break;
+			}
+			p++;
+		}
+	}
+	return 0;
+}
+
+void adif_close(struct adif_file *f){
+	if (f->data)
+		munmap(f->data, f->length);
+	f->data = NULL;
+}
+
+/* returns ADIF_FIELD with the next field, ADIF_EOR at the end of a record
+	and ADIF_END at the end of the file */
+int adif_next(struct adif_file *f, struct adif_field *field){
+	const char *end = f->data + f->length;
+
+	while (f->pos < f->length){
+		const char *p = memchr(f->data + f->pos, '<', f->length - f->pos);
+		if (!p)
+			break;
+		p++;
+
+		//the name runs till a ':' or a '>'
+		const char *name = p;
+		while (p < end && *p != ':' && *p != '>')
+			p++;
+		if (p >= end)
+			break;
+		field->name = name;
+		field->name_length = p - name;
+
+		//<EOR>, <EOH> or a tag without a value
+		if (*p == '>'){
+			f->pos = p + 1 - f->data;
+			if (field->name_length == 3 && !strncasecmp(name, "EOR", 3))
+				return ADIF_EOR;
+			continue;
+		}
+
+		int length = 0;
+		for (p++; p < end && isdigit(*p); p++)
+			length = length * 10 + *p - '0';
+		//skip the data type, as in <QSO_DATE:8:D>
+		while (p < end && *p != '>')
+			p++;
+		if (p >= end)
+			break;
+		p++;
+		if (length > end - p)
+			length = end - p;
+		field->value = p;
+		field->value_length = length;
+		f->pos = p + length - f->data;
+		return ADIF_FIELD;
+	}
+	f->pos = f->length;
+	return ADIF_END;
+}
+
+//the field names are matched without case
+int adif_is(struct adif_field *field, const char *name){
+	return field->name_length == strlen(name)
+		&& !strncasecmp(field->name, name, field->name_length);
+}
+
+//copies out the value, zero terminated and trimmed to fit
+int adif_value(struct adif_field *field, char *buff, int size){
+	int n = field->value_length < size - 1 ? field->value_length : size - 1;
+
+	memcpy(buff, field->value, n);
+	buff[n] = 0;
+	return n;
+}
+
+//how far the reader is, in percent
+int adif_progress(struct adif_file *f){
+	return f->length ? (int)((f->pos * 100) / f->length) : 100;
+}
+
+/* writer */
+
+void adif_write_header(FILE *pf, const char *program){
+	fprintf(pf, "/ADIF file\n");
+	fprintf(pf, "generated from sBITX log db by %s\n", program);
+	fprintf(pf, "<adif version:5>3.1.4\n");
+	fprintf(pf, "<EOH>\n");
+}
+
+//empty fields are left out
+void adif_write_field(FILE *pf, const char *name, const char *value){
+	int length = strlen(value);
+
+	if (length)
+		fprintf(pf, "<%s:%d>%s\n", name, length, value);
+}
+
+void adif_write_eor(FILE *pf){
+	fputs("<EOR>\n", pf);
+}
+
+/* modes
+	ADIF puts the voice and the newer digital modes under a mode with a
+	submode (SSB/USB, MFSK/FT4). The log keeps the modes as the radio
+	names them */
+
+static struct {
+	char *mode, *adif_mode, *adif_submode;
+} adif_modes[] = {
+	{"USB", "SSB", "USB"},
+	{"LSB", "SSB", "LSB"},
+	{"CWR", "CW", ""},
+	{"FT4", "MFSK", "FT4"},
+	{"JS8", "MFSK", "JS8"},
+	{"Q65", "MFSK", "Q65"},
+	{"DIGI", "PKT", ""},
+	{NULL, NULL, NULL}
+};
+
+//the mode to log from an ADIF mode and submode
+void adif_mode_in(const char *mode, const char *submode, int freq_khz, char *out, int size){
+	if (submode && *submode)
+		snprintf(out, size, "%s", submode);
+	//an SSB without a submode is on the usual sideband
+	else if (!strcasecmp(mode, "SSB"))
+		snprintf(out, size, "%s", freq_khz && freq_khz < 10000 ? "LSB" : "USB");
+	else
+		snprintf(out, size, "%s", mode);
+	for (char *p = out; *p; p++)
+		*p = toupper(*p);
+}
+
+void adif_mode_out(const char *mode, char *adif_mode, char *adif_submode){
+	for (int i = 0; adif_modes[i].mode; i++)
+		if (!strcasecmp(mode, adif_modes[i].mode)){
+			strcpy(adif_mode, adif_modes[i].adif_mode);
+			strcpy(adif_submode, adif_modes[i].adif_submode);
+			return;
+		}
+	strcpy(adif_mode, mode);
+	adif_submode[0] = 0;
+}
+
+/* reader benchmark, it writes a synthetic log of 50,000 QSOs and times
+	reading it back
+
+#include <time.h>
+
+void main(int argc, char **argv){
+	struct adif_file f;
+	struct adif_field field;
+	struct timespec start, stop;
+	char call[20];
+	int fields = 0, records = 0;
+
+	FILE *pf = fopen("/tmp/test.adi", "w");
+	adif_write_header(pf, "adif.c");
+	for (int i = 0; i < 50000; i++){
+		char buff[20];
+		sprintf(buff, "K%dABC", i);
+		adif_write_field(pf, "CALL", buff);
+		adif_write_field(pf, "QSO_DATE", "20240115");
+		adif_write_field(pf, "TIME_ON", "1234");
+		adif_write_field(pf, "FREQ", "14.074");
+		adif_write_field(pf, "MODE", "FT8");
+		adif_write_field(pf, "RST_SENT", "-10");
+		adif_write_field(pf, "RST_RCVD", "-12");
+		adif_write_field(pf, "GRIDSQUARE", "FN42");
+		adif_write_eor(pf);
+	}
+	fclose(pf);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	adif_open(&f, "/tmp/test.adi");
+	int e;
+	while ((e = adif_next(&f, &field)) != ADIF_END){
+		if (e == ADIF_EOR)
+			records++;
+		else if (adif_is(&field, "CALL"))
+			adif_value(&field, call, sizeof(call));
+		fields++;
+	}
+	adif_close(&f);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	double msecs = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec)/1e6;
+	printf("%d records, %d fields in %.1f msec\n", records, fields, msecs);
+}
+*/
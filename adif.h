@@ -0,0 +1,33 @@
+/* reads and writes ADIF, see adif.c */
+
+struct adif_file {
+	char *data;			//the whole file, mapped
+	size_t length;
+	size_t pos;
+};
+
+//a field points into the file, the value is not zero terminated
+struct adif_field {
+	const char *name;
+	int name_length;
+	const char *value;
+	int value_length;
+};
+
+#define ADIF_FIELD 1
+#define ADIF_EOR 0
+#define ADIF_END -1
+
+int adif_open(struct adif_file *f, const char *path);
+void adif_close(struct adif_file *f);
+int adif_next(struct adif_file *f, struct adif_field *field);
+int adif_is(struct adif_field *field, const char *name);
+int adif_value(struct adif_field *field, char *buff, int size);
+int adif_progress(struct adif_file *f);
+
+void adif_write_header(FILE *pf, const char *program);
+void adif_write_field(FILE *pf, const char *name, const char *value);
+void adif_write_eor(FILE *pf);
+
+void adif_mode_in(const char *mode, const char *submode, int freq_khz, char *out, int size);
+void adif_mode_out(const char *mode, char *adif_mode, char *adif_submode);
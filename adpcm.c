@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include "adpcm.h"
+
+/*
+	IMA ADPCM, four bits per sample.
+	This is used to squeeze the remote audio going out on the websocket.
+	Each frame carries the encoder state it started with (see the
+	webserver.c), so the frames can be decoded even if some are dropped.
+	The decoder in web/pcm-player.js has to match this.
+*/
+
+static const int8_t index_table[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int16_t step_table[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+//updates the state with one code, returns the decoded sample
+static int adpcm_step(struct adpcm_state *s, int code){
+	int step = step_table[s->index];
+	int diff = step >> 3;
+
+	if (code & 4)
+		diff += step;
+	if (code & 2)
+		diff += step >> 1;
+	if (code & 1)
+		diff += step >> 2;
+	if (code & 8)
+		s->predictor -= diff;
+	else
+		s->predictor += diff;
+
+	if (s->predictor > 32767)
+		s->predictor = 32767;
+	else if (s->predictor < -32768)
+		s->predictor = -32768;
+
+	s->index += index_table[code];
+	if (s->index < 0)
+		s->index = 0;
+	else if (s->index > 88)
+		s->index = 88;
+	return s->predictor;
+}
+
+void adpcm_init(struct adpcm_state *s){
+	s->predictor = 0;
+	s->index = 0;
+}
+
+//packs n samples into n/2 bytes, the first sample in the lower nibble
+void adpcm_encode(struct adpcm_state *s, int16_t *in, uint8_t *out, int n){
+	for (int i = 0; i < n; i++){
+		int step = step_table[s->index];
+		int diff = in[i] - s->predictor;
+		int code = 0;
+
+		if (diff < 0){
+			code = 8;
+			diff = -diff;
+		}
+		if (diff >= step){
+			code |= 4;
+			diff -= step;
+		}
+		if (diff >= step >> 1){
+			code |= 2;
+			diff -= step >> 1;
+		}
+		if (diff >= step >> 2)
+			code |= 1;
+
+		//the encoder tracks the decoder exactly
+		adpcm_step(s, code);
+		if (i & 1)
+			out[i/2] |= code << 4;
+		else
+			out[i/2] = code;
+	}
+}
+
+void adpcm_decode(struct adpcm_state *s, uint8_t *in, int16_t *out, int n){
+	for (int i = 0; i < n; i++){
+		int code = (i & 1) ? in[i/2] >> 4 : in[i/2] & 0x0f;
+		out[i] = adpcm_step(s, code);
+	}
+}
+
+/* round trip test, a 1 KHz tone with some noise at 8000 samples/sec
+void main(int argc, char **argv){
+	int16_t in[8000], out[8000];
+	uint8_t coded[4000];
+	struct adpcm_state enc, dec;
+	double signal = 0, noise = 0;
+
+	for (int i = 0; i < 8000; i++)
+		in[i] = 10000 * sin(2 * M_PI * 1000 * i / 8000.0) + (rand() % 200) - 100;
+
+	adpcm_init(&enc);
+	adpcm_init(&dec);
+	for (int i = 0; i < 8000; i += 160){
+		adpcm_encode(&enc, in + i, coded + i/2, 160);
+		adpcm_decode(&dec, coded + i/2, out + i, 160);
+	}
+	for (int i = 0; i < 8000; i++){
+		signal += (double)in[i] * in[i];
+		noise += (double)(in[i] - out[i]) * (in[i] - out[i]);
+	}
+	printf("snr %.1f db, %d bytes for %d bytes\n", 10 * log10(signal/noise),
+		4000, (int)sizeof(in));
+}
+*/
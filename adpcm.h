@@ -0,0 +1,8 @@
+struct adpcm_state {
+	int predictor;
+	int index;
+};
+
+void adpcm_init(struct adpcm_state *s);
+void adpcm_encode(struct adpcm_state *s, int16_t *in, uint8_t *out, int n);
+void adpcm_decode(struct adpcm_state *s, uint8_t *in, int16_t *out, int n);
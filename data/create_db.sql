@@ -30,8 +30,10 @@ create table logbook (
 	rst_recv TEXT,
 	exch_recv TEXT DEFAULT "",
 	tx_id	TEXT DEFAULT "",
-	comments TEXT DEFAULT ""
+	comments TEXT DEFAULT "",
+	epoch INTEGER
 );
 CREATE INDEX gridIx ON logbook (exch_recv);
 CREATE INDEX callIx ON logbook (callsign_recv);
+CREATE INDEX callEpochIx ON logbook (callsign_recv, epoch);
 
@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "fldigi.h"
+
+/*
+	The fldigi client.
+	fldigi is run as a proxy for the digital modes it implements, it is
+	worked through its XML-RPC server on port 7362. Each call used to open
+	a connection, send the request, wait in a recv() and close. That was
+	done from the gtk thread and, for the modem pitch, from the audio
+	thread.
+
+	Now a thread of its own keeps one connection open. The calls are put
+	in a queue and the thread writes them out one at a time. The reply
+	is read as it comes, the HTTP header is parsed for the length of
+	the body and the body is matched to the oldest call sent.
+	fldigi's XmlRpc++ server reads one request per read and drops the 
+	rest of what was pipelined behind it, so FLDIGI_PIPELINE stays at 1.
+	The kept-alive connection already saves the connect per call.
+
+	fldigi_send() doesn't wait, the reply goes to a callback on the
+	fldigi thread. fldigi_call() waits for the reply, for FLDIGI_TIMEOUT
+	at most. If fldigi isn't running, the calls fail at once and the
+	connection is tried again after FLDIGI_RETRY msecs.
+*/
+
+#define FLDIGI_PORT 7362
+#define FLDIGI_QUEUE 32			//must be a power of 2
+#define FLDIGI_PIPELINE 1		//calls on the wire, waiting for replies
+#define FLDIGI_TIMEOUT 1000		//msecs
+#define FLDIGI_RETRY 2000		//msecs
+#define FLDIGI_RESULT 1000
+
+struct fldigi_request {
+	unsigned int seq;
+	char text[1500];			//the whole http request
+	int length;
+	int retried;
+	long sent_at;
+	char *result;					//the caller's, if it is waiting
+	int *status;
+	void (*done)(char *result);
+};
+
+static struct fldigi_request queue[FLDIGI_QUEUE];
+//the counters only go up: [q_done, q_sent) are on the wire, [q_sent, q_head) are waiting
+static unsigned int q_head = 0, q_sent = 0, q_done = 0;
+static pthread_mutex_t fldigi_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fldigi_replied = PTHREAD_COND_INITIALIZER;
+static pthread_once_t fldigi_once = PTHREAD_ONCE_INIT;
+static pthread_t fldigi_thread;
+static int wake_fds[2] = {-1, -1};
+static int fldigi_fd = -1;
+static long fldigi_retry_at = 0;
+
+static char reply[16384];
+static int reply_length = 0;
+
+#define FLDIGI_PENDING 1
+
+static long fldigi_msecs(){
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/* ---- Base64 Encoding/Decoding Table --- */
+static char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* decodeblock - decode 4 '6-bit' characters into 3 8-bit binary bytes 
+	at clrdst + *n, never past the last byte of the size */
+static void decodeblock(unsigned char in[], char *clrdst, int *n, int size) {
+  unsigned char out[3];
+  out[0] = in[0] << 2 | in[1] >> 4;
+  out[1] = in[1] << 4 | in[2] >> 2;
+  out[2] = in[2] << 6 | in[3] >> 0;
+  for (int i = 0; i < 3 && *n < size - 1; i++)
+    clrdst[(*n)++] = out[i];
+  clrdst[*n] = '\0';
+}
+
+static void b64_decode(char *b64src, char *clrdst, int size) {
+  int c, phase, i, n = 0;
+  unsigned char in[4] = {0, 0, 0, 0};
+  char *p;
+
+  clrdst[0] = '\0';
+  phase = 0; i=0;
+  while(b64src[i]) {
+    c = (int) b64src[i];
+    if(c == '=') {
+      decodeblock(in, clrdst, &n, size);
+      break;
+    }
+    p = strchr(b64, c);
+    if(p) {
+      in[phase] = p - b64;
+      phase = (phase + 1) % 4;
+      if(phase == 0) {
+        decodeblock(in, clrdst, &n, size);
+        in[0]=in[1]=in[2]=in[3]=0;
+      }
+    }
+    i++;
+  }
+}
+
+//the text of the reply is either in base64 or is the plain <value>
+static void fldigi_result(char *body, char *result){
+	char *p, *r;
+
+	result[0] = 0;
+	if ((p = strstr(body, "<base64>"))){
+		p += strlen("<base64>");
+		if ((r = strchr(p, '<'))){
+			*r = 0;
+			if ((int)strlen(p) > (FLDIGI_RESULT * 4)/3 - 4)
+				p[(FLDIGI_RESULT * 4)/3 - 4] = 0;
+			int len = (strlen(p) * 6)/8;
+			b64_decode(p, result, FLDIGI_RESULT);
+			result[len] = 0;
+		}
+	}
+	else if ((p = strstr(body, "<value>"))){
+		p += strlen("<value>");
+		//skip the type, as in <value><string>
+		if (p[0] == '<' && p[1] != '/' && (r = strchr(p, '>')))
+			p = r + 1;
+		if ((r = strchr(p, '<')))
+			*r = 0;
+		snprintf(result, FLDIGI_RESULT, "%s", p);
+	}
+	else
+		snprintf(result, FLDIGI_RESULT, "%s", body);
+}
+
+/* on the fldigi thread */
+
+//ends the call at the head of the wire, status is 0 or -1
+static void fldigi_complete(int status, char *body){
+	char result[FLDIGI_RESULT];
+	void (*done)(char *result);
+
+	if (body)
+		fldigi_result(body, result);
+	else
+		result[0] = 0;
+
+	pthread_mutex_lock(&fldigi_lock);
+	struct fldigi_request *q = queue + (q_done % FLDIGI_QUEUE);
+	if (q->status){
+		if (q->result)
+			strcpy(q->result, result);
+		*q->status = status;
+	}
+	done = q->done;
+	q_done++;
+	pthread_cond_broadcast(&fldigi_replied);
+	pthread_mutex_unlock(&fldigi_lock);
+
+	if (done && !status)
+		done(result);
+}
+
+//fails everything that is queued
+static void fldigi_fail_all(){
+	while (1){
+		pthread_mutex_lock(&fldigi_lock);
+		int pending = q_done != q_head;
+		if (pending && q_sent == q_done)
+			q_sent++;
+		pthread_mutex_unlock(&fldigi_lock);
+		if (!pending)
+			break;
+		fldigi_complete(-1, NULL);
+	}
+}
+
+//the calls that had gone out are sent again once on the next connection
+static void fldigi_drop(char *why){
+	if (fldigi_fd >= 0){
+		printf("fldigi connection closed: %s\n", why);
+		close(fldigi_fd);
+	}
+	fldigi_fd = -1;
+	reply_length = 0;
+
+	pthread_mutex_lock(&fldigi_lock);
+	int resend = 1;
+	for (unsigned int i = q_done; i != q_sent; i++)
+		if (queue[i % FLDIGI_QUEUE].retried)
+			resend = 0;
+	if (resend){
+		for (unsigned int i = q_done; i != q_sent; i++)
+			queue[i % FLDIGI_QUEUE].retried = 1;
+		q_sent = q_done;
+	}
+	pthread_mutex_unlock(&fldigi_lock);
+	if (!resend)
+		fldigi_fail_all();
+}
+
+static int fldigi_connect(){
+	struct sockaddr_in addr;
+	int one = 1;
+
+	if (fldigi_msecs() < fldigi_retry_at){
+		fldigi_fail_all();
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(FLDIGI_PORT);
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	fldigi_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fldigi_fd < 0 || connect(fldigi_fd, (struct sockaddr *)&addr, sizeof(addr))){
+		if (fldigi_fd >= 0)
+			close(fldigi_fd);
+		fldigi_fd = -1;
+		fldigi_retry_at = fldigi_msecs() + FLDIGI_RETRY;
+		fldigi_fail_all();
+		return -1;
+	}
+	setsockopt(fldigi_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(fldigi_fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+	fcntl(fldigi_fd, F_SETFL, fcntl(fldigi_fd, F_GETFL) | O_NONBLOCK);
+	reply_length = 0;
+	printf("fldigi connected\n");
+	return 0;
+}
+
+//writes out the waiting calls, as many as the pipeline allows
+static void fldigi_write(){
+	while (1){
+		pthread_mutex_lock(&fldigi_lock);
+		if (q_sent == q_head || q_sent - q_done >= FLDIGI_PIPELINE){
+			pthread_mutex_unlock(&fldigi_lock);
+			return;
+		}
+		struct fldigi_request *q = queue + (q_sent % FLDIGI_QUEUE);
+		q->sent_at = fldigi_msecs();
+		q_sent++;
+		pthread_mutex_unlock(&fldigi_lock);
+
+		//the requests are small, the socket buffer takes them whole
+		if (send(fldigi_fd, q->text, q->length, MSG_NOSIGNAL) != q->length){
+			fldigi_drop(strerror(errno));
+			return;
+		}
+	}
+}
+
+static int fldigi_content_length(char *header, int length){
+	const char *tag = "content-length:";
+
+	for (int i = 0; i + 15 < length; i++)
+		if (!strncasecmp(header + i, tag, 15))
+			return atoi(header + i + 15);
+	return 0;
+}
+
+//takes the complete replies out of the buffer
+static void fldigi_parse(){
+	char body[sizeof(reply)];
+
+	while (reply_length > 0){
+		reply[reply_length] = 0;
+		char *end = strstr(reply, "\r\n\r\n");
+		int gap = 4;
+		if (!end){
+			end = strstr(reply, "\n\n");
+			gap = 2;
+		}
+		if (!end)
+			return;
+		int header_length = end - reply + gap;
+		int body_length = fldigi_content_length(reply, header_length);
+		if (header_length + body_length > (int)sizeof(reply) - 1){
+			fldigi_drop("reply too long");
+			return;
+		}
+		if (reply_length < header_length + body_length)
+			return;
+
+		memcpy(body, reply + header_length, body_length);
+		body[body_length] = 0;
+		reply_length -= header_length + body_length;
+		memmove(reply, reply + header_length + body_length, reply_length);
+
+		pthread_mutex_lock(&fldigi_lock);
+		int expected = q_done != q_sent;
+		pthread_mutex_unlock(&fldigi_lock);
+		if (expected)
+			fldigi_complete(0, body);
+	}
+}
+
+static void fldigi_read(){
+	int n = recv(fldigi_fd, reply + reply_length, sizeof(reply) - 1 - reply_length, 0);
+
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)){
+		fldigi_drop(n == 0 ? "closed by fldigi" : strerror(errno));
+		return;
+	}
+	if (n > 0){
+		reply_length += n;
+		fldigi_parse();
+	}
+}
+
+static void *fldigi_thread_function(void *ptr){
+	struct pollfd fds[2];
+	char c[16];
+
+	while (1){
+		pthread_mutex_lock(&fldigi_lock);
+		int waiting = q_sent != q_head;
+		int on_wire = q_done != q_sent;
+		long sent_at = queue[q_done % FLDIGI_QUEUE].sent_at;
+		pthread_mutex_unlock(&fldigi_lock);
+
+		if (on_wire && fldigi_msecs() - sent_at > FLDIGI_TIMEOUT){
+			//a second timeout fails the calls
+			fldigi_drop("no reply");
+			continue;
+		}
+		if (waiting && fldigi_fd < 0 && fldigi_connect())
+			continue;
+		if (waiting)
+			fldigi_write();
+
+		fds[0].fd = wake_fds[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = fldigi_fd;
+		fds[1].events = POLLIN;
+		//a closed socket (fd -1) is skipped by poll()
+		poll(fds, 2, on_wire ? 100 : 1000);
+		if (fds[0].revents & POLLIN)
+			while (read(wake_fds[0], c, sizeof(c)) > 0)
+				;
+		if (fldigi_fd >= 0 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+			fldigi_read();
+	}
+	return NULL;
+}
+
+static void fldigi_start(){
+	if (pipe(wake_fds)){
+		printf("*Error: fldigi pipe: %s\n", strerror(errno));
+		return;
+	}
+	fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+	pthread_create(&fldigi_thread, NULL, fldigi_thread_function, NULL);
+}
+
+/* from the other threads */
+
+//returns the sequence of the call or -1 if it can't be queued
+static long fldigi_queue(char *action, char *type, char *param,
+	char *result, int *status, void (*done)(char *result)){
+	char xml[1000], value[400];
+	int i = 0;
+
+	pthread_once(&fldigi_once, fldigi_start);
+	if (wake_fds[1] < 0 || fldigi_msecs() < fldigi_retry_at)
+		return -1;
+
+	//escape the text
+	for (char *p = param; *p && i < (int)sizeof(value) - 6; p++){
+		if (*p == '<')
+			i += sprintf(value + i, "&lt;");
+		else if (*p == '&')
+			i += sprintf(value + i, "&amp;");
+		else
+			value[i++] = *p;
+	}
+	value[i] = 0;
+
+	snprintf(xml, sizeof(xml),
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<methodCall><methodName>%s</methodName>\n"
+		"<params>\n<param><value><%s>%s</%s></value></param> </params></methodCall>\n",
+		action, type, value, type);
+
+	pthread_mutex_lock(&fldigi_lock);
+	if (q_head - q_done == FLDIGI_QUEUE){
+		pthread_mutex_unlock(&fldigi_lock);
+		return -1;
+	}
+	unsigned int seq = q_head;
+	struct fldigi_request *q = queue + (seq % FLDIGI_QUEUE);
+	q->seq = seq;
+	q->length = snprintf(q->text, sizeof(q->text),
+		"POST /RPC2 HTTP/1.1\r\n"
+		"Host: 127.0.0.1:%d\r\n"
+		"User-Agent: sbitx\r\n"
+		"Content-Type: text/xml\r\n"
+		"Content-Length: %d\r\n\r\n"
+		"%s",
+		FLDIGI_PORT, (int)strlen(xml), xml);
+	q->retried = 0;
+	q->sent_at = 0;
+	q->result = result;
+	q->status = status;
+	q->done = done;
+	q_head++;
+	pthread_mutex_unlock(&fldigi_lock);
+
+	write(wake_fds[1], "", 1);
+	return seq;
+}
+
+static int fldigi_wait(char *action, char *type, char *param, char *result){
+	struct timespec until;
+	int status = FLDIGI_PENDING;
+
+	*result = 0;
+	long seq = fldigi_queue(action, type, param, result, &status, NULL);
+	if (seq < 0)
+		return -1;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += (FLDIGI_TIMEOUT * 2) / 1000 + 1;
+	pthread_mutex_lock(&fldigi_lock);
+	while (status == FLDIGI_PENDING)
+		if (pthread_cond_timedwait(&fldigi_replied, &fldigi_lock, &until))
+			break;
+	//if we gave up, the reply must not be written to our stack
+	if (status == FLDIGI_PENDING){
+		struct fldigi_request *q = queue + (seq % FLDIGI_QUEUE);
+		if (q->seq == (unsigned int)seq){
+			q->result = NULL;
+			q->status = NULL;
+		}
+		status = -1;
+	}
+	pthread_mutex_unlock(&fldigi_lock);
+	return status;
+}
+
+//waits for the reply, the result should have room for 1000 bytes
+int fldigi_call(char *action, char *param, char *result){
+	return fldigi_wait(action, "string", param, result);
+}
+
+int fldigi_call_i(char *action, int param, char *result){
+	char value[20];
+
+	sprintf(value, "%d", param);
+	return fldigi_wait(action, "i4", value, result);
+}
+
+//doesn't wait, done() is called on the fldigi thread with the reply
+int fldigi_send(char *action, char *param, void (*done)(char *result)){
+	return fldigi_queue(action, "string", param, NULL, NULL, done) < 0 ? -1 : 0;
+}
+
+int fldigi_send_i(char *action, int param, void (*done)(char *result)){
+	char value[20];
+
+	sprintf(value, "%d", param);
+	return fldigi_queue(action, "i4", value, NULL, NULL, done) < 0 ? -1 : 0;
+}
+
+/* a test, run it with fldigi open, it times a thousand calls
+void main(int argc, char **argv){
+	char result[FLDIGI_RESULT];
+	long start = fldigi_msecs();
+
+	for (int i = 0; i < 1000; i++)
+		while (fldigi_send("rx.get_data", "", NULL))
+			usleep(100);
+	int e = fldigi_call("modem.get_name", "", result);
+	printf("%d [%s] in %ld msecs\n", e, result, fldigi_msecs() - start);
+}
+*/
@@ -0,0 +1,6 @@
+/* the fldigi xml-rpc client, see fldigi.c */
+
+int fldigi_call(char *action, char *param, char *result);
+int fldigi_call_i(char *action, int param, char *result);
+int fldigi_send(char *action, char *param, void (*done)(char *result));
+int fldigi_send_i(char *action, int param, void (*done)(char *result));
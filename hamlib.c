@@ -13,13 +13,12 @@
 #include <fcntl.h>
 #include <complex.h>
 #include <fftw3.h>
+#include <ctype.h>
 #include "sdr.h"
 #include "sdr_ui.h"
+#include "netio.h"
 
-static int welcome_socket = -1, data_socket = -1;
-#define MAX_DATA 1000
-char incoming_data[MAX_DATA];
-int incoming_ptr;
+static int hamlib_client = -1; //the client being answered
 
 void  hamlib_tx(int tx_on);
 
@@ -41,10 +40,12 @@ static char dump_state_response[] =
          *  ant - Antenna list equipped with this range, 0 means all
          *  FIXME: limits can be gets from receiver::get_rf_range()
          */
-        "100000 30000000 0x2ef -1 -1 0x1 0x0\n"
+        "100000 30000000 0x88f -1 -1 0x3 0x0\n"
         /* End of RX frequency ranges. */
         "0 0 0 0 0 0 0\n"
-        /* End of TX frequency ranges. The Gqrx is receiver only. */
+        /* the sbitx transmits on the ham bands, the rig checks the limits */
+        "1800000 30000000 0x88f 1000 40000 0x3 0x0\n"
+        /* End of TX frequency ranges. */
         "0 0 0 0 0 0 0\n"
         /* Tuning steps: modes, tuning_step */
         "0xef 1\n"
@@ -78,176 +79,389 @@ static char dump_state_response[] =
         /* Bit field list of set functions */
         "0\n" /* RIG_FUNC_NONE */
         /* Bit field list of get level */
-        "0x40000020\n" /* RIG_LEVEL_SQL | RIG_LEVEL_STRENGTH */
+        "0x50001008\n" /* STRENGTH | SWR | RFPOWER | AF */
         /* Bit field list of set level */
-        "0x20\n"       /* RIG_LEVEL_SQL */
+        "0x1008\n"       /* RFPOWER | AF */
         /* Bit field list of get parm */
         "0\n" /* RIG_PARM_NONE */
         /* Bit field list of set parm */
         "0\n" /* RIG_PARM_NONE */;
 
-int check_cmd(char *cmd, char *token){
-  if (strstr(cmd, token) == cmd)
-    return 1;
-  else
-    return 0;
-}
-
 void send_response(char *response){
-  send(data_socket, response, strlen(response), 0);
+  netio_send(hamlib_client, response);
 	//printf(" %s]\n", response); 
 }
 
-int in_tx = 0;
-void send_freq(){
-  char response[20];
-  sprintf(response, "%d\n", get_freq());
-  send_response(response);
+/*
+	The rigctld commands.
+	Each command has a single letter and a long name (used as "\get_freq"),
+	The gets fill in their values, one per line, the sets queue the change 
+	for the gtk thread through remote_execute_from().
+	A command that starts with '+', ';', '|' or ',' gets the extended 
+	response: the command's name, each value with its label and the
+	RPRT code. These are separated by new lines for '+' and by the
+	character itself for the others.
+	Since the \chk_vfo says yes, most clients put the vfo before the 
+	other arguments ("F VFOA 14074000"), it is optional here.
+*/
+
+#define RIG_OK 0
+#define RIG_EINVAL -1
+#define RIG_ENIMPL -4
+
+struct rig_cmd {
+	char cmd;
+	char *name;
+	char *labels;	//the values returned by a get, NULL for a set
+	int (*fn)(char *vfo, char *args, char *reply);
+};
+
+//sbitx modes and what they are called in hamlib
+static char *rig_modes[][2] = {
+	{"USB", "USB"}, {"LSB", "LSB"}, {"CW", "CW"}, {"CWR", "CWR"},
+	{"AM", "AM"}, {"FT8", "PKTUSB"}, {"DIGI", "PKTUSB"}, {"2TONE", "USB"},
+	{NULL, NULL}
+};
+
+static int vfo_is_b(char *vfo){
+	if (!vfo[0] || !strcmp(vfo, "currVFO"))
+		return field_str("VFO")[0] == 'B';
+	return !strcmp(vfo, "VFOB") || !strcmp(vfo, "Sub");
+}
+
+static int rig_get_freq(char *vfo, char *args, char *reply){
+	//the dial is the frequency of the current vfo
+	if (vfo_is_b(vfo) == (field_str("VFO")[0] == 'B'))
+		sprintf(reply, "%ld\n", get_freq());
+	else
+		sprintf(reply, "%s\n", field_str(vfo_is_b(vfo) ? "VFOB" : "VFOA"));
+	return RIG_OK;
 }
 
-void hamlib_set_freq(char *f){
-	long freq;
+static int rig_set_freq(char *vfo, char *args, char *reply){
 	char cmd[50];
-  if (!strncmp(f, "VFO", 3))
-    freq = atoi(f+5);
-  else
-    freq = atoi(f);
-  send_response("RPRT 0\n");
-	sprintf(cmd, "freq %d", freq);
-	cmd_exec(cmd);
-//	set_freq(freq);
+	long freq = atol(args);
+
+	if (freq <= 0)
+		return RIG_EINVAL;
+	if (vfo_is_b(vfo) == (field_str("VFO")[0] == 'B'))
+		sprintf(cmd, "freq %ld", freq);
+	else
+		sprintf(cmd, "%s %ld", vfo_is_b(vfo) ? "VFOB" : "VFOA", freq);
+	remote_execute_from(REMOTE_HAMLIB, cmd);
+	return RIG_OK;
 }
-	
-
-void tx_control(int s){
-  if (s == 1){
-    in_tx = 1;
-    hamlib_tx(in_tx);
-  }
-  if (s == 0){
-    in_tx = 0;
-    hamlib_tx(in_tx);
-  }
-  if (s != -1)
-    send_response("RPRT 0\n");
-  if (in_tx == 1)
-    send_response("1\n");
-  else
-    send_response("0\n");
+
+static int rig_get_mode(char *vfo, char *args, char *reply){
+	const char *mode = field_str("MODE");
+
+	for (int i = 0; rig_modes[i][0]; i++)
+		if (!strcmp(mode, rig_modes[i][0])){
+			sprintf(reply, "%s\n%d\n", rig_modes[i][1], field_int("BW"));
+			return RIG_OK;
+		}
+	sprintf(reply, "USB\n%d\n", field_int("BW"));
+	return RIG_OK;
 }
 
-void interpret_command(char *cmd){
+//args is the mode and the passband
+static int rig_set_mode(char *vfo, char *args, char *reply){
+	char mode[20], cmd[50];
+	int passband = 0;
+	const char *now = field_str("MODE");
 
-  if (check_cmd(cmd, "\\chk_vfo"))
-    send_response("CHKVFO 1\n"); 
-  else if (check_cmd(cmd, "\\dump_state"))
-    send_response(dump_state_response);
-  else if (check_cmd(cmd, "V"))
-    send_response("VFOA\n");
-  else if (check_cmd(cmd, "v"))
-    send_response("VFOA\n");
-	else if (!strcmp(cmd, "m VFOA"))
-		send_response("USB\n3000\n");
-  else if (!strncmp(cmd, "m VFOA", 6))
-    send_response("USB\n3000\n");
-  else if (check_cmd(cmd, "f"))
-		send_freq();
-  else if (check_cmd(cmd, "F"))
-    hamlib_set_freq(cmd + 2);
-  else if (cmd[0] == 'T'){
-		if (strchr(cmd, '0'))
-			tx_control(0); //if there is a zero in it, we are to rx
-		else
-			tx_control(1); //this is a shaky way to do it, who has the time to parse?
-/*    if (!strcmp(cmd, "T 0") || !strcmp(cmd, "T VFOA 0"))
-      tx_control(0);
-    else if (!strcmp(cmd, "T 1") || !strcmp(cmd, "T VFOA 1"))
-      tx_control(1);
-*/
-  }
-  else if (check_cmd(cmd, "s"))
-    send_response("0\n");
-  else if (check_cmd(cmd, "t"))
-    tx_control(-1);
-  else if (check_cmd(cmd, "q")){
-    close(data_socket);
-    data_socket = -1;
-  }
-	else 
-		printf("Hamlib: Unrecognized command [%s] '%c'\n", cmd, cmd[0]);
+	if (sscanf(args, "%19s %d", mode, &passband) < 1)
+		return RIG_EINVAL;
+
+	if (!strcmp(mode, "PKTUSB") && (!strcmp(now, "FT8") || !strcmp(now, "DIGI")))
+		; //already in a data mode 
+	else if (!strcmp(mode, "PKTUSB"))
+		remote_execute_from(REMOTE_HAMLIB, "mode DIGI");
+	else {
+		int i;
+		for (i = 0; rig_modes[i][0]; i++)
+			if (!strcmp(mode, rig_modes[i][0]))
+				break;
+		if (!rig_modes[i][0])
+			return RIG_EINVAL;
+		if (strcmp(now, mode)){
+			sprintf(cmd, "mode %s", mode);
+			remote_execute_from(REMOTE_HAMLIB, cmd);
+		}
+	}
+
+	//0 is the default and -1 is no change
+	if (passband > 0){
+		sprintf(cmd, "BW %d", passband);
+		remote_execute_from(REMOTE_HAMLIB, cmd);
+	}
+	return RIG_OK;
 }
 
-void hamlib_handler(char *data, int len){
-
-//	printf("<<<hamlib cmd %s =>", data);
-  for (int i = 0; i < len; i++){
-    if (data[i] == '\n'){
-      incoming_data[incoming_ptr] = 0;
-      incoming_ptr = 0;
-      interpret_command(incoming_data);
-    }
-    else if (incoming_ptr < MAX_DATA){
-      incoming_data[incoming_ptr] = data[i]; 
-      incoming_ptr++;
-    }
-  }
+static int rig_get_vfo(char *vfo, char *args, char *reply){
+	sprintf(reply, "VFO%c\n", field_str("VFO")[0]);
+	return RIG_OK;
 }
 
-void hamlib_start(){
-  char buffer[MAX_DATA];
-  struct sockaddr_in serverAddr;
-  struct sockaddr_storage serverStorage;
-  socklen_t addr_size;
+static int rig_set_vfo(char *vfo, char *args, char *reply){
+	if (!strcmp(args, "VFOA"))
+		remote_execute_from(REMOTE_HAMLIB, "VFO A");
+	else if (!strcmp(args, "VFOB"))
+		remote_execute_from(REMOTE_HAMLIB, "VFO B");
+	else if (strcmp(args, "currVFO"))
+		return RIG_EINVAL;
+	return RIG_OK;
+}
 
-  welcome_socket = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-  
-  serverAddr.sin_family = AF_INET;
-  serverAddr.sin_port = htons(4532);
-  serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
-  memset(serverAddr.sin_zero, '\0', sizeof serverAddr.sin_zero);  
+static int rig_get_ptt(char *vfo, char *args, char *reply){
+	//the radio's own state, a T only queues the change
+	sprintf(reply, "%d\n", is_in_tx() ? 1 : 0);
+	return RIG_OK;
+}
 
-  /*---- Bind the address struct to the socket ----*/
-  bind(welcome_socket, (struct sockaddr *) &serverAddr, sizeof(serverAddr));
+static int rig_set_ptt(char *vfo, char *args, char *reply){
+	if (!isdigit(args[0]))
+		return RIG_EINVAL;
+	remote_execute_from(REMOTE_HAMLIB, atoi(args) ? "ptt 1" : "ptt 0");
+	return RIG_OK;
+}
 
-  /*---- Listen on the socket, with 5 max connection requests queued ----*/
-  if(listen(welcome_socket,5)!=0)
-    printf("hamlib listen() Error\n");
-  incoming_ptr = 0;
+static int rig_get_split_vfo(char *vfo, char *args, char *reply){
+	if (!strcmp(field_str("SPLIT"), "ON"))
+		strcpy(reply, "1\nVFOB\n");
+	else
+		strcpy(reply, "0\nVFOA\n");
+	return RIG_OK;
 }
 
-void hamlib_slice(){
-  struct sockaddr_storage server_storage;
-  socklen_t addr_size;
-  int e, len;
-  char buffer[1024];
+static int rig_set_split_vfo(char *vfo, char *args, char *reply){
+	int split = atoi(args);
+
+	if (split != !strcmp(field_str("SPLIT"), "ON"))
+		remote_execute_from(REMOTE_HAMLIB, split ? "SPLIT ON" : "SPLIT OFF");
+	return RIG_OK;
+}
+
+static int rig_get_split_freq(char *vfo, char *args, char *reply){
+	return rig_get_freq("VFOB", args, reply);
+}
+
+static int rig_set_split_freq(char *vfo, char *args, char *reply){
+	return rig_set_freq("VFOB", args, reply);
+}
 
-  if (data_socket == -1){
-    addr_size = sizeof server_storage;
-    e = accept(welcome_socket, (struct sockaddr *) &server_storage, &addr_size);
-    if (e == -1)
-      return;
-    puts("Hamlib connected\n");
-    incoming_ptr = 0;
-    data_socket = e;
-    fcntl(data_socket, F_SETFL, fcntl(data_socket, F_GETFL) | O_NONBLOCK);
-  }
-  else { 
-    len = recv(data_socket, buffer, sizeof(buffer), 0);
-    if (len >= 0){
-      buffer[len] = 0;
-      hamlib_handler(buffer, len);
-    }
-    else {
-      //e = errno();
-      if (errno == EAGAIN || errno == EWOULDBLOCK)
-        return;
-      //for other errors, just close the socket
-			puts("Hamlib connection dropped. Restarting to listen ..."); 
-      close(data_socket);
-      data_socket = -1;      
-    }
-  } 
+//there is just one mode, for the rx and the tx
+static int rig_set_split_mode(char *vfo, char *args, char *reply){
+	return rig_set_mode(vfo, args, reply);
 }
+
+static int rig_get_level(char *vfo, char *args, char *reply){
+	if (!strcmp(args, "STRENGTH")){
+		//the smeter is in s-units * 100 + the db over it
+		int smeter = field_int("SMETER");
+		sprintf(reply, "%d\n", ((smeter / 100) - 9) * 6 + (smeter % 100));
+	}
+	else if (!strcmp(args, "RFPOWER"))
+		sprintf(reply, "%.2f\n", field_int("DRIVE") / 100.0);
+	else if (!strcmp(args, "AF"))
+		sprintf(reply, "%.2f\n", field_int("AUDIO") / 100.0);
+	else if (!strcmp(args, "SWR"))
+		sprintf(reply, "%.1f\n", is_in_tx() ? field_int("REF") / 10.0 : 1.0);
+	else if (!strcmp(args, "RFPOWER_METER_WATTS"))
+		sprintf(reply, "%.1f\n", is_in_tx() ? field_int("POWER") / 10.0 : 0.0);
+	else
+		return RIG_EINVAL;
+	return RIG_OK;
+}
+
+static int rig_set_level(char *vfo, char *args, char *reply){
+	char level[30], cmd[50];
+	float value;
+
+	if (sscanf(args, "%29s %f", level, &value) != 2 || value < 0 || value > 1)
+		return RIG_EINVAL;
+	if (!strcmp(level, "RFPOWER"))
+		sprintf(cmd, "DRIVE %d", (int)(value * 100 + 0.5));
+	else if (!strcmp(level, "AF"))
+		sprintf(cmd, "AUDIO %d", (int)(value * 100 + 0.5));
+	else
+		return RIG_EINVAL;
+	remote_execute_from(REMOTE_HAMLIB, cmd);
+	return RIG_OK;
+}
+
+static int rig_dump_state(char *vfo, char *args, char *reply){
+	strcpy(reply, dump_state_response);
+	return RIG_OK;
+}
+
+static int rig_chk_vfo(char *vfo, char *args, char *reply){
+	strcpy(reply, "CHKVFO 1\n");
+	return RIG_OK;
+}
+
+static int rig_get_powerstat(char *vfo, char *args, char *reply){
+	strcpy(reply, "1\n");
+	return RIG_OK;
+}
+
+static int rig_get_info(char *vfo, char *args, char *reply){
+	sprintf(reply, "%s\n", VER_STR);
+	return RIG_OK;
+}
+
+static int rig_quit(char *vfo, char *args, char *reply){
+	netio_close(hamlib_client);
+	return RIG_OK;
+}
+
+/* the labels "" mark the commands that answer with a block of their own */
+static struct rig_cmd rig_cmds[] = {
+	{'f', "get_freq", "Frequency", rig_get_freq},
+	{'F', "set_freq", NULL, rig_set_freq},
+	{'m', "get_mode", "Mode/Passband", rig_get_mode},
+	{'M', "set_mode", NULL, rig_set_mode},
+	{'v', "get_vfo", "VFO", rig_get_vfo},
+	{'V', "set_vfo", NULL, rig_set_vfo},
+	{'t', "get_ptt", "PTT", rig_get_ptt},
+	{'T', "set_ptt", NULL, rig_set_ptt},
+	{'s', "get_split_vfo", "Split/TX VFO", rig_get_split_vfo},
+	{'S', "set_split_vfo", NULL, rig_set_split_vfo},
+	{'i', "get_split_freq", "TX Frequency", rig_get_split_freq},
+	{'I', "set_split_freq", NULL, rig_set_split_freq},
+	{'x', "get_split_mode", "TX Mode/TX Passband", rig_get_mode},
+	{'X', "set_split_mode", NULL, rig_set_split_mode},
+	{'l', "get_level", "Level Value", rig_get_level},
+	{'L', "set_level", NULL, rig_set_level},
+	{'_', "get_info", "Info", rig_get_info},
+	{0, "get_powerstat", "Power Status", rig_get_powerstat},
+	{0, "dump_state", "", rig_dump_state},
+	{0, "chk_vfo", "", rig_chk_vfo},
+	{'q', "quit", NULL, rig_quit},
+	{0, NULL, NULL, NULL}
+};
+
+static int is_vfo(char *token){
+	return !strncmp(token, "VFO", 3) || !strcmp(token, "currVFO") 
+		|| !strcmp(token, "Main") || !strcmp(token, "Sub");
+}
+
+static void rig_respond(struct rig_cmd *c, char sep, char *args, int e, char *values){
+	char response[2000];
+	int n = 0;
+
+	if (!sep){
+		if (e != RIG_OK)
+			sprintf(response, "RPRT %d\n", e);
+		else if (c->labels)
+			strcpy(response, values);
+		else
+			strcpy(response, "RPRT 0\n");
+		send_response(response);
+		return;
+	}
+
+	n = sprintf(response, "%s:%s%s\n", c->name, args[0] ? " " : "", args);
+	if (e == RIG_OK && c->labels && c->labels[0]){
+		char labels[100], *label, *save_label, *value, *save_value;
+		strcpy(labels, c->labels);
+		label = strtok_r(labels, "/", &save_label);
+		value = strtok_r(values, "\n", &save_value);
+		while (label && value){
+			n += sprintf(response + n, "%s: %s\n", label, value);
+			label = strtok_r(NULL, "/", &save_label);
+			value = strtok_r(NULL, "\n", &save_value);
+		}
+	}
+	else if (e == RIG_OK && c->labels)
+		n += sprintf(response + n, "%s", values);
+	sprintf(response + n, "RPRT %d\n", e);
+
+	//all but the last new line are separators
+	if (sep != '\n')
+		for (char *p = response; p[1]; p++)
+			if (*p == '\n')
+				*p = sep;
+	send_response(response);
+}
+
+void interpret_command(char *cmd){
+	char name[30], vfo[20], values[1500];
+	char sep = 0;
+	struct rig_cmd *c;
+	char *line = cmd;
+	int i;
+
+	if (!*cmd)
+		return;
+	if (strchr("+;|,", *cmd)){
+		sep = *cmd == '+' ? '\n' : *cmd;
+		cmd++;
+	}
+
+	//the command is a single letter or a \long_name
+	if (*cmd == '\\'){
+		cmd++;
+		for (i = 0; *cmd > ' ' && i < sizeof(name) - 1; i++)
+			name[i] = *cmd++;
+		name[i] = 0;
+		for (c = rig_cmds; c->name; c++)
+			if (!strcmp(c->name, name))
+				break;
+	}
+	else {
+		for (c = rig_cmds; c->name; c++)
+			if (c->cmd && c->cmd == *cmd)
+				break;
+		if (*cmd)
+			cmd++;
+	}
+
+	if (!c->name){
+		printf("Hamlib: Unrecognized command [%s]\n", line);
+		send_response("RPRT -4\n");
+		return;
+	}
+
+	while (*cmd == ' ')
+		cmd++;
+
+	//the optional vfo
+	vfo[0] = 0;
+	for (i = 0; cmd[i] > ' ' && i < sizeof(vfo) - 1; i++)
+		vfo[i] = cmd[i];
+	vfo[i] = 0;
+	if (c->fn != rig_set_vfo && is_vfo(vfo)){
+		cmd += i;
+		while (*cmd == ' ')
+			cmd++;
+	}
+	else
+		vfo[0] = 0;
+
+	values[0] = 0;
+	int e = c->fn(vfo, cmd, values);
+	if (c->fn != rig_quit)
+		rig_respond(c, sep, cmd, e, values);
+}
+
+/* this is called on the netio thread for each line from a client.
+	the commands that change the radio are queued for the gtk thread,
+	a command is held back until those queued before it are done,
+	so that a get after a set sees the new value */
+static int hamlib_line(int client, char *line){
+	if (remote_pending(REMOTE_HAMLIB))
+		return NETIO_LATER;
+//	printf("<<<hamlib cmd %s =>", line);
+	hamlib_client = client;
+	interpret_command(line);
+	return 0;
+}
+
+void hamlib_start(){
+	netio_listen("hamlib", "127.0.0.1", 4532, NULL, hamlib_line);
+}
+
 /*
 int main(){
   struct sockaddr_storage serverStorage;
@@ -258,10 +472,9 @@ int main(){
   puts("Starting server\n");
   hamlib_start();
   puts("Server started\n");
-  while (1){
-    hamlib_slice();
-    usleep(1000);
-  }
+  netio_start();
+  while (1)
+    sleep(1);
   return 0;
 }
 */
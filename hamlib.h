@@ -1,3 +1 @@
 void hamlib_start();
-void hamlib_slice();
-
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
+#include <time.h>
 #include "sdr_ui.h"
 #include "logbook.h"
 #include "hist_disp.h"
@@ -86,11 +87,15 @@ int hd_message_parse(struct hd_message_struct* p_message, char* raw_message) {
 	return 0;
 }
 
+//the band and mode the worked before lookups are made for, set by hd_decorate()
+static int hd_freq_khz = 0;
+static char hd_mode[10];
+
 int ff_lookup_style(char* id, int style, int style_default) {
 	switch (style)
 	{
 	case FF_CALLER:
-		return logbook_caller_exists(id) ? style_default : style;
+		return logbook_caller_worked(id, hd_freq_khz, hd_mode) ? style_default : style;
 		// return style; // test skipping log lookup
 		break;
 
@@ -100,7 +105,7 @@ int ff_lookup_style(char* id, int style, int style_default) {
 			isLetter(id[0]) && isLetter(id[1]) &&
         	isDigit(id[2]) && isDigit(id[3]));
 			
-			return (!id_ok || logbook_grid_exists(id)) ? style_default : style;
+			return (!id_ok || logbook_grid_worked(id, hd_freq_khz, hd_mode)) ? style_default : style;
 			//return (!id_ok) ? style_default : style; // test skipping log lookup
 		}
 		break;
@@ -177,6 +182,9 @@ int hd_decorate(int style, char * message, char * decorated) {
 		decorated[0] = 0;
 			struct hd_message_struct fms;
 			const char* my_callsign = field_str("MYCALLSIGN");
+			//a station is new until it is worked on this band in this mode
+			hd_freq_khz = field_int("FREQ") / 1000;
+			snprintf(hd_mode, sizeof(hd_mode), "%s", field_str("MODE"));
 			int res = hd_message_parse(&fms, message);
 			if (res == 0) {
 				if (!strcmp(fms.m1, "CQ")) { 
@@ -205,3 +213,32 @@ int hd_decorate(int style, char * message, char * decorated) {
 	}
 	return 0;
 }
+
+/* decoration benchmark, it times hd_decorate() on a slot's worth of 
+FT8 decodes. Each of them looks up its callsign and grid in the log. 
+To run it, uncomment this and call it from main() after field_init()
+
+void hd_benchmark(){
+	char *messages[] = {
+		"123000  -12  1.2 1234 ~ CQ VU2ESE MK68",
+		"123000  -03  0.3 1512 ~ CQ DX W1AW FN31",
+		"123000  -18  0.8  980 ~ JA1XYZ VK2ABC QF56",
+		"123000  -07  0.1 2210 ~ G4ABC EA8XYZ -15",
+		"123000  -21  1.9  640 ~ K1ABC F5XYZ RR73",
+		NULL
+	};
+	char decorated[1000];
+	struct timespec start, stop;
+	int n = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < 10000; i++)
+		for (int j = 0; messages[j]; j++){
+			hd_decorate(FONT_FT8_RX, messages[j], decorated);
+			n++;
+		}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	double nsecs = (stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec);
+	printf("hd_decorate: %.0f nsec per message\n", nsecs / n);
+}
+*/
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "i2cbb.h"
+#include "i2c.h"
+
+/*
+	The i2c transport.
+	A backend is a set of five calls. The rest of the code calls the
+	i2c_ functions below, they hold the bus lock, pass the call to the
+	current backend and time it.
+
+	The bit-banged backend spins the cpu through every bit, on a busy bus
+	(the si5351 tuning, the zbitx panel) that adds up. Where the board
+	wiring allows, the same transactions can go through the kernel's driver.
+	The pins 23 and 22 (wiringPi numbering) are not the Pi's hardware
+	i2c pins, on the existing boards the kernel's i2c-gpio overlay can
+	still drive them and shows up as /dev/i2c-N.
+
+	The bus is picked with i2c= in hw_settings.ini.
+*/
+
+#define I2C_SDA 23
+#define I2C_SCL 22
+#define I2CDEV_RLL_MAX 64	//i2c-dev has to be told the length of a read upfront
+
+struct i2c_backend {
+	char *name;
+	int (*open)(const char *device);
+	int32_t (*write_block)(uint8_t address, uint8_t command, uint8_t length,
+		const uint8_t *values);
+	int32_t (*read_block)(uint8_t address, uint8_t length, uint8_t *values);
+	int32_t (*write_read)(uint8_t address, const uint8_t *out, uint8_t out_length,
+		uint8_t *in, uint8_t in_length);
+	int32_t (*read_rll)(uint8_t address, uint8_t *values);
+
+	//timing stats
+	unsigned long transactions, errors, bytes;
+	unsigned long usec, worst_usec;
+};
+
+static pthread_mutex_t i2c_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* bit-banged */
+
+static int bb_open(const char *device){
+	i2cbb_init(I2C_SDA, I2C_SCL);
+	return 0;
+}
+
+static int32_t bb_read_block(uint8_t address, uint8_t length, uint8_t *values){
+	return i2cbb_read_i2c_block_data(address, 0, length, values);
+}
+
+static struct i2c_backend bb_backend = {
+	"bitbang", bb_open, i2cbb_write_i2c_block_data, bb_read_block,
+	i2cbb_write_read, i2cbb_read_rll
+};
+
+/* kernel's i2c-dev */
+
+static int i2cdev_fd = -1;
+
+static int i2cdev_open(const char *device){
+	i2cdev_fd = open(device, O_RDWR);
+	if (i2cdev_fd < 0){
+		printf("*Error: unable to open %s: %s\n", device, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int i2cdev_transfer(struct i2c_msg *msgs, int count){
+	struct i2c_rdwr_ioctl_data data;
+
+	data.msgs = msgs;
+	data.nmsgs = count;
+	if (ioctl(i2cdev_fd, I2C_RDWR, &data) != count)
+		return -1;
+	return 0;
+}
+
+static int32_t i2cdev_write_block(uint8_t address, uint8_t command, uint8_t length,
+	const uint8_t *values){
+	uint8_t buff[257];
+	struct i2c_msg msg = {address, 0, length + 1, buff};
+
+	buff[0] = command;
+	if (length)
+		memcpy(buff + 1, values, length);
+	return i2cdev_transfer(&msg, 1);
+}
+
+static int32_t i2cdev_read_block(uint8_t address, uint8_t length, uint8_t *values){
+	struct i2c_msg msg = {address, I2C_M_RD, length, values};
+
+	if (i2cdev_transfer(&msg, 1))
+		return -1;
+	return length;
+}
+
+static int32_t i2cdev_write_read(uint8_t address, const uint8_t *out, uint8_t out_length,
+	uint8_t *in, uint8_t in_length){
+	struct i2c_msg msgs[2] = {
+		{address, 0, out_length, (uint8_t *)out},
+		{address, I2C_M_RD, in_length, in}
+	};
+
+	if (i2cdev_transfer(msgs, 2))
+		return -1;
+	return in_length;
+}
+
+//reads a window, the device pads what is past its reply
+static int32_t i2cdev_read_rll(uint8_t address, uint8_t *values){
+	uint8_t buff[I2CDEV_RLL_MAX + 1];
+	struct i2c_msg msg = {address, I2C_M_RD, sizeof(buff), buff};
+
+	if (i2cdev_transfer(&msg, 1))
+		return -1;
+	if (buff[0] > I2CDEV_RLL_MAX){
+		printf("*Error: i2c reply of %d bytes from %x is too long\n", buff[0], address);
+		return -1;
+	}
+	memcpy(values, buff + 1, buff[0]);
+	return buff[0];
+}
+
+static struct i2c_backend i2cdev_backend = {
+	"i2c-dev", i2cdev_open, i2cdev_write_block, i2cdev_read_block,
+	i2cdev_write_read, i2cdev_read_rll
+};
+
+/* mock, each address is a bank of registers that auto-increment */
+
+static uint8_t mock_regs[128][256];
+static uint8_t mock_pointer[128];
+static uint8_t mock_reply[128][256];
+static int mock_reply_length[128];
+
+static int mock_open(const char *device){
+	memset(mock_regs, 0, sizeof(mock_regs));
+	memset(mock_pointer, 0, sizeof(mock_pointer));
+	memset(mock_reply_length, 0, sizeof(mock_reply_length));
+	return 0;
+}
+
+static int32_t mock_write_block(uint8_t address, uint8_t command, uint8_t length,
+	const uint8_t *values){
+	address &= 0x7f;
+	mock_pointer[address] = command;
+	for (int i = 0; i < length; i++)
+		mock_regs[address][mock_pointer[address]++] = values[i];
+	return 0;
+}
+
+static int32_t mock_read_block(uint8_t address, uint8_t length, uint8_t *values){
+	address &= 0x7f;
+	for (int i = 0; i < length; i++)
+		values[i] = mock_regs[address][mock_pointer[address]++];
+	return length;
+}
+
+static int32_t mock_write_read(uint8_t address, const uint8_t *out, uint8_t out_length,
+	uint8_t *in, uint8_t in_length){
+	if (out_length)
+		mock_write_block(address, out[0], out_length - 1, out + 1);
+	return mock_read_block(address, in_length, in);
+}
+
+static int32_t mock_read_rll(uint8_t address, uint8_t *values){
+	int length = mock_reply_length[address & 0x7f];
+
+	memcpy(values, mock_reply[address & 0x7f], length);
+	mock_reply_length[address & 0x7f] = 0;
+	return length;
+}
+
+static struct i2c_backend mock_backend = {
+	"mock", mock_open, mock_write_block, mock_read_block,
+	mock_write_read, mock_read_rll
+};
+
+void i2c_mock_reply(uint8_t address, const uint8_t *reply, uint8_t length){
+	pthread_mutex_lock(&i2c_lock);
+	memcpy(mock_reply[address & 0x7f], reply, length);
+	mock_reply_length[address & 0x7f] = length;
+	pthread_mutex_unlock(&i2c_lock);
+}
+
+int i2c_mock_register(uint8_t address, uint8_t reg){
+	return mock_regs[address & 0x7f][reg];
+}
+
+/* the bus */
+
+static struct i2c_backend *bus = NULL;
+
+static unsigned long i2c_usec(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
+//this is called with the bus locked
+static void i2c_start(){
+	if (!bus){
+		bus = &bb_backend;
+		bus->open(NULL);
+	}
+}
+
+static void i2c_end(unsigned long start, int32_t e, int bytes){
+	unsigned long t = i2c_usec() - start;
+
+	bus->transactions++;
+	bus->usec += t;
+	if (t > bus->worst_usec)
+		bus->worst_usec = t;
+	if (e < 0)
+		bus->errors++;
+	else
+		bus->bytes += bytes;
+}
+
+//bus is "bitbang", "mock" or a device like "/dev/i2c-3"
+int i2c_init(const char *bus_name){
+	struct i2c_backend *b = &bb_backend;
+	int e;
+
+	if (bus_name && !strcmp(bus_name, "mock"))
+		b = &mock_backend;
+	else if (bus_name && !strncmp(bus_name, "/dev/", 5))
+		b = &i2cdev_backend;
+
+	pthread_mutex_lock(&i2c_lock);
+	e = b->open(bus_name);
+	if (e){
+		printf("*Error: falling back to the bit-banged i2c\n");
+		b = &bb_backend;
+		b->open(NULL);
+	}
+	bus = b;
+	pthread_mutex_unlock(&i2c_lock);
+	printf("i2c bus is %s\n", b->name);
+	return e;
+}
+
+int32_t i2c_write_block(uint8_t address, uint8_t command, uint8_t length,
+	const uint8_t *values){
+	pthread_mutex_lock(&i2c_lock);
+	i2c_start();
+	unsigned long start = i2c_usec();
+	int32_t e = bus->write_block(address, command, length, values);
+	i2c_end(start, e, length + 2);
+	pthread_mutex_unlock(&i2c_lock);
+	return e;
+}
+
+int32_t i2c_read_block(uint8_t address, uint8_t length, uint8_t *values){
+	pthread_mutex_lock(&i2c_lock);
+	i2c_start();
+	unsigned long start = i2c_usec();
+	int32_t e = bus->read_block(address, length, values);
+	i2c_end(start, e, length + 1);
+	pthread_mutex_unlock(&i2c_lock);
+	return e;
+}
+
+int32_t i2c_write_read(uint8_t address, const uint8_t *out, uint8_t out_length,
+	uint8_t *in, uint8_t in_length){
+	pthread_mutex_lock(&i2c_lock);
+	i2c_start();
+	unsigned long start = i2c_usec();
+	int32_t e = bus->write_read(address, out, out_length, in, in_length);
+	i2c_end(start, e, out_length + in_length + 2);
+	pthread_mutex_unlock(&i2c_lock);
+	return e;
+}
+
+int32_t i2c_read_rll(uint8_t address, uint8_t *values){
+	pthread_mutex_lock(&i2c_lock);
+	i2c_start();
+	unsigned long start = i2c_usec();
+	int32_t e = bus->read_rll(address, values);
+	i2c_end(start, e, e + 2);
+	pthread_mutex_unlock(&i2c_lock);
+	return e;
+}
+
+int32_t i2c_write_byte_data(uint8_t address, uint8_t command, uint8_t value){
+	return i2c_write_block(address, command, 1, &value);
+}
+
+int32_t i2c_read_byte_data(uint8_t address, uint8_t command){
+	uint8_t value;
+
+	if (i2c_write_read(address, &command, 1, &value, 1) < 0)
+		return -1;
+	return value;
+}
+
+void i2c_stats(char *buff){
+	struct i2c_backend *b = bus ? bus : &bb_backend;
+	unsigned long n = b->transactions ? b->transactions : 1;
+	unsigned long usec = b->usec ? b->usec : 1;
+
+	sprintf(buff, "i2c %s: %lu transactions, %lu errors, %lu bytes, "
+		"%lu usec avg, %lu usec worst, %lu bytes/sec\n",
+		b->name, b->transactions, b->errors, b->bytes,
+		b->usec / n, b->worst_usec,
+		(unsigned long)(b->bytes * 1000000.0 / usec));
+}
+
+/* exercises the bus, with no argument it runs on the mock
+void main(int argc, char **argv){
+	uint8_t out[2] = {0x10, 0x20}, reg = 26, in[4], reply[3] = {'O', 'K', 0};
+	char buff[200];
+
+	i2c_init(argc > 1 ? argv[1] : "mock");
+	for (int i = 0; i < 1000; i++)
+		i2c_write_block(0x60, 26, 2, out);
+	i2c_write_read(0x60, &reg, 1, in, 2);
+	printf("read back %02x %02x\n", in[0], in[1]);
+	i2c_mock_reply(0xa, reply, 3);
+	printf("panel says %d bytes, %s\n", i2c_read_rll(0xa, in), in);
+	i2c_stats(buff);
+	printf("%s", buff);
+}
+*/
@@ -0,0 +1,31 @@
+/*
+	The i2c bus of the sbitx/zbitx.
+	All the devices on the bus (the Si5351, the power sensor, the RTC, the oled
+	and the zbitx front panel) are reached through these calls. They go to
+	one of the backends, picked by i2c_init():
+	"bitbang"     - the GPIO bit-banged driver in i2cbb.c, the default
+	"/dev/i2c-N"  - the kernel's i2c driver through i2c-dev
+	"mock"        - no hardware, each address is a bank of 256 registers
+*/
+
+int i2c_init(const char *bus);
+
+// these return -1 on error, else zero (or the byte read)
+int32_t i2c_write_byte_data(uint8_t address, uint8_t command, uint8_t value);
+int32_t i2c_read_byte_data(uint8_t address, uint8_t command);
+int32_t i2c_write_block(uint8_t address, uint8_t command, uint8_t length,
+	const uint8_t *values);
+
+// these return -1 on error, else the number of bytes read
+int32_t i2c_read_block(uint8_t address, uint8_t length, uint8_t *values);
+// writes out and reads back in a single transaction (with a repeated start)
+int32_t i2c_write_read(uint8_t address, const uint8_t *out, uint8_t out_length,
+	uint8_t *in, uint8_t in_length);
+// reads a variable length block, the first byte gives the number of bytes to follow
+int32_t i2c_read_rll(uint8_t address, uint8_t *values);
+
+void i2c_stats(char *buff);
+
+// the next reads of i2c_read_rll() from the mock return this, once
+void i2c_mock_reply(uint8_t address, const uint8_t *reply, uint8_t length);
+int i2c_mock_register(uint8_t address, uint8_t reg);
@@ -274,8 +274,6 @@ int32_t i2cbb_read_byte_data(uint8_t i2c_address, uint8_t command) {
 }
 
 
-int i2c_busy = 0;
-
 // 7 bit address + 1 bit read/write
 // read = 1, write = 0
 // http://www.totalphase.com/support/articles/200349176-7-bit-8-bit-and-10-bit-I2C-Slave-Addressing
@@ -284,14 +282,6 @@ int i2c_busy = 0;
 int32_t i2cbb_write_i2c_block_data(uint8_t i2c_address, uint8_t command, 
 	uint8_t length, const uint8_t * values) {
 
-	for (int i = 0; i < 100; i++){
-		if (!i2c_busy)
-			break;
-		printf("i2c busy\n");
-		delay(2);
-	}
-	i2c_busy++;
-
 	i2c_error = 0;
   uint8_t address = (i2c_address << 1) | 0;
 
@@ -307,10 +297,8 @@ int32_t i2cbb_write_i2c_block_data(uint8_t i2c_address, uint8_t command,
 
       i2c_stop_cond();
 
-      if (!errors){
-				i2c_busy--;
+      if (!errors)
         return i2c_error;
-			}
 			i2c_error = -1;
 		  printf("i2cbb: write byte failed at index %d\n", i);
       }
@@ -324,7 +312,6 @@ int32_t i2cbb_write_i2c_block_data(uint8_t i2c_address, uint8_t command,
 		printf("i2cbb: address failed %x, cmd %x, length%d\n",
 			address, command, length);
 	}
-	i2c_busy--;
   return -1;
 }
 
@@ -384,3 +371,36 @@ int32_t i2cbb_read_rll(uint8_t i2c_address, uint8_t* values) {
 	i2c_stop_cond();
   return length;
 }
+
+// writes out and then reads back in with a repeated start in between, 
+// returns the number of bytes read or -1
+int32_t i2cbb_write_read(uint8_t i2c_address, const uint8_t *out, uint8_t out_length,
+	uint8_t *in, uint8_t in_length) {
+	uint8_t address = (i2c_address << 1) | 0;
+
+	if (i2c_write_byte(1, 0, address)){ 
+		i2c_stop_cond();
+		return -1;
+	}
+	for (int i = 0; i < out_length; i++)
+		if (i2c_write_byte(0, 0, out[i])){
+			i2c_stop_cond();
+			return -1;
+		}
+
+	//i2c_started is still set, this goes out as a repeated start
+	address = (i2c_address << 1) | 1;
+	if (i2c_write_byte(1, 0, address)){ 
+		i2c_stop_cond();
+		return -1;
+	}
+	if (!in_length){
+		i2c_stop_cond();
+		return 0;
+	}
+	uint8_t i = 0;
+  for (i = 0; i < in_length - 1; i++) 
+  	in[i] = i2c_read_byte(0,0);
+	in[i] = i2c_read_byte(1,1);
+  return in_length;
+}
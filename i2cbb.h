@@ -24,3 +24,7 @@ int32_t i2cbb_read_i2c_block_data (uint8_t i2c_address, uint8_t command, uint8_t
 
 // reads a variable length block, the first byte gives the number of bytes to follow
 int32_t i2cbb_read_rll(uint8_t i2c_address, uint8_t* values); 
+
+// writes out and reads back in, with a repeated start in between
+int32_t i2cbb_write_read(uint8_t i2c_address, const uint8_t *out, uint8_t out_length,
+	uint8_t *in, uint8_t in_length);
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
 #include <fcntl.h> 
@@ -12,11 +13,16 @@
 #include <linux/types.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
 #include <time.h>
 #include <stdbool.h>
 #include <sys/types.h>
 #include <stdint.h>
 #include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <strings.h>
 #include <time.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -27,11 +33,13 @@
 #include "sdr.h"
 #include "sdr_ui.h"
 #include "logbook.h"
+#include "adif.h"
 
 #include <sqlite3.h>
 
 static int rc;
 static sqlite3 *db=NULL;
+static char log_db_path[200];
 GtkListStore *list_store=NULL;
 GtkTreeSelection *selection = NULL;
 GtkWidget *logbook_window = NULL;
@@ -39,124 +47,205 @@ GtkWidget *logbook_window = NULL;
 void logbook_open();
 int logbook_fill(int from_id, int count, char *query);
 void clear_tree(GtkListStore *list_store);
+static void worked_qso(int id, int delta);
+static void worked_load();
+static void worked_add(const char *callsign, const char *grid, int freq_khz, 
+	const char *mode, int delta);
+static void log_writer_start(char *db_path);
+static void logbook_list_refresh();
+
+/* The statements.
+	Each query on the log is compiled once, when the log is opened, and
+	kept. The web server, the zbitx panel and the gtk each run them from
+	their own thread, a statement can only be stepped by one of them at a
+	time, so they are taken with log_statement() and given back with
+	log_statement_done(), which holds a lock in between.
+	The columns are named, not *, so that the columns added to the table
+	later don't shift the ones that the web and the ADIF export expect. */
+
+#define LOG_COLUMNS "id, mode, freq, qso_date, qso_time, callsign_sent, " \
+	"rst_sent, exch_sent, callsign_recv, rst_recv, exch_recv, tx_id, comments"
+
+//the columns in the order of LOG_COLUMNS
+enum {
+	COL_ID, COL_MODE, COL_FREQ, COL_QSO_DATE, COL_QSO_TIME, COL_CALLSIGN_SENT,
+	COL_RST_SENT, COL_EXCH_SENT, COL_CALLSIGN_RECV, COL_RST_RECV, COL_EXCH_RECV,
+	COL_TX_ID, COL_COMMENTS
+};
 
-/* writes the output to data/result_rows.txt
-	if the from_id is negative, it returns the later 50 records (higher id)
-	if the from_id is positive, it returns the prior 50 records (lower id) */
+enum {
+	LOG_PAGE,
+	LOG_DUP,
+	LOG_PREV,
+	LOG_GRIDS,
+	LOG_ADIF,
+	LOG_WORKED_ROW,
+	LOG_WORKED_ALL,
+	LOG_DELETE,
+	LOG_UPDATE,
+	LOG_STATEMENTS
+};
 
-int logbook_query(char *query, int from_id, char *result_file){
-	sqlite3_stmt *stmt;
-	char statement[200], json[10000], param[2000];
+static char *log_sql[LOG_STATEMENTS] = {
+	//a page of the log, newest first: callsign prefix, below id, above id, rows
+	"SELECT " LOG_COLUMNS " FROM logbook "
+		"WHERE (?1 IS NULL OR callsign_recv LIKE ?1 || '%') AND id < ?2 AND id > ?3 "
+		"ORDER BY id DESC LIMIT ?4",
+	"SELECT COUNT(*) FROM logbook WHERE callsign_recv = ? AND epoch >= ?",
+	"SELECT " LOG_COLUMNS " FROM logbook WHERE callsign_recv = ? ORDER BY id DESC",
+	"SELECT exch_recv, COUNT(*) AS n FROM logbook GROUP BY exch_recv ORDER BY exch_recv",
+	"SELECT " LOG_COLUMNS " FROM logbook WHERE qso_date >= ? AND qso_date <= ? "
+		"ORDER BY id DESC",
+	"SELECT callsign_recv, exch_recv, freq, mode FROM logbook WHERE id = ?",
+	"SELECT callsign_recv, exch_recv, freq, mode FROM logbook",
+	"DELETE FROM logbook WHERE id = ?",
+	"UPDATE logbook SET mode = ?, freq = ?, callsign_recv = ?, rst_sent = ?, "
+		"exch_sent = ?, rst_recv = ?, exch_recv = ?, comments = ? WHERE id = ?"
+};
+
+static sqlite3_stmt *log_stmts[LOG_STATEMENTS];
+static pthread_mutex_t log_stmt_lock = PTHREAD_MUTEX_INITIALIZER;
 
+static void log_prepare(){
+	for (int i = 0; i < LOG_STATEMENTS; i++)
+		if (sqlite3_prepare_v2(db, log_sql[i], -1, log_stmts + i, NULL) != SQLITE_OK)
+			printf("*Error: logbook statement %d: %s\n", i, sqlite3_errmsg(db));
+}
+
+//the statement is NULL if it didn't compile, it must be given back all the same
+static sqlite3_stmt *log_statement(int which){
 	if (db == NULL)
 		logbook_open();
+	pthread_mutex_lock(&log_stmt_lock);
+	return log_stmts[which];
+}
+
+static void log_statement_done(sqlite3_stmt *stmt){
+	if (stmt){
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+	pthread_mutex_unlock(&log_stmt_lock);
+}
 
+//binds the paging of logbook_rows() and logbook_fill()
+static void log_bind_page(sqlite3_stmt *stmt, char *query, int from_id, int count){
+	if (query)
+		sqlite3_bind_text(stmt, 1, query, -1, SQLITE_TRANSIENT);
 	//add to the bottom of the logbook
 	if (from_id > 0){
-		if (query)
-			sprintf(statement, "select * from logbook "
-				"where (callsign_recv LIKE '%s%%' AND id < %d) ",
-				query, from_id);
-		else
-			sprintf(statement, "select * from logbook where id < %d ", from_id);
+		sqlite3_bind_int(stmt, 2, from_id);
+		sqlite3_bind_int(stmt, 3, 0);
 	}
-	//last 50 QSOs
+	//the last QSOs
 	else if (from_id == 0){
-		if (query)
-			sprintf(statement, "select * from logbook "
-				"where callsign_recv LIKE '%s%%' ", query);
-		else
-			strcpy(statement, "select * from logbook ");
+		sqlite3_bind_int(stmt, 2, INT_MAX);
+		sqlite3_bind_int(stmt, 3, 0);
 	}
 	//latest QSOs after from_id (top of the log)
 	else {
-		if (query)
-			sprintf(statement, "select * from logbook "
-				"where (callsign_recv LIKE '%s%%' AND id > %d) ",
-				query, -from_id);
-		else 
-			sprintf(statement, "select * from logbook where id > %d ", -from_id); 
+		sqlite3_bind_int(stmt, 2, INT_MAX);
+		sqlite3_bind_int(stmt, 3, -from_id);
 	}
-	strcat(statement, "ORDER BY id DESC LIMIT 50;");
+	sqlite3_bind_int(stmt, 4, count);
+}
 
-	//printf("[%s]\n", statement);
-	sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
+/* appends to the text at n, returns the new length, never past the 
+	last byte of the buffer even when snprintf had to truncate */
+static int log_text_add(char *text, int n, int size, const char *fmt, ...){
+	va_list args;
+
+	if (n >= size - 1)
+		return size - 1;
+	va_start(args, fmt);
+	n += vsnprintf(text + n, size - n, fmt, args);
+	va_end(args);
+	return n < size ? n : size - 1;
+}
 
-	char output_path[200];	//dangerous, find the MAX_PATH and replace 200 with it
-	sprintf(output_path, "%s/sbitx/data/result_rows.txt", getenv("HOME"));
-	strcpy(result_file, output_path);
-	
-	FILE *pf = fopen(output_path, "w");
-	if (!pf)
-		return -1;
+/* a row as text, the columns separated by | (as the web expects them)
+	or as a json object */
+static void log_row_text(sqlite3_stmt *stmt, int format, char *text, int size){
+	int n = 0;
 
-	int rec = 0;
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		int i;
-		int num_cols = sqlite3_column_count(stmt);
-		for (i = 0; i < num_cols; i++){
-			switch (sqlite3_column_type(stmt, i))
-			{
-			case (SQLITE3_TEXT):
-				strcpy(param, sqlite3_column_text(stmt, i));
-				break;
-			case (SQLITE_INTEGER):
-				sprintf(param, "%d", sqlite3_column_int(stmt, i));
-				break;
-			case (SQLITE_FLOAT):
-				sprintf(param, "%g", sqlite3_column_double(stmt, i));
-				break;
-			case (SQLITE_NULL):
-				break;
-			default:
-				sprintf(param, "%d", sqlite3_column_type(stmt, i));
-				break;
-			}
-			//printf("%s|", param);
-			fprintf(pf, "%s|", param);
+	text[0] = 0;
+	if (format == LOGBOOK_JSON)
+		n = log_text_add(text, n, size, "{");
+	for (int i = 0; i < sqlite3_column_count(stmt) && n < size - 1; i++){
+		const char *value = sqlite3_column_text(stmt, i);
+		if (!value)
+			value = "";
+		if (format == LOGBOOK_PIPE){
+			n = log_text_add(text, n, size, "%s|", value);
+			continue;
+		}
+		if (sqlite3_column_type(stmt, i) == SQLITE_INTEGER){
+			n = log_text_add(text, n, size, "%s\"%s\":%s", i ? "," : "", 
+				sqlite3_column_name(stmt, i), value);
+			continue;
 		}
-		//printf("\n");
-		fprintf(pf, "\n");
+		n = log_text_add(text, n, size, "%s\"%s\":\"", i ? "," : "", 
+			sqlite3_column_name(stmt, i));
+		for (; *value && n < size - 8; value++){
+			if (*value == '"' || *value == '\\')
+				text[n++] = '\\';
+			if ((unsigned char)*value < ' ')
+				n += sprintf(text + n, "\\u%04x", *value);
+			else
+				text[n++] = *value;
+		}
+		text[n] = 0;
+		n = log_text_add(text, n, size, "\"");
 	}
-	sqlite3_finalize(stmt);
-	fclose(pf);
-	return rec;
+	log_text_add(text, n, size, format == LOGBOOK_JSON ? "}" : "\n");
 }
 
-int logbook_count_dup(const char *callsign, int last_seconds){
-	char date_str[100], time_str[100], statement[1000];
-	sqlite3_stmt *stmt;
+/* hands a page of the log to row(), a row at a time, newest first.
+	if the from_id is positive, it returns the count rows prior to it (lower id)
+	if the from_id is negative, it returns the count rows after -from_id (higher id)
+	if the from_id is zero, it returns the latest count rows
+	To page down, pass the id of the last row handed out as the next from_id.
+	The row() is called with the log's lock held, it must not call back
+	into the logbook. Returns the number of rows. */
+
+int logbook_rows(char *query, int from_id, int count, int format,
+	void (*row)(void *context, int id, char *text), void *context){
+	char text[3000];
+	int rec = 0;
 
-	time_t log_time = time_sbitx() - last_seconds;
-	struct tm *tmp = gmtime(&log_time);
-	sprintf(date_str, "%04d-%02d-%02d", tmp->tm_year + 1900, tmp->tm_mon + 1, tmp->tm_mday);
-	sprintf(time_str, "%02d%02d", tmp->tm_hour, tmp->tm_min);
-	
-	sprintf(statement, "select * from logbook where "
-		"callsign_recv=\"%s\" AND qso_date >= \"%s\" AND qso_time >= \"%s\"",
-		callsign, date_str, time_str);
+	sqlite3_stmt *stmt = log_statement(LOG_PAGE);
+	if (stmt)
+		log_bind_page(stmt, query, from_id, count);
+	while (stmt && sqlite3_step(stmt) == SQLITE_ROW) {
+		log_row_text(stmt, format, text, sizeof(text));
+		row(context, sqlite3_column_int(stmt, 0), text);
+		rec++;
+	}
+	log_statement_done(stmt);
+	return rec;
+}
 
-	sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
+int logbook_count_dup(const char *callsign, int last_seconds){
+	sqlite3_stmt *stmt = log_statement(LOG_DUP);
 	int rec = 0;
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		rec++;
+
+	if (stmt){
+		sqlite3_bind_text(stmt, 1, callsign, -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int64(stmt, 2, time_sbitx() - last_seconds);
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			rec = sqlite3_column_int(stmt, 0);
 	}
-	sqlite3_finalize(stmt);
+	log_statement_done(stmt);
 	return rec;
 }
 
 int logbook_get_grids(void (*f)(char *,int)) {
-	sqlite3_stmt *stmt;
-
-	char *statement = "SELECT exch_recv, COUNT(*) AS n FROM logbook "
-		"GROUP BY exch_recv order by exch_recv";
+	sqlite3_stmt *stmt = log_statement(LOG_GRIDS);
 
-	int res = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
-	//printf("%s : %d\n", statement, res);
 	int cnt = 0;
 	char grid[10];
 	int n = 0;
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
+	while (stmt && sqlite3_step(stmt) == SQLITE_ROW) {
 		int num_cols = sqlite3_column_count(stmt);
 		for (int i = 0; i < num_cols; i++){
 			char const *col_name = sqlite3_column_name(stmt, i);
@@ -170,55 +259,20 @@ int logbook_get_grids(void (*f)(char *,int)) {
 		f(grid,n);
 		cnt++;
 	}
-	sqlite3_finalize(stmt);
+	log_statement_done(stmt);
 	return cnt;
 }
 
-bool logbook_caller_exists(char * id) {
-	sqlite3_stmt *stmt;
-	char * statement = "SELECT EXISTS(SELECT 1 FROM logbook WHERE callsign_recv=?)";
-	int res = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
-	if (res != SQLITE_OK) return false;
-	bool exists = false;
-	res = sqlite3_bind_text(stmt, 1, id, strlen(id), SQLITE_STATIC);
-	if (res == SQLITE_OK) {
-		res = sqlite3_step(stmt);
-		int i = sqlite3_column_int(stmt, 0);
-		exists = ( res == SQLITE_ROW && i != 0);
-	}
-	sqlite3_finalize(stmt);
-	return exists;
-}
-
-bool logbook_grid_exists(char *id) {
-	sqlite3_stmt *stmt;
-	char * statement = "SELECT EXISTS(SELECT 1 FROM logbook WHERE exch_recv=?)";
-	int res = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
-	if (res != SQLITE_OK) return false;
-	bool exists = false;
-	res = sqlite3_bind_text(stmt, 1, id, strlen(id), SQLITE_STATIC);
-	if (res == SQLITE_OK) {
-		res = sqlite3_step(stmt);
-		int i = sqlite3_column_int(stmt, 0);
-		exists = ( res == SQLITE_ROW && i != 0);
-	}
-	sqlite3_finalize(stmt);
-	return exists;
-}
-
 int logbook_prev_log(const char *callsign, char *result){
-	char statement[1000], param[2000];
-	sqlite3_stmt *stmt;
+	char param[2000];
+	sqlite3_stmt *stmt = log_statement(LOG_PREV);
 
-	sprintf(statement, "select * from logbook where "
-		"callsign_recv=\"%s\" ORDER BY id DESC",
-		callsign);
 	strcpy(result, callsign);
 	strcat(result, ": ");
-	int res = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
-	//printf("%s : %d\n", statement, res);
+	if (stmt)
+		sqlite3_bind_text(stmt, 1, callsign, -1, SQLITE_TRANSIENT);
 	int rec = 0;
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
+	while (stmt && sqlite3_step(stmt) == SQLITE_ROW) {
 		int i;
 		int num_cols = sqlite3_column_count(stmt);
 		if (rec == 0) {
@@ -239,6 +293,7 @@ int logbook_prev_log(const char *callsign, char *result){
 					sprintf(param, "%g", sqlite3_column_double(stmt, i));
 					break;
 				case (SQLITE_NULL):
+					param[0] = 0;
 					break;
 				default:
 					sprintf(param, "%d", sqlite3_column_type(stmt, i));
@@ -252,7 +307,7 @@ int logbook_prev_log(const char *callsign, char *result){
 		}
 		rec++;
 	}
-	sqlite3_finalize(stmt);
+	log_statement_done(stmt);
 	sprintf(param, ": %d", rec);
 	strcat(result, param);
 	/*if (rec > 1) {
@@ -265,11 +320,45 @@ int logbook_prev_log(const char *callsign, char *result){
 	return rec;
 }
 
+/* the epoch column (seconds of UTC) came later, the logs from before
+	get it here, worked out from their date and time. The duplicate check
+	looks it up by callsign and time through the index */
+static void logbook_migrate(){
+	sqlite3_stmt *stmt;
+	char *err_msg = NULL;
+
+	if (sqlite3_prepare_v2(db, "SELECT epoch FROM logbook LIMIT 0", -1, &stmt, NULL)
+		== SQLITE_OK)
+		sqlite3_finalize(stmt);
+	else {
+		printf("Adding the epoch column to the logbook\n");
+		if (sqlite3_exec(db, "BEGIN;"
+			"ALTER TABLE logbook ADD COLUMN epoch INTEGER;"
+			"UPDATE logbook SET epoch = CAST(strftime('%s', qso_date || ' ' || "
+				"substr(qso_time, 1, 2) || ':' || substr(qso_time, 3, 2)) AS INTEGER);"
+			"COMMIT;", 0, 0, &err_msg) != SQLITE_OK){
+			printf("*Error: logbook migration: %s\n", err_msg);
+			sqlite3_free(err_msg);
+			sqlite3_exec(db, "ROLLBACK", 0, 0, NULL);
+			return;
+		}
+	}
+	sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS callEpochIx "
+		"ON logbook (callsign_recv, epoch)", 0, 0, NULL);
+}
+
 void logbook_open(){
 	char db_path[200];	//dangerous, find the MAX_PATH and replace 200 with it
+	if (db)
+		return;
 	sprintf(db_path, "%s/sbitx/data/sbitx.db", getenv("HOME"));
-
+	strcpy(log_db_path, db_path);
 	rc = sqlite3_open(db_path, &db);
+	sqlite3_busy_timeout(db, 2000);
+	logbook_migrate();
+	log_prepare();
+	worked_load();
+	log_writer_start(db_path);
 }
 /*
 create table messages (
@@ -283,10 +372,232 @@ create table messages (
 );
 */
 
+/* The writer.
+	The decoder adds every FT8 message it hears to the messages table.
+	Each sqlite3_exec() of an INSERT was a transaction of its own, with
+	its own sync to the SD card, and the decoder waited on it. Now the
+	rows are put in a queue and a thread of its own writes them, many
+	rows to a transaction. It has its own connection to the database,
+	in WAL mode, so the readers on the other connection are not blocked.
+
+	The queue is a ring of slots that the decoder, the FT8 transmit and
+	the gtk can all put into without a lock. Each slot carries a sequence
+	number that says whose turn it is: the producer that will fill it, or
+	the writer that will empty it.
+
+	A transaction is committed after LOG_BATCH_ROWS rows or LOG_BATCH_MS
+	after its first row, whichever comes first. A QSO is committed at
+	once and logbook_add() waits for it, the log window and the duplicate
+	check read it right after. A QSO that finds the database locked (by an
+	import, or the log window) is tried again, and if it still can't be
+	written, logbook_add() is told so. */
+
+#define LOG_QUEUE 256	// a power of 2
+#define LOG_BATCH_ROWS 50
+#define LOG_BATCH_MS 1000
+
+#define LOG_QSO_TRIES 5	// each try waits out the busy timeout
+#define LOG_FAILED 16
+
+#define LOG_MESSAGE 1
+#define LOG_QSO 2
+
+struct log_record {
+	unsigned int seq;
+	int kind;
+	// messages
+	int freq, date, time, outgoing;
+	char mode[10], data[200];
+	// qso
+	time_t epoch;
+	char log_freq[12], date_str[12], time_str[12], mycallsign[20], 
+		rst_sent[10], exchange_sent[20], callsign[20], rst_recv[10], 
+		exchange_recv[20];
+};
+
+static struct log_record log_queue[LOG_QUEUE];
+static unsigned int log_head = 0;	// the next slot to be claimed
+static unsigned int log_tail = 0;	// the next slot to be written
+static unsigned int log_committed = 0;
+static unsigned int log_dropped = 0;
+static unsigned int log_failed[LOG_FAILED];	// tickets of the QSOs not written
+static int log_failed_count = 0;
+static sem_t log_ready;
+static pthread_t log_thread;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_done = PTHREAD_COND_INITIALIZER;
+static sqlite3 *wdb = NULL;
+static sqlite3_stmt *insert_message = NULL, *insert_qso = NULL;
+
+//returns the slot claimed, or NULL if the queue is full
+static struct log_record *log_claim(unsigned int *ticket){
+	unsigned int pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+
+	while (1){
+		struct log_record *r = log_queue + (pos & (LOG_QUEUE - 1));
+		int diff = (int)(__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0){
+			if (__atomic_compare_exchange_n(&log_head, &pos, pos + 1, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+				*ticket = pos;
+				return r;
+			}
+		}
+		else if (diff < 0)
+			return NULL;
+		else
+			pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	}
+}
+
+//hands the filled slot to the writer
+static void log_publish(struct log_record *r, unsigned int ticket){
+	__atomic_store_n(&r->seq, ticket + 1, __ATOMIC_RELEASE);
+	sem_post(&log_ready);
+}
+
+static void log_bind(sqlite3_stmt *stmt, int i, const char *text){
+	sqlite3_bind_text(stmt, i, text, -1, SQLITE_STATIC);
+}
+
+//writes the next row, returns 1 if it was a qso, ok is cleared if it failed
+static int log_write_next(int *ok){
+	struct log_record *r = log_queue + (log_tail & (LOG_QUEUE - 1));
+	sqlite3_stmt *stmt;
+
+	//the sem said it is there, it may not be published yet
+	while (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != log_tail + 1)
+		sched_yield();
+
+	if (r->kind == LOG_MESSAGE){
+		stmt = insert_message;
+		log_bind(stmt, 1, r->mode);
+		sqlite3_bind_int(stmt, 2, r->freq);
+		sqlite3_bind_int(stmt, 3, r->date);
+		sqlite3_bind_int(stmt, 4, r->time);
+		sqlite3_bind_int(stmt, 5, r->outgoing);
+		log_bind(stmt, 6, r->data);
+	}
+	else {
+		stmt = insert_qso;
+		log_bind(stmt, 1, r->log_freq);
+		log_bind(stmt, 2, r->mode);
+		log_bind(stmt, 3, r->date_str);
+		log_bind(stmt, 4, r->time_str);
+		log_bind(stmt, 5, r->mycallsign);
+		log_bind(stmt, 6, r->rst_sent);
+		log_bind(stmt, 7, r->exchange_sent);
+		log_bind(stmt, 8, r->callsign);
+		log_bind(stmt, 9, r->rst_recv);
+		log_bind(stmt, 10, r->exchange_recv);
+		sqlite3_bind_int64(stmt, 11, r->epoch);
+	}
+	int e = SQLITE_ERROR, tries = LOG_QSO_TRIES;
+	while (stmt && (e = sqlite3_step(stmt)) == SQLITE_BUSY 
+		&& r->kind == LOG_QSO && --tries > 0){
+		printf("logbook is busy, trying the QSO with %s again\n", r->callsign);
+		sqlite3_reset(stmt);
+	}
+	if (e != SQLITE_DONE){
+		printf("*Error: logbook write: %s\n", sqlite3_errmsg(wdb));
+		*ok = 0;
+	}
+	if (stmt){
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+
+	int kind = r->kind;
+	__atomic_store_n(&r->seq, log_tail + LOG_QUEUE, __ATOMIC_RELEASE);
+	log_tail++;
+	return kind == LOG_QSO;
+}
+
+static void *log_thread_function(void *ptr){
+	struct timespec deadline;
+
+	while (1){
+		while (sem_wait(&log_ready))
+			;
+
+		sqlite3_exec(wdb, "BEGIN", 0, 0, NULL);
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += LOG_BATCH_MS / 1000;
+		deadline.tv_nsec += (LOG_BATCH_MS % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		int rows = 0, qso = 0, ok = 1;
+		do {
+			ok = 1;
+			qso = log_write_next(&ok);
+			if (qso || ++rows >= LOG_BATCH_ROWS)
+				break;
+		} while (!sem_timedwait(&log_ready, &deadline));
+		if (sqlite3_exec(wdb, "COMMIT", 0, 0, NULL) != SQLITE_OK){
+			printf("*Error: logbook commit: %s\n", sqlite3_errmsg(wdb));
+			sqlite3_exec(wdb, "ROLLBACK", 0, 0, NULL);
+			ok = 0;
+		}
+
+		pthread_mutex_lock(&log_lock);
+		//the qso, if any, is the last row of the batch
+		if (qso && !ok){
+			if (log_failed_count == LOG_FAILED)
+				memmove(log_failed, log_failed + 1, --log_failed_count * sizeof(log_failed[0]));
+			log_failed[log_failed_count++] = log_tail - 1;
+		}
+		log_committed = log_tail;
+		pthread_cond_broadcast(&log_done);
+		pthread_mutex_unlock(&log_lock);
+	}
+}
+
+static void log_writer_start(char *db_path){
+	if (sqlite3_open(db_path, &wdb) != SQLITE_OK){
+		printf("*Error: logbook writer can't open %s\n", db_path);
+		return;
+	}
+	sqlite3_busy_timeout(wdb, 2000);
+	sqlite3_exec(wdb, "PRAGMA journal_mode=WAL", 0, 0, NULL);
+	sqlite3_exec(wdb, "PRAGMA synchronous=NORMAL", 0, 0, NULL);
+	sqlite3_prepare_v2(wdb, 
+		"INSERT INTO messages (mode, freq, qso_date, qso_time, is_outgoing, data)"
+		" VALUES(?, ?, ?, ?, ?, ?)", -1, &insert_message, NULL);
+	sqlite3_prepare_v2(wdb,
+		"INSERT INTO logbook (freq, mode, qso_date, qso_time, callsign_sent,"
+		"rst_sent, exch_sent, callsign_recv, rst_recv, exch_recv, epoch) "
+		"VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)", -1, &insert_qso, NULL);
+
+	for (int i = 0; i < LOG_QUEUE; i++)
+		log_queue[i].seq = i;
+	sem_init(&log_ready, 0, 0);
+	pthread_create(&log_thread, NULL, log_thread_function, NULL);
+}
+
+//waits till the row of this ticket is committed, -1 if it couldn't be
+static int log_wait(unsigned int ticket){
+	int e = 0;
+
+	pthread_mutex_lock(&log_lock);
+	while ((int)(log_committed - ticket) <= 0)
+		pthread_cond_wait(&log_done, &log_lock);
+	for (int i = 0; i < log_failed_count; i++)
+		if (log_failed[i] == ticket){
+			log_failed[i] = log_failed[--log_failed_count];
+			e = -1;
+			break;
+		}
+	pthread_mutex_unlock(&log_lock);
+	return e;
+}
+
 void message_add(char *mode, unsigned int frequency, int outgoing, char *message){
-	char date_str[10], time_str[10], freq_str[12], statement[1000], *err_msg;
+	char freq_str[12];
+	struct log_record *r;
+	unsigned int ticket;
 
-	
 	/* get the frequency */
 	get_field_value("r1:freq", freq_str);
 	frequency = frequency + atoi(freq_str);
@@ -295,29 +606,32 @@ void message_add(char *mode, unsigned int frequency, int outgoing, char *message
 	time_t log_time = time_sbitx();
 	struct tm *tmp = gmtime(&log_time);
 
-	int date_utc = ((tmp->tm_year + 1900)*10000) 
-		+ ((tmp->tm_mon+1) * 100) + (tmp->tm_mday);
-	int time_utc = (tmp->tm_hour * 10000) + (tmp->tm_min * 100) + tmp->tm_sec;
-
-	sprintf(statement,
-		"INSERT INTO messages (mode, freq, qso_date, qso_time, is_outgoing, data)"
-		" VALUES('%s', '%d', '%d', '%d',  '%d','%s');",
-			mode, frequency, date_utc, time_utc, outgoing, message);
-
 	if (db == NULL)
 		logbook_open();
 
-	int res = sqlite3_exec(db, statement, 0,0, &err_msg);
-	if (res != 0) {
-		printf("logbook_add db: %d err=%s", res, err_msg);
-		if (err_msg) sqlite3_free(err_msg);
+	//a busy band is no reason to hold up the decoder
+	if (!wdb || !(r = log_claim(&ticket))){
+		log_dropped++;
+		return;
 	}
+
+	r->kind = LOG_MESSAGE;
+	r->freq = frequency;
+	r->date = ((tmp->tm_year + 1900)*10000) 
+		+ ((tmp->tm_mon+1) * 100) + (tmp->tm_mday);
+	r->time = (tmp->tm_hour * 10000) + (tmp->tm_min * 100) + tmp->tm_sec;
+	r->outgoing = outgoing;
+	snprintf(r->mode, sizeof(r->mode), "%s", mode);
+	snprintf(r->data, sizeof(r->data), "%s", message);
+	log_publish(r, ticket);
 }
 
-void logbook_add(char *contact_callsign, char *rst_sent, char *exchange_sent, 
+//returns -1 if the QSO could not be written to the log
+int logbook_add(char *contact_callsign, char *rst_sent, char *exchange_sent, 
 	char *rst_recv, char *exchange_recv){
-	char statement[1000], *err_msg, date_str[10], time_str[10];
-	char freq[12], log_freq[12], mode[10], mycallsign[10];
+	char freq[12], mode[10], mycallsign[10];
+	struct log_record *r;
+	unsigned int ticket;
 
 	time_t log_time = time_sbitx();
 	struct tm *tmp = gmtime(&log_time);
@@ -325,31 +639,41 @@ void logbook_add(char *contact_callsign, char *rst_sent, char *exchange_sent,
 	get_field_value("r1:mode", mode);
 	get_field_value("#mycallsign", mycallsign);
 
-	sprintf(log_freq, "%d", atoi(freq)/1000);
-	
-	sprintf(date_str, "%04d-%02d-%02d", tmp->tm_year + 1900, tmp->tm_mon + 1, tmp->tm_mday);
-	sprintf(time_str, "%02d%02d", tmp->tm_hour, tmp->tm_min);
-
-	sprintf(statement,
-		"INSERT INTO logbook (freq, mode, qso_date, qso_time, callsign_sent,"
-		"rst_sent, exch_sent, callsign_recv, rst_recv, exch_recv) "
-		"VALUES('%s', '%s', '%s', '%s',  '%s','%s','%s',  '%s','%s','%s');",
-			log_freq, mode, date_str, time_str, mycallsign,
-			 rst_sent, exchange_sent, contact_callsign, rst_recv, exchange_recv);
-
 	if (db == NULL)
 		logbook_open();
+	if (!wdb){
+		printf("*Error: logbook is not open, %s is not logged\n", contact_callsign);
+		return -1;
+	}
 
-	int res = sqlite3_exec(db, statement, 0,0, &err_msg);
-	if (res != 0) {
-		printf("logbook_add db: %d err=%s", res, err_msg);
-		if (err_msg) sqlite3_free(err_msg);
+	//a qso is never dropped, wait for the writer to make room
+	while (!(r = log_claim(&ticket)))
+		usleep(1000);
+
+	r->kind = LOG_QSO;
+	r->epoch = log_time;
+	sprintf(r->log_freq, "%d", atoi(freq)/1000);
+	snprintf(r->mode, sizeof(r->mode), "%s", mode);
+	sprintf(r->date_str, "%04d-%02d-%02d", tmp->tm_year + 1900, tmp->tm_mon + 1, tmp->tm_mday);
+	sprintf(r->time_str, "%02d%02d", tmp->tm_hour, tmp->tm_min);
+	snprintf(r->mycallsign, sizeof(r->mycallsign), "%s", mycallsign);
+	snprintf(r->rst_sent, sizeof(r->rst_sent), "%s", rst_sent);
+	snprintf(r->exchange_sent, sizeof(r->exchange_sent), "%s", exchange_sent);
+	snprintf(r->callsign, sizeof(r->callsign), "%s", contact_callsign);
+	snprintf(r->rst_recv, sizeof(r->rst_recv), "%s", rst_recv);
+	snprintf(r->exchange_recv, sizeof(r->exchange_recv), "%s", exchange_recv);
+	log_publish(r, ticket);
+
+	if (log_wait(ticket)){
+		printf("*Error: the QSO with %s is not logged\n", contact_callsign);
+		return -1;
 	}
-	//refresh the list if opened
-	if (list_store){
-		clear_tree(list_store);
-		logbook_fill(0,10000,NULL);
-	}	
+	worked_add(contact_callsign, exchange_recv, atoi(freq)/1000, mode, 1);
+
+	//add it to the list if opened
+	if (list_store)
+		logbook_list_refresh();
+	return 0;
 }
 
 // ADIF field headers, see note above
@@ -371,6 +695,193 @@ struct band_name {
 	{"10M", 28000, 29700},
 };
 
+/* The worked-before index.
+	Every FT8 line written to the console is decorated by looking up its
+	callsign and grid in the log, a busy slot makes hundreds of these.
+	They are answered from a hash table of counts held in memory, loaded
+	when the log is opened and kept up to date as the QSOs are added,
+	edited and deleted. Each QSO counts its callsign and its grid four
+	times: by itself, on its band, in its mode and on its band in its mode.
+	The counts never go away, a key that drops to zero stays till the table
+	is grown. */
+
+#define WORKED_MIN 4096	// a power of 2
+
+struct worked_entry {
+	char *key;
+	int count;
+};
+
+static struct worked_entry *worked = NULL;
+static int worked_size = 0, worked_used = 0;
+static pthread_mutex_t worked_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int worked_hash(const char *key){
+	unsigned int h = 2166136261u;	// FNV-1a
+	while (*key){
+		h ^= *key++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static struct worked_entry *worked_slot(struct worked_entry *table, int size, 
+	const char *key){
+	unsigned int h = worked_hash(key);
+	while (table[h & (size - 1)].key && strcmp(table[h & (size - 1)].key, key))
+		h++;
+	return table + (h & (size - 1));
+}
+
+//doubles the table, the keys that dropped to zero are left behind
+static void worked_grow(){
+	int size = worked_size ? worked_size * 2 : WORKED_MIN;
+	struct worked_entry *table = calloc(size, sizeof(struct worked_entry));
+
+	worked_used = 0;
+	for (int i = 0; i < worked_size; i++){
+		if (!worked[i].key)
+			continue;
+		if (worked[i].count > 0){
+			*worked_slot(table, size, worked[i].key) = worked[i];
+			worked_used++;
+		}
+		else
+			free(worked[i].key);
+	}
+	free(worked);
+	worked = table;
+	worked_size = size;
+}
+
+//the key is kind|ID|band|mode, the band and mode can be left blank
+static void worked_key(char *key, char kind, const char *id, const char *band, 
+	const char *mode){
+	int n = sprintf(key, "%c|%.20s|%s|%.10s", kind, id, band ? band : "", 
+		mode ? mode : "");
+	for (int i = 0; i < n; i++)
+		key[i] = toupper(key[i]);
+}
+
+static void worked_count(const char *key, int delta){
+	if (worked_used * 2 >= worked_size)
+		worked_grow();
+	struct worked_entry *e = worked_slot(worked, worked_size, key);
+	if (!e->key){
+		if (delta < 0)
+			return;
+		e->key = strdup(key);
+		worked_used++;
+	}
+	e->count += delta;
+	if (e->count < 0)
+		e->count = 0;
+}
+
+//NULL for a frequency outside the ham bands
+static const char *worked_band(int freq_khz){
+	for (int i = 0; i < sizeof(bands)/sizeof(struct band_name); i++)
+		if (bands[i].from <= freq_khz && freq_khz <= bands[i].to)
+			return bands[i].name;
+	return NULL;
+}
+
+static void worked_add(const char *callsign, const char *grid, int freq_khz, 
+	const char *mode, int delta){
+	const char *band = worked_band(freq_khz);
+	char key[60];
+
+	pthread_mutex_lock(&worked_lock);
+	for (int i = 0; i < 2; i++){
+		const char *id = i ? grid : callsign;
+		char kind = i ? 'G' : 'C';
+		if (!id || !id[0])
+			continue;
+		worked_key(key, kind, id, NULL, NULL);
+		worked_count(key, delta);
+		worked_key(key, kind, id, NULL, mode);
+		worked_count(key, delta);
+		//a QSO off the bands counts only for any band
+		if (!band)
+			continue;
+		worked_key(key, kind, id, band, NULL);
+		worked_count(key, delta);
+		worked_key(key, kind, id, band, mode);
+		worked_count(key, delta);
+	}
+	pthread_mutex_unlock(&worked_lock);
+}
+
+static const char *worked_column(sqlite3_stmt *stmt, int i){
+	const char *text = sqlite3_column_text(stmt, i);
+	return text ? text : "";
+}
+
+//adds (delta = 1) or takes out (delta = -1) a logged QSO
+static void worked_qso(int id, int delta){
+	sqlite3_stmt *stmt = log_statement(LOG_WORKED_ROW);
+
+	if (stmt){
+		sqlite3_bind_int(stmt, 1, id);
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			worked_add(worked_column(stmt, 0), worked_column(stmt, 1),
+				sqlite3_column_int(stmt, 2), worked_column(stmt, 3), delta);
+	}
+	log_statement_done(stmt);
+}
+
+static void worked_load(){
+	sqlite3_stmt *stmt;
+	int n = 0;
+
+	if (!worked)
+		worked_grow();
+	stmt = log_statement(LOG_WORKED_ALL);
+	while (stmt && sqlite3_step(stmt) == SQLITE_ROW){
+		worked_add(worked_column(stmt, 0), worked_column(stmt, 1),
+			sqlite3_column_int(stmt, 2), worked_column(stmt, 3), 1);
+		n++;
+	}
+	log_statement_done(stmt);
+	printf("worked before index: %d QSOs, %d keys\n", n, worked_used);
+}
+
+static bool worked_lookup(char kind, const char *id, int freq_khz, const char *mode){
+	char key[60];
+	bool found = false;
+
+	if (db == NULL)
+		logbook_open();
+	const char *band = NULL;
+	if (freq_khz && !(band = worked_band(freq_khz)))
+		return false;
+	worked_key(key, kind, id, band, mode);
+
+	pthread_mutex_lock(&worked_lock);
+	struct worked_entry *e = worked_slot(worked, worked_size, key);
+	found = e->key && e->count > 0;
+	pthread_mutex_unlock(&worked_lock);
+	return found;
+}
+
+/* the freq (in KHz) picks the band, leave it zero for any band, 
+	leave the mode NULL for any mode. A freq off the bands matches nothing */
+bool logbook_caller_worked(const char *callsign, int freq_khz, const char *mode){
+	return worked_lookup('C', callsign, freq_khz, mode);
+}
+
+bool logbook_grid_worked(const char *grid, int freq_khz, const char *mode){
+	return worked_lookup('G', grid, freq_khz, mode);
+}
+
+bool logbook_caller_exists(char * id) {
+	return worked_lookup('C', id, 0, NULL);
+}
+
+bool logbook_grid_exists(char *id) {
+	return worked_lookup('G', id, 0, NULL);
+}
+
 static void strip_chr(char *str, const char to_remove){
     int i, j, len;
 
@@ -387,61 +898,249 @@ static void strip_chr(char *str, const char to_remove){
 
 int export_adif(char *path, char *start_date, char *end_date){
 	sqlite3_stmt *stmt;
-	char statement[200], param[2000], qso_band[20];
+	char param[2000], adif_mode[20], adif_submode[20];
+	static char out_buff[65536];
 	
-
-	//add to the bottom of the logbook
-	sprintf(statement, "select * from logbook where (qso_date >= '%s' AND  qso_date <= '%s')  ORDER BY id DESC;",
-		start_date, end_date);
-
 	FILE *pf = fopen(path, "w");
-	sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
-	fprintf(pf, "/ADIF file\n");
-	fprintf(pf, "generated from sBITX log db by Log2ADIF program\n");	
-	fprintf(pf, "<adif version:5>3.1.4\n");	
-	fprintf(pf, "<EOH>\n");	
+	if (!pf)
+		return -1;
+	setvbuf(pf, out_buff, _IOFBF, sizeof(out_buff));
+	stmt = log_statement(LOG_ADIF);
+	if (stmt){
+		sqlite3_bind_text(stmt, 1, start_date, -1, SQLITE_TRANSIENT);
+		sqlite3_bind_text(stmt, 2, end_date, -1, SQLITE_TRANSIENT);
+	}
+	adif_write_header(pf, "Log2ADIF program");
 
 	int rec = 0;
 
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		int i;
-		int num_cols = sqlite3_column_count(stmt);
-		for (i = 0; i < num_cols; i++){
-			switch (sqlite3_column_type(stmt, i))
-			{
-			case (SQLITE3_TEXT):
-				strcpy(param, sqlite3_column_text(stmt, i));
-				break;
-			case (SQLITE_INTEGER):
-				sprintf(param, "%d", sqlite3_column_int(stmt, i));
-				break;
-			case (SQLITE_FLOAT):
-				sprintf(param, "%g", sqlite3_column_double(stmt, i));
-				break;
-			case (SQLITE_NULL):
-				break;
-			default:
-				sprintf(param, "%d", sqlite3_column_type(stmt, i));
-				break;
-			}
-			if (i == 2){
+	while (stmt && sqlite3_step(stmt) == SQLITE_ROW) {
+		for (int i = 0; i < sqlite3_column_count(stmt); i++){
+			const char *value = sqlite3_column_text(stmt, i);
+			snprintf(param, sizeof(param), "%s", value ? value : "");
+			if (i == COL_FREQ){
 				long f = atoi(param);
 				float ffreq=atof(param)/1000.0;  // convert kHz to MHz
 				sprintf(param, "%.3f",ffreq); // write out with 3 decimal digits
-				for (int j = 0 ; j < sizeof(bands)/sizeof(struct band_name); j++)
-					if (bands[j].from <= f && f <= bands[j].to){
-						fprintf(pf, "<BAND:%d>%s\n", strlen(bands[j].name), bands[j].name); 
-					}
+				const char *band = worked_band(f);
+				adif_write_field(pf, "BAND", band ? band : "");
 			}
-			else if (i == 3) //it is the date
+			else if (i == COL_QSO_DATE)
 				strip_chr(param, '-');
-	   	fprintf(pf, "<%s:%d>%s\n", adif_names[i], strlen(param), param);
+			else if (i == COL_MODE){
+				adif_mode_out(param, adif_mode, adif_submode);
+				adif_write_field(pf, "MODE", adif_mode);
+				adif_write_field(pf, "SUBMODE", adif_submode);
+				continue;
+			}
+			adif_write_field(pf, adif_names[i], param);
 		}
-		fprintf(pf, "<EOR>\n");
-		//printf("\n");
+		adif_write_eor(pf);
+		rec++;
 	}
-	sqlite3_finalize(stmt);
+	log_statement_done(stmt);
 	fclose(pf);
+	return rec;
+}
+
+/* ADIF import.
+	A log from another logger can run to tens of thousands of QSOs. It is
+	read on a thread of its own, with its own connection, and inserted in
+	a single transaction through one prepared statement, so the radio
+	carries on as it goes. A QSO that is already in the log (the same 
+	callsign in the same minute) is skipped, so a file can be imported
+	again without making duplicates. */
+
+struct adif_qso {
+	char call[20], date[12], time[8], freq[20], band[10], mode[12], submode[12],
+		rst_sent[10], rst_recv[10], stx[20], srx[20], grid[12], operator[20],
+		comment[200];
+};
+
+static int import_running = 0;
+
+/* the import commits every IMPORT_CHUNK records so that the log writer,
+	waiting out its 2 second busy timeout, gets the database in between */
+#define IMPORT_CHUNK 1000
+
+static int adif_band_khz(const char *band){
+	for (int i = 0; i < sizeof(bands)/sizeof(struct band_name); i++)
+		if (!strcasecmp(bands[i].name, band))
+			return bands[i].from;
+	return 0;
+}
+
+static void adif_collect(struct adif_qso *q, struct adif_field *f){
+	static struct {
+		char *name;
+		int offset, size;
+	} fields[] = {
+		{"CALL", offsetof(struct adif_qso, call), 20},
+		{"QSO_DATE", offsetof(struct adif_qso, date), 12},
+		{"TIME_ON", offsetof(struct adif_qso, time), 8},
+		{"FREQ", offsetof(struct adif_qso, freq), 20},
+		{"BAND", offsetof(struct adif_qso, band), 10},
+		{"MODE", offsetof(struct adif_qso, mode), 12},
+		{"SUBMODE", offsetof(struct adif_qso, submode), 12},
+		{"RST_SENT", offsetof(struct adif_qso, rst_sent), 10},
+		{"RST_RCVD", offsetof(struct adif_qso, rst_recv), 10},
+		{"STX_STRING", offsetof(struct adif_qso, stx), 20},
+		{"SRX_STRING", offsetof(struct adif_qso, srx), 20},
+		{"GRIDSQUARE", offsetof(struct adif_qso, grid), 12},
+		{"OPERATOR", offsetof(struct adif_qso, operator), 20},
+		{"COMMENT", offsetof(struct adif_qso, comment), 200},
+		{"COMMENTS", offsetof(struct adif_qso, comment), 200},
+		{NULL, 0, 0}
+	};
+
+	for (int i = 0; fields[i].name; i++)
+		if (adif_is(f, fields[i].name)){
+			adif_value(f, (char *)q + fields[i].offset, fields[i].size);
+			return;
+		}
+	//the fallbacks, when the preferred ones are missing
+	if (adif_is(f, "STX") && !q->stx[0])
+		adif_value(f, q->stx, sizeof(q->stx));
+	else if (adif_is(f, "SRX") && !q->srx[0])
+		adif_value(f, q->srx, sizeof(q->srx));
+	else if (adif_is(f, "STATION_CALLSIGN") && !q->operator[0])
+		adif_value(f, q->operator, sizeof(q->operator));
+}
+
+//returns 1 if the qso was added, 0 if it was already there, -1 if it is bad
+static int adif_insert(sqlite3 *idb, sqlite3_stmt *stmt, struct adif_qso *q){
+	char freq[12], mode[12], date[12], time_on[8], exch_recv[20];
+	struct tm t;
+
+	if (!q->call[0] || strlen(q->date) != 8 || strlen(q->time) < 4)
+		return -1;
+
+	int khz = q->freq[0] ? (int)(atof(q->freq) * 1000 + 0.5) : adif_band_khz(q->band);
+	sprintf(freq, "%d", khz);
+	adif_mode_in(q->mode, q->submode, khz, mode, sizeof(mode));
+	sprintf(date, "%.4s-%.2s-%.2s", q->date, q->date + 4, q->date + 6);
+	sprintf(time_on, "%.4s", q->time);
+	//the grid goes where the FT8 exchange is kept
+	snprintf(exch_recv, sizeof(exch_recv), "%s", q->srx[0] ? q->srx : q->grid);
+	if (!q->srx[0] && strlen(exch_recv) > 4)
+		exch_recv[4] = 0;
+	for (char *p = q->call; *p; p++)
+		*p = toupper(*p);
+
+	memset(&t, 0, sizeof(t));
+	sscanf(q->date, "%4d%2d%2d", &t.tm_year, &t.tm_mon, &t.tm_mday);
+	sscanf(q->time, "%2d%2d%2d", &t.tm_hour, &t.tm_min, &t.tm_sec);
+	t.tm_year -= 1900;
+	t.tm_mon--;
+	time_t epoch = timegm(&t);
+
+	char *values[] = {mode, freq, date, time_on, q->operator, q->rst_sent, 
+		q->stx, q->call, q->rst_recv, exch_recv, q->comment};
+	for (int i = 0; i < 11; i++)
+		sqlite3_bind_text(stmt, i + 1, values[i], -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 12, epoch);
+	sqlite3_bind_int64(stmt, 13, epoch - epoch % 60);
+
+	int e = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if (e != SQLITE_DONE){
+		printf("*Error: ADIF import of %s: %s\n", q->call, sqlite3_errmsg(idb));
+		return -1;
+	}
+	if (!sqlite3_changes(idb))
+		return 0;
+	worked_add(q->call, exch_recv, khz, mode, 1);
+	return 1;
+}
+
+static void *import_thread_function(void *ptr){
+	char *path = (char *)ptr;
+	struct adif_file f;
+	struct adif_field field;
+	struct adif_qso q;
+	struct timespec start, stop;
+	sqlite3 *idb = NULL;
+	sqlite3_stmt *stmt = NULL;
+	int added = 0, skipped = 0, bad = 0, records = 0, e;
+	char buff[200];
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (adif_open(&f, path))
+		goto done;
+	if (sqlite3_open(log_db_path, &idb) != SQLITE_OK)
+		goto done;
+	sqlite3_busy_timeout(idb, 10000);
+	if (sqlite3_prepare_v2(idb, 
+		"INSERT INTO logbook (mode, freq, qso_date, qso_time, callsign_sent, "
+		"rst_sent, exch_sent, callsign_recv, rst_recv, exch_recv, comments, epoch) "
+		"SELECT ?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12 WHERE NOT EXISTS "
+		"(SELECT 1 FROM logbook WHERE callsign_recv = ?8 AND epoch >= ?13 AND epoch < ?13 + 60)",
+		-1, &stmt, NULL) != SQLITE_OK){
+		printf("*Error: ADIF import: %s\n", sqlite3_errmsg(idb));
+		goto done;
+	}
+
+	sprintf(buff, "Importing %s\n", path);
+	write_console(FONT_LOG, buff);
+	sqlite3_exec(idb, "BEGIN IMMEDIATE", 0, 0, NULL);
+	memset(&q, 0, sizeof(q));
+	while ((e = adif_next(&f, &field)) != ADIF_END){
+		if (e == ADIF_FIELD){
+			adif_collect(&q, &field);
+			continue;
+		}
+		e = adif_insert(idb, stmt, &q);
+		if (e > 0)
+			added++;
+		else if (e == 0)
+			skipped++;
+		else
+			bad++;
+		memset(&q, 0, sizeof(q));
+		if (++records % IMPORT_CHUNK == 0){
+			if (sqlite3_exec(idb, "COMMIT", 0, 0, NULL) != SQLITE_OK)
+				printf("*Error: ADIF import commit: %s\n", sqlite3_errmsg(idb));
+			sqlite3_exec(idb, "BEGIN IMMEDIATE", 0, 0, NULL);
+		}
+		if (records % 10000 == 0)
+			printf("ADIF import: %d%% (%d QSOs)\n", adif_progress(&f), records);
+	}
+	if (sqlite3_exec(idb, "COMMIT", 0, 0, NULL) != SQLITE_OK)
+		printf("*Error: ADIF import commit: %s\n", sqlite3_errmsg(idb));
+
+done:
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	sprintf(buff, "ADIF import: %d QSOs added, %d already logged, %d bad, in %.1f secs\n",
+		added, skipped, bad, 
+		(stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9);
+	write_console(FONT_LOG, buff);
+	printf("%s", buff);
+	if (stmt)
+		sqlite3_finalize(stmt);
+	if (idb)
+		sqlite3_close(idb);
+	adif_close(&f);
+	free(path);
+	import_running = 0;
+	return NULL;
+}
+
+int logbook_import_adif(const char *path){
+	pthread_t thread;
+
+	if (db == NULL)
+		logbook_open();
+	if (import_running){
+		write_console(FONT_LOG, "An ADIF import is already running\n");
+		return -1;
+	}
+	import_running = 1;
+	if (pthread_create(&thread, NULL, import_thread_function, strdup(path))){
+		import_running = 0;
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
 }
 
 /* Export functions */
@@ -710,12 +1409,28 @@ int edit_qso(char *qso_id, char *freq, char *mode, char *callsign, char *rst_sen
 }
 
 
-void add_to_list(GtkListStore *list_store, const gchar *col1, const gchar *col2, const gchar *col3, 
+/* The logbook window.
+	It used to be filled with up to 10000 QSOs, and filled all over again
+	after every QSO that was logged. Now it is filled a page at a time,
+	newest first, and the next page is fetched (by id, below the lowest
+	one shown) as the list is scrolled down to its end. The QSOs logged
+	while it is open are inserted at its top, the edits and deletes
+	change just their own row. */
+
+#define LOGBOOK_LIST_PAGE 100
+
+static int list_top_id = 0;			//the highest id in the list
+static int list_bottom_id = 0;	//the lowest
+static int list_more = 0;				//there are more rows below the bottom
+static char list_query[20];			//the callsign searched for
+
+//position -1 appends the row
+void add_to_list(GtkListStore *list_store, int position, const gchar *col1, 
+		const gchar *col2, const gchar *col3, 
 		const gchar *col4, const gchar *col5, const gchar *col6, 
 		const gchar *col7, const gchar *col8, const gchar *col9, const gchar *col10) {
     GtkTreeIter iter;
-    gtk_list_store_append(list_store, &iter);
-    gtk_list_store_set(list_store, &iter,
+    gtk_list_store_insert_with_values(list_store, &iter, position,
                        0, col1,
                        1, col2,
                        2, col3,
@@ -729,89 +1444,77 @@ void add_to_list(GtkListStore *list_store, const gchar *col1, const gchar *col2,
                        -1);
 }
 
+static const char *list_column(sqlite3_stmt *stmt, int i){
+	const char *text = sqlite3_column_text(stmt, i);
+	return text ? text : "";
+}
 
+/* from_id as in logbook_rows(), the rows newer than the top are 
+	inserted above it, the rest are appended. Returns the rows added */
 int logbook_fill(int from_id, int count, char *query){
-	sqlite3_stmt *stmt;
-	char statement[200], json[10000], param[2000];
-
-	if (db == NULL)
-		logbook_open();
+	char id[10], qso_date[40];
+	int position = from_id < 0 ? 0 : -1;
+	int rec = 0;
 
-	//add to the bottom of the logbook
-	if (from_id > 0){
-		if (query)
-			sprintf(statement, "select * from logbook "
-				"where (callsign_recv LIKE '%s%%' AND id < %d) ",
-				query, from_id);
-		else
-			sprintf(statement, "select * from logbook where id < %d ", from_id);
-	}
-	//last 200 QSOs
-	else if (from_id == 0){
-		if (query)
-			sprintf(statement, "select * from logbook "
-				"where callsign_recv LIKE '%s%%' ", query);
-		else
-			strcpy(statement, "select * from logbook ");
-	}
-	//latest QSOs after from_id (top of the log)
-	else {
-		if (query)
-			sprintf(statement, "select * from logbook "
-				"where (callsign_recv LIKE '%s%%' AND id > %d) ",
-				query, -from_id);
-		else 
-			sprintf(statement, "select * from logbook where id > %d ", -from_id); 
+	sqlite3_stmt *stmt = log_statement(LOG_PAGE);
+	if (stmt)
+		log_bind_page(stmt, query, from_id, count);
+
+	while (stmt && sqlite3_step(stmt) == SQLITE_ROW) {
+		int row_id = sqlite3_column_int(stmt, COL_ID);
+		sprintf(id, "%d", row_id);
+		snprintf(qso_date, sizeof(qso_date), "%s %s", 
+			list_column(stmt, COL_QSO_DATE), list_column(stmt, COL_QSO_TIME));
+		add_to_list(list_store, position, id,  qso_date, 
+			list_column(stmt, COL_FREQ), list_column(stmt, COL_MODE),
+			list_column(stmt, COL_CALLSIGN_RECV), list_column(stmt, COL_RST_SENT), 
+			list_column(stmt, COL_EXCH_SENT), list_column(stmt, COL_RST_RECV), 
+			list_column(stmt, COL_EXCH_RECV), list_column(stmt, COL_COMMENTS));
+		if (position >= 0)
+			position++;
+		if (row_id > list_top_id)
+			list_top_id = row_id;
+		if (!list_bottom_id || row_id < list_bottom_id)
+			list_bottom_id = row_id;
+		rec++;
 	}
-	char stmt_count[100];
-	sprintf(stmt_count, "ORDER BY id DESC LIMIT %d;", count);
-	strcat(statement, stmt_count);
-	//printf("[%s]\n", statement);
-	sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
+	log_statement_done(stmt);
+	return rec;
+}
 
-	int rec = 0;
+//starts the list over with the first page
+static void logbook_list_reload(const char *query){
+	clear_tree(list_store);
+	list_top_id = 0;
+	list_bottom_id = 0;
+	if (query && *query)
+		snprintf(list_query, sizeof(list_query), "%s", query);
+	else
+		list_query[0] = 0;
+	int n = logbook_fill(0, LOGBOOK_LIST_PAGE, list_query[0] ? list_query : NULL);
+	list_more = n == LOGBOOK_LIST_PAGE;
+}
 
-	char id[10], qso_time[20], qso_date[20], freq[20], mode[20], callsign[20],
-	rst_recv[20], exchange_recv[20], rst_sent[20], exchange_sent[20], comments[1000];
+//adds the QSOs logged since the list was filled
+static void logbook_list_refresh(){
+	char *query = list_query[0] ? list_query : NULL;
 
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		int i;
-		int num_cols = sqlite3_column_count(stmt);
-		for (i = 0; i < num_cols; i++){
+	if (list_top_id)
+		logbook_fill(-list_top_id, 1000, query);
+	else
+		list_more = logbook_fill(0, LOGBOOK_LIST_PAGE, query) == LOGBOOK_LIST_PAGE;
+}
 
-			char const *col_name = sqlite3_column_name(stmt, i);
-			if (!strcmp(col_name, "id"))
-				strcpy(id, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "qso_date"))
-				strcpy(qso_date, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "qso_time"))
-				strcpy(qso_time, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "qso_time"))
-				strcpy(qso_time, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "freq"))
-				strcpy(freq, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "mode"))
-				strcpy(mode, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "callsign_recv"))
-				strcpy(callsign, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "rst_sent"))
-				strcpy(rst_sent, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "rst_recv"))
-				strcpy(rst_recv, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "exch_sent"))
-				strcpy(exchange_sent, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "exch_recv"))
-				strcpy(exchange_recv, sqlite3_column_text(stmt, i));
-			else if (!strcmp(col_name, "comments"))
-				strcpy(comments, sqlite3_column_text(stmt, i));
-		}
-	
-		strcat(qso_date, " ");
-		strcat(qso_date, qso_time);	
-		add_to_list(list_store, id,  qso_date, freq, mode,
-		callsign, rst_sent, exchange_sent, rst_recv, exchange_recv, comments);
-	}
-	sqlite3_finalize(stmt);
+//fetches the next page when the list is scrolled near its end
+static void logbook_list_scrolled(GtkAdjustment *adjustment, gpointer user_data){
+	double page = gtk_adjustment_get_page_size(adjustment);
+
+	if (!list_more || !list_bottom_id)
+		return;
+	if (gtk_adjustment_get_value(adjustment) + 2 * page < gtk_adjustment_get_upper(adjustment))
+		return;
+	int n = logbook_fill(list_bottom_id, LOGBOOK_LIST_PAGE, list_query[0] ? list_query : NULL);
+	list_more = n == LOGBOOK_LIST_PAGE;
 }
 
 void clear_tree(GtkListStore *list_store) {
@@ -821,12 +1524,7 @@ void clear_tree(GtkListStore *list_store) {
 void search_button_clicked(GtkWidget *entry, gpointer search_box) {
 	const gchar *search_text = gtk_entry_get_text(GTK_ENTRY(search_box));
 
-	clear_tree(list_store);
-	if (!strlen(search_text))
-		logbook_fill(0, 10000, NULL);
-	else
-		logbook_fill(0, 10000, (gchar *)search_text);
-
+	logbook_list_reload(search_text);
 }
 
 void search_update(GtkWidget *entry, gpointer search_box) {
@@ -834,9 +1532,32 @@ void search_update(GtkWidget *entry, gpointer search_box) {
 }
 
 void logbook_delete(int id){
-	char statement[100], *err_msg;
-	sprintf(statement, "DELETE FROM logbook WHERE id='%d';", id);
-	sqlite3_exec(db, statement, 0,0, &err_msg);
+	worked_qso(id, -1);
+	sqlite3_stmt *stmt = log_statement(LOG_DELETE);
+	if (stmt){
+		sqlite3_bind_int(stmt, 1, id);
+		sqlite3_step(stmt);
+	}
+	log_statement_done(stmt);
+}
+
+static void logbook_update(char *qso_id, char *freq, char *mode, char *callsign, 
+	char *rst_sent, char *exchange_sent, char *rst_recv, char *exchange_recv, 
+	char *comment){
+	char *values[] = {mode, freq, callsign, rst_sent, exchange_sent, rst_recv, 
+		exchange_recv, comment};
+
+	worked_qso(atoi(qso_id), -1);
+	sqlite3_stmt *stmt = log_statement(LOG_UPDATE);
+	if (stmt){
+		for (int i = 0; i < 8; i++)
+			sqlite3_bind_text(stmt, i + 1, values[i], -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int(stmt, 9, atoi(qso_id));
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+			printf("*Error: logbook update: %s\n", sqlite3_errmsg(db));
+	}
+	log_statement_done(stmt);
+	worked_qso(atoi(qso_id), 1);
 }
 
 void delete_button_clicked(GtkWidget *entry, gpointer tree_view) {
@@ -856,17 +1577,11 @@ void delete_button_clicked(GtkWidget *entry, gpointer tree_view) {
 		"Do you want to delete #%s", qso_id);
  	int response = gtk_dialog_run (GTK_DIALOG (dialog));
 	if (response == GTK_RESPONSE_YES){
-		char statement[100], *err_msg;
-		sprintf(statement, "DELETE FROM logbook WHERE id='%s';", qso_id);
-		sqlite3_exec(db, statement, 0,0, &err_msg);
+		logbook_delete(atoi(qso_id));
+		gtk_list_store_remove(list_store, &iter);
 	}
  	gtk_widget_destroy (dialog);
   g_free(qso_id);
-
-	printf("Response %d\n", response);
-	//refill the log
-	clear_tree(list_store);
-	logbook_fill(0, 10000, NULL);
 }
 
 void edit_button_clicked(GtkWidget *entry, gpointer tree_view) {
@@ -887,15 +1602,12 @@ void edit_button_clicked(GtkWidget *entry, gpointer tree_view) {
 	-1);
 
 
-	if (edit_qso(qso_id, freq, mode, callsign, rst_sent, exchange_sent, rst_recv, exchange_recv, comment)){
-		char statement[1000], *err_msg;
-		sprintf(statement,
-			"UPDATE logbook SET mode = '%s', freq = '%s', callsign_recv = '%s', rst_sent = '%s', "
-			"exch_sent = '%s',rst_recv = '%s', exch_recv = '%s', comments = '%s' WHERE id = '%s'",
-			mode, freq, callsign, rst_sent, exchange_sent, rst_recv, exchange_recv, 
-			comment, qso_id);
-
-		sqlite3_exec(db, statement, 0,0, &err_msg);
+	if (edit_qso(qso_id, freq, mode, callsign, rst_sent, exchange_sent, rst_recv, 
+		exchange_recv, comment) == GTK_RESPONSE_OK){
+		logbook_update(qso_id, freq, mode, callsign, rst_sent, exchange_sent, 
+			rst_recv, exchange_recv, comment);
+		gtk_list_store_set(list_store, &iter, 2, freq, 3, mode, 4, callsign, 
+			5, rst_sent, 6, exchange_sent, 7, rst_recv, 8, exchange_recv, 9, comment, -1);
 	}
 
    g_free(qso_id);
@@ -907,10 +1619,6 @@ void edit_button_clicked(GtkWidget *entry, gpointer tree_view) {
    g_free(rst_recv);
    g_free(exchange_recv);
    g_free(comment);
-
-	//refill the log
-	clear_tree(list_store);
-	logbook_fill(0, 10000, NULL);
 }
 
 
@@ -929,15 +1637,12 @@ void on_row_activated(GtkTreeView *treeview, GtkTreePath *path, GtkTreeViewColum
 					-1);
 
 
-	if (edit_qso(qso_id, freq, mode, callsign, rst_sent, exchange_sent, rst_recv, exchange_recv, comment)){
-		char statement[1000], *err_msg;
-		sprintf(statement,
-			"UPDATE logbook SET mode = '%s', freq = '%s', callsign_recv = '%s', rst_sent = '%s', "
-			"exch_sent = '%s',rst_recv = '%s', exch_recv = '%s', comments = '%s' WHERE id = '%s'",
-			mode, freq, callsign, rst_sent, exchange_sent, rst_recv, exchange_recv, 
-			comment, qso_id);
-
-		sqlite3_exec(db, statement, 0,0, &err_msg);
+	if (edit_qso(qso_id, freq, mode, callsign, rst_sent, exchange_sent, rst_recv, 
+		exchange_recv, comment) == GTK_RESPONSE_OK){
+		logbook_update(qso_id, freq, mode, callsign, rst_sent, exchange_sent, 
+			rst_recv, exchange_recv, comment);
+		gtk_list_store_set(list_store, &iter, 2, freq, 3, mode, 4, callsign, 
+			5, rst_sent, 6, exchange_sent, 7, rst_recv, 8, exchange_recv, 9, comment, -1);
 	}
 
    g_free(qso_id);
@@ -949,10 +1654,6 @@ void on_row_activated(GtkTreeView *treeview, GtkTreePath *path, GtkTreeViewColum
    g_free(rst_recv);
    g_free(exchange_recv);
    g_free(comment);
-
-	//refill the log
-	clear_tree(list_store);
-	logbook_fill(0, 10000, NULL);
 }
 
 // Function to handle row selection
@@ -1038,8 +1739,6 @@ void logbook_list_open(){
     	list_store = gtk_list_store_new(10, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
       	G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, 
       	G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
-		else
-			clear_tree(list_store);
 
     // Create a tree view and set up columns with headings aligned to the left
     tree_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(list_store));
@@ -1072,7 +1771,9 @@ void logbook_list_open(){
     // Add tree view to scrolled window
     gtk_container_add(GTK_CONTAINER(scrolled_window), tree_view);
 
-		logbook_fill(0, 10000, NULL);
+		logbook_list_reload(NULL);
+		g_signal_connect(gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(scrolled_window)),
+			"value-changed", G_CALLBACK(logbook_list_scrolled), NULL);
     // Connect row activation signal
 //		gtk_tree_view_set_activate_on_single_click((GtkTreeView *)tree_view, FALSE);
 //    g_signal_connect(tree_view, "row-activated", G_CALLBACK(on_row_activated), NULL);
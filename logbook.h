@@ -1,6 +1,9 @@
-void logbook_add(char *contact_callsign, char *rst_sent, char *exchange_sent, 
+int logbook_add(char *contact_callsign, char *rst_sent, char *exchange_sent, 
 	char *rst_recv, char *exchange_recv);
-int logbook_query(char *query, int from_id, char *result_file);
+#define LOGBOOK_PIPE 0
+#define LOGBOOK_JSON 1
+int logbook_rows(char *query, int from_id, int count, int format,
+	void (*row)(void *context, int id, char *text), void *context);
 int logbook_count_dup(const char *callsign, int last_seconds);
 int logbook_prev_log(const char *callsign, char *result);
 int logbook_get_grids(void (*f)(char *,int));
@@ -8,5 +11,8 @@ void logbook_list_open();
 void logbook_open();
 bool logbook_grid_exists(char *id);
 bool logbook_caller_exists(char * id);
+bool logbook_caller_worked(const char *callsign, int freq_khz, const char *mode);
+bool logbook_grid_worked(const char *grid, int freq_khz, const char *mode);
 void logbook_delete(int id);
+int logbook_import_adif(const char *path);
 void message_add(char *mode, unsigned int frequency, int outgoing, char *message);
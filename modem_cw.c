@@ -89,6 +89,7 @@
 #include "sdr_ui.h"
 #include "modem_cw.h"
 #include "sound.h"
+#include "spots.h"
 
 
 struct morse_tx {
@@ -506,6 +507,45 @@ static int cw_rx_bin_detect(struct bin *p, int32_t *data){
 	return magnitude;
 } 
 
+/* the decoded words, a call that follows a CQ or a DE is spotted */
+static char cw_word[12], cw_prev_word[12];
+
+static void cw_rx_word_end(struct cw_decoder *p){
+	char message[30];
+
+	if (!cw_word[0])
+		return;
+	if ((!strcmp(cw_prev_word, "CQ") || !strcmp(cw_prev_word, "DE")) 
+		&& spot_is_call(cw_word)){
+		int snr = p->noise_floor > 0 ? 
+			20 * log10((1.0 * p->high_level)/p->noise_floor) : 0;
+		sprintf(message, "%s %s", cw_prev_word, cw_word);
+		spot_add("CW", p->signal.freq, snr, cw_word, "", "", message, 0);
+	}
+	strcpy(cw_prev_word, cw_word);
+	cw_word[0] = 0;
+}
+
+static void cw_rx_word_add(struct cw_decoder *p, const char *letter){
+	int n = strlen(cw_word);
+
+	if (!*letter)
+		return;
+	if (strlen(letter) == 1 && (isalnum(*letter) || *letter == '/')){
+		if (n < sizeof(cw_word) - 1){
+			cw_word[n++] = toupper(*letter);
+			cw_word[n] = 0;
+		}
+		else
+			strcpy(cw_word, "?"); //too long for a call
+	}
+	else {
+		//a prosign or an undecoded letter
+		cw_rx_word_end(p);
+		cw_prev_word[0] = 0;
+	}
+}
+
 static void cw_rx_match_letter(struct cw_decoder *p){
 	char code[MAX_SYMBOLS];
 
@@ -551,10 +591,12 @@ static void cw_rx_match_letter(struct cw_decoder *p){
 	for (int i = 0; i < sizeof(morse_rx_table)/sizeof(struct morse_rx); i++)
 		if (!strcmp(code, morse_rx_table[i].code)){
 			write_console(FONT_CW_RX, morse_rx_table[i].c);
+			cw_rx_word_add(p, morse_rx_table[i].c);
 			return;
 		}
 	//un-decoded phrases
 	write_console(FONT_CW_RX, code);
+	cw_rx_word_add(p, code);
 
 }
 
@@ -633,6 +675,7 @@ static void cw_rx_detect_symbol(struct cw_decoder *p){
 		if (p->next_symbol == 0){
 	 		if(p->ticker > (p->dash_len * 3)/2){
 				write_console(FONT_CW_RX, " ");
+				cw_rx_word_end(p);
 				p->ticker = 0;
 			}
 		}
@@ -641,6 +684,7 @@ static void cw_rx_detect_symbol(struct cw_decoder *p){
 			cw_rx_match_letter(p);
 			if (p->ticker > (p->dash_len * 3)/2){
 				write_console(FONT_CW_RX, " ");
+				cw_rx_word_end(p);
 			}
 			p->ticker = 0;
 		}
@@ -717,6 +761,25 @@ void cw_rx(int32_t *samples, int count){
 	 For those transmitting at higher than 40 wpm, .. some other day
 */
 
+//the speed and the pitch are followed through field callbacks
+static int cw_wpm = 0, cw_pitch = 0;
+
+static void cw_wpm_changed(const char *label, int wpm){
+	if (wpm <= 0)
+		return;
+	cw_wpm = wpm;
+	cw_period = (12 * 9600)/wpm;
+	decoder.wpm = wpm;
+	decoder.dash_len = (18 * SAMPLING_FREQ) / (5 * N_BINS* wpm); 
+}
+
+static void cw_pitch_changed(const char *label, int cw_rx_pitch){
+	cw_pitch = cw_rx_pitch;
+	//retune the rx pitch if needed
+	if (cw_rx_pitch != decoder.signal.freq)
+		cw_rx_bin_init(&decoder.signal, cw_rx_pitch, N_BINS, SAMPLING_FREQ);
+}
+
 void cw_init(){	
 	//cw rx initializeation
 	decoder.ticker = 0;
@@ -744,23 +807,25 @@ void cw_init(){
 	keydown_count = 0;
 	keyup_count = 0;
 	cw_envelope = 0;
+
+	//back to the settings, if we have them already
+	if (cw_wpm)
+		cw_wpm_changed("WPM", cw_wpm);
+	if (cw_pitch)
+		cw_pitch_changed("PITCH", cw_pitch);
 }
 
 void cw_poll(int bytes_available, int tx_is_on){
-	cw_bytes_available = bytes_available;
-	int wpm  = field_int("WPM");
-	cw_period = (12 * 9600)/wpm;
+	static int watching = 0;
 
-	//retune the rx pitch if needed
-	int cw_rx_pitch = field_int("PITCH");
-	if (cw_rx_pitch != decoder.signal.freq)
-		cw_rx_bin_init(&decoder.signal, cw_rx_pitch, N_BINS, SAMPLING_FREQ);
+	cw_bytes_available = bytes_available;
 
-	// check if the wpm has changed
-	if (wpm != decoder.wpm){
-		decoder.wpm = wpm;
-		decoder.dash_len = (18 * SAMPLING_FREQ) / (5 * N_BINS* wpm); 
-	}	
+	//the fields are only there once the ui is up
+	if (!watching){
+		field_watch("WPM", cw_wpm_changed);
+		field_watch("PITCH", cw_pitch_changed);
+		watching = 1;
+	}
 
 	// TX ON if bytes are avaiable (from macro/keyboard) or key is pressed
 	// of we are in the middle of symbol (dah/dit) transmission 
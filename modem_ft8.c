@@ -15,6 +15,9 @@
 #include "sdr_ui.h"
 #include "modem_ft8.h"
 #include "logbook.h"
+#include "spots.h"
+#include "wsjtx.h"
+#include "ntputil.h"
 
 #include "ft8_lib/common/common.h"
 #include "ft8_lib/common/wave.h"
@@ -32,6 +35,8 @@ static char ft8_tx_text[128];
 static int ft8_rx_buff_index = 0;
 static int ft8_tx_buff_index = 0;
 static int	ft8_tx_nsamples = 0;
+static time_t ft8_tx_slot = 0;
+static int ft8_tx_align = 0;
 static int ft8_do_decode = 0;
 static int	ft8_do_tx = 0;
 static int	ft8_pitch = 0;
@@ -45,7 +50,6 @@ extern void call_wipe();
 // how to handle a command option
 #define FT8_START_QSO 1
 #define FT8_CONTINUE_QSO 0
-static unsigned int wallclock =0;
 static const int kMin_score = 10; // Minimum sync score threshold for candidates
 static const int kMax_candidates = 120;
 static const int kLDPC_iterations = 20;
@@ -492,6 +496,10 @@ static int sbitx_ft8_decode(float *signal, int num_samples, bool is_ft8)
 
 				//message_add(char *mode, unsigned int frequency, int outgoing, char *message);
 					message_add("FT8", freq_hz, 0, message.text);
+					spot_ft8(is_ft8 ? "FT8" : "FT4", freq_hz, cand->snr, message.text, 
+						mycallsign_upper);
+					wsjtx_decode(rawtime, cand->snr, time_sec, freq_hz, 
+						is_ft8 ? "FT8" : "FT4", message.text);
 					if (strstr(buff, mycallsign_upper)){
 						write_console(FONT_FT8_REPLY, buff);
 						ft8_process(buff, FT8_CONTINUE_QSO);
@@ -533,7 +541,7 @@ void ft8_setmode(int config){
 	}
 }
 
-static void ft8_start_tx(int offset_seconds){
+static void ft8_start_tx(){
 	char buff[1000];
 	//timestamp the packets for display log
 	time_t	rawtime = time_sbitx();
@@ -543,8 +551,11 @@ static void ft8_start_tx(int offset_seconds){
 	write_console(FONT_FT8_TX, buff);
 	message_add("FT8", ft8_pitch, 1, ft8_tx_text);
 
+	ft8_tx_align = 0;
 	ft8_tx_nsamples = sbitx_ft8_encode(ft8_tx_text, ft8_pitch, ft8_tx_buff, false); 
-	ft8_tx_buff_index = offset_seconds * 96000;
+	//the sound thread lines up the samples with the slot
+	ft8_tx_slot = (rawtime / 15) * 15;
+	ft8_tx_align = 1;
 }
 
 // the ft8_tx() only schedules the transmission
@@ -609,16 +620,23 @@ void *ft8_thread_function(void *ptr){
 
 		ft8_do_decode = 0;
 		sbitx_ft8_decode(ft8_rx_buffer, ft8_rx_buff_index, true);
-		//let the next batch begin
-		ft8_rx_buff_index = 0;
+		//the next batch begins at the slot boundary, in ft8_rx()
 	}
 }
 
 // the ft8 sampling is at 12000, the incoming samples are at
-// 96000 samples/sec
+// 96000 samples/sec. The buffer starts at the very sample that
+// was captured on the slot boundary and is decoded when it is 14 seconds old
 void ft8_rx(int32_t *samples, int count){
 
 	int decimation_ratio = 96000/12000;
+	int slot_start = -1, slot_decode = -1;
+
+	double t = timebase_rx(0);
+	if (t > 0){
+		slot_start = timebase_rx_sample(ceil(t / 15) * 15);
+		slot_decode = timebase_rx_sample(ceil((t - 14) / 15) * 15 + 14);
+	}
 
 	//if there is an overflow, then reset to the begining
 	if (ft8_rx_buff_index + (count/decimation_ratio) >= FT8_MAX_BUFF){
@@ -627,23 +645,18 @@ void ft8_rx(int32_t *samples, int count){
 	}
 
 	//down convert to 12000 Hz sampling rate
-	for (int i = 0; i < count; i += decimation_ratio)
+	for (int i = 0; i < count; i += decimation_ratio){
+		if (slot_start >= 0 && i >= slot_start){
+			ft8_rx_buff_index = 0;
+			slot_start = -1;
+		}
 		//ft8_rx_buff[ft8_rx_buff_index++] = samples[i];
 		ft8_rx_buffer[ft8_rx_buff_index++] = samples[i] / 200000000.0f;
+	}
 
-	int now = time_sbitx();
-	if (now != wallclock)	
-		wallclock = now;
-	else 
-		return;
-
-	int slot_second = wallclock % 15;
-	if (slot_second == 0)
-		ft8_rx_buff_index = 0;
-
-//	printf("ft8 decoding trigger index %d, slot_second %d\n", ft8_rx_buff_index, slot_second);
-	//we should have atleast 12 seconds of samples to decode
-	if (ft8_rx_buff_index >= 13 * 12000 && slot_second > 13)
+//	printf("ft8 decoding trigger index %d, slot_decode %d\n", ft8_rx_buff_index, slot_decode);
+	//we should have atleast 13 seconds of samples to decode
+	if (slot_decode >= 0 && ft8_rx_buff_index >= 13 * 12000)
 		ft8_do_decode = 1;
 }
 
@@ -675,13 +688,40 @@ void ft8_poll(int seconds, int tx_is_on){
 		(ft8_tx1st == 0 && ((seconds >= 15 && seconds < 30)|| 
 			(seconds >= 45 && seconds < 59)))){
 		tx_on(TX_SOFT);
-		ft8_start_tx(seconds % 15);
+		ft8_start_tx();
 		ft8_repeat--;
 	} 
 }
 
 float ft8_next_sample(){
+		static int64_t block = -1;
+		static int block_index = 0;
 		float sample = 0;
+
+		//tx_modem() asks for the samples of a block in order
+		int64_t b = timebase_count();
+		if (b != block){
+			block = b;
+			block_index = 0;
+		}
+		else
+			block_index++;
+
+		//skip into the slot by as much as it is late on air
+		if (ft8_tx_align){
+			double t = timebase_tx(block_index);
+			if (t == 0)
+				t = time_sbitx();
+			ft8_tx_buff_index = (int)((t - ft8_tx_slot) * 96000);
+			ft8_tx_align = 0;
+		}
+
+		//early for the slot, wait it out
+		if (ft8_tx_buff_index < 0){
+			ft8_tx_buff_index++;
+			return 0;
+		}
+
 		if (ft8_tx_buff_index/8 < ft8_tx_nsamples){
 			sample = ft8_tx_buff[ft8_tx_buff_index/8]/7;
 			ft8_tx_buff_index++;
@@ -749,6 +789,14 @@ int ft8_message_tokenize(char *message){
 	return 0;
 }
 
+//a reply without a grid, it may have been heard in their cq
+static void ft8_exch_from_spot(const char *callsign){
+	struct spot s;
+
+	if (spot_find(callsign, &s) && s.grid[0])
+		field_set("EXCH", s.grid);
+}
+
 // this kicks stars a new qso either as a CQ message or
 // as a reply to someone's cq or as a 'break' with signal report to
 // a concluding qso
@@ -801,6 +849,7 @@ void ft8_on_start_qso(char *message){
 			sprintf(reply_message, "%s %s R%s", call, mycall, signal_strength);
 			if (strcmp(m2, cur_call)){ // other  than previous caller - clear EXCH
 				field_set("EXCH", "");
+				ft8_exch_from_spot(m2);
 			}
 		}
 	}
@@ -810,6 +859,7 @@ void ft8_on_start_qso(char *message){
 			field_set("EXCH", m3); // the gridId is valid - use it
 		} else {
 			field_set("EXCH", "");
+			ft8_exch_from_spot(m2);
 		}
 		field_set("SENT", signal_strength);
 		sprintf(reply_message, "%s %s %s", call, mycall, mygrid); //signal_strength);
@@ -915,3 +965,8 @@ void ft8_abort(){
 	ft8_tx_nsamples = 0;
 	ft8_repeat = 0;
 }
+
+//no more repeats, the message on the air now is sent to the end
+void ft8_halt(){
+	ft8_repeat = 0;
+}
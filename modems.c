@@ -27,6 +27,7 @@
 #include "sound.h"
 #include "modem_ft8.h"
 #include "modem_cw.h"
+#include "fldigi.h"
 
 typedef float float32_t;
 
@@ -69,279 +70,35 @@ int qso_state = QSO_STATE_ZOMBIE;
 static int current_mode = -1;
 static unsigned long millis_now = 0;
 
-/* ---- Base64 Encoding/Decoding Table --- */
-char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-/* decodeblock - decode 4 '6-bit' characters into 3 8-bit binary bytes */
-void decodeblock(unsigned char in[], char *clrstr) {
-  unsigned char out[4];
-  out[0] = in[0] << 2 | in[1] >> 4;
-  out[1] = in[1] << 4 | in[2] >> 2;
-  out[2] = in[2] << 6 | in[3] >> 0;
-  out[3] = '\0';
-  strncat(clrstr, out, sizeof(out));
-}
-
-void b64_decode(char *b64src, char *clrdst) {
-  int c, phase, i;
-  unsigned char in[4];
-  char *p;
-
-  clrdst[0] = '\0';
-  phase = 0; i=0;
-  while(b64src[i]) {
-    c = (int) b64src[i];
-    if(c == '=') {
-      decodeblock(in, clrdst); 
-      break;
-    }
-    p = strchr(b64, c);
-    if(p) {
-      in[phase] = p - b64;
-      phase = (phase + 1) % 4;
-      if(phase == 0) {
-        decodeblock(in, clrdst);
-        in[0]=in[1]=in[2]=in[3]=0;
-      }
-    }
-    i++;
-  }
-}
-
-/* encodeblock - encode 3 8-bit binary bytes as 4 '6-bit' characters */
-void encodeblock( unsigned char in[], char b64str[], int len ) {
-    unsigned char out[5];
-    out[0] = b64[ in[0] >> 2 ];
-    out[1] = b64[ ((in[0] & 0x03) << 4) | ((in[1] & 0xf0) >> 4) ];
-    out[2] = (unsigned char) (len > 1 ? b64[ ((in[1] & 0x0f) << 2) |
-             ((in[2] & 0xc0) >> 6) ] : '=');
-    out[3] = (unsigned char) (len > 2 ? b64[ in[2] & 0x3f ] : '=');
-    out[4] = '\0';
-    strncat(b64str, out, sizeof(out));
-}
-
-/* encode - base64 encode a stream, adding padding if needed */
-void b64_encode(char *clrstr, char *b64dst) {
-  unsigned char in[3];
-  int i, len = 0;
-  int j = 0;
-
-  b64dst[0] = '\0';
-  while(clrstr[j]) {
-    len = 0;
-    for(i=0; i<3; i++) {
-     in[i] = (unsigned char) clrstr[j];
-     if(clrstr[j]) {
-        len++; j++;
-      }
-      else in[i] = 0;
-    }
-    if( len ) {
-      encodeblock( in, b64dst, len );
-    }
-  }
-}
-
 /*******************************************************
-**********           FLDIGI xml                  *******
+**********      Modem dispatch routines          *******
 ********************************************************/
-/*
-An almost trivial xml, just enough to work fldigi
-*/
-
 char fldigi_mode[100];
 long fldigi_retry_at = 0;
-/*
-An almost trivial xml, just enough to work fldigi
-*/
-
-int fldigi_call_i(char *action, int param, char *result){
-  char buffer[10000], q[10000], xml[1000];
-  struct sockaddr_in serverAddr;
-  struct sockaddr_storage serverStorage;
-  socklen_t addr_size;
-	struct timeval timeout;
-
-  serverAddr.sin_family = AF_INET;
-  serverAddr.sin_port = htons(7362);
-  serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
-  memset(serverAddr.sin_zero, '\0', sizeof serverAddr.sin_zero);  
-	
-	int fldigi_socket = socket(AF_INET, SOCK_STREAM, 0);
-/*	timeout.tv_sec = 0;
-	timeout.tv_usec = 1000;
-	setsockopt(fldigi_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
-	setsockopt(fldigi_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
-*/
-	*result = 0; //start with a null string so it is returned if nothing is read
-
-  if (connect(fldigi_socket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
-		//puts("unable to connect to the flidigi\n");        
-		close(fldigi_socket);
-		return -1;
-   }
-
-	sprintf(xml, 
-"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-"<methodCall><methodName>%s</methodName>\n"
-"<params>\n<param><value><i4>%d</i4></value></param> </params></methodCall>\n",
-		action, param);
-
-	sprintf(q, 
-		"POST / HTTP/1.1\n"
-		"Host: 127.0.0.1:7362\n"
-		"User-Agent: sbitx/v0.01\n" 
-		"Accept:\n" 
-		"Content-Length: %d\n"
-		"Content-Type: application/x-www-form-urlencoded\n\n"
-		"%s\n",
-		(int)strlen(xml), xml);
- 
-  if (send(fldigi_socket, q, strlen(q), 0) < 0) {
-		puts("Unable to request fldigi");
-		close(fldigi_socket);
-		return -1;
-  } 
-	char buff[10000]; //large, large
-	int e = recv(fldigi_socket, buff, sizeof(buff), 0);
-	if(e < 0) {
-//		puts("Unable to recv from fldigi");
-		close(fldigi_socket);
-		return -1;
-  }
-	buff[e] = 0;
-	result[0] = 0;
-
-	//now check if we got the data in base64
-	char *p = strstr(buff, "<base64>");
-	if (p){
-		p += strlen("<base64"); //skip past the tag
-		char *r =  strchr(p, '<'); //find the end
-		if (r){
-			*r = 0; //terminate the base64 at the end tag
-			int len =  (strlen(p) * 6)/8;
-			b64_decode(p, result);
-			result[len] = 0;
-		}
-	}
-	else
-		strcpy(result, buff);
-  close(fldigi_socket);
-
-	return 0;
-}
-
-int fldigi_call(char *action, char *param, char *result){
-  char buffer[10000], q[10000], xml[1000];
-  struct sockaddr_in serverAddr;
-  struct sockaddr_storage serverStorage;
-  socklen_t addr_size;
-	struct timeval timeout;
-
-  serverAddr.sin_family = AF_INET;
-  serverAddr.sin_port = htons(7362);
-  serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
-  memset(serverAddr.sin_zero, '\0', sizeof serverAddr.sin_zero);  
-	*result = 0;
-	
-	int fldigi_socket = socket(AF_INET, SOCK_STREAM, 0);
-/*	timeout.tv_sec = 0;
-	timeout.tv_usec = 500;
-	setsockopt(fldigi_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
-	setsockopt(fldigi_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
-*/
-  if (connect(fldigi_socket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
-		//puts("unable to connect to the flidigi\n");        
-		close(fldigi_socket);
-		return -1;
-   }
-
-	sprintf(xml, 
-"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-"<methodCall><methodName>%s</methodName>\n"
-"<params>\n<param><value><string>%s</string></value></param> </params></methodCall>\n",
-		action, param);
-
-	sprintf(q, 
-		"POST / HTTP/1.1\n"
-		"Host: 127.0.0.1:7362\n"
-		"User-Agent: sbitx/v0.01\n" 
-		"Accept:\n" 
-		"Content-Length: %d\n"
-		"Content-Type: application/x-www-form-urlencoded\n\n"
-		"%s\n",
-		(int)strlen(xml), xml);
- 
-  if (send(fldigi_socket, q, strlen(q), 0) < 0) {
-		puts("Unable to request fldigi");
-		close(fldigi_socket);
-		return -1;
-  } 
-	char buff[10000]; //large, large
-	int e = recv(fldigi_socket, buff, sizeof(buff), 0);
-	if(e < 0) {
-//		puts("Unable to recv from fldigi");
-		close(fldigi_socket);
-		return -1;
-  }
-	buff[e] = 0;
-	result[0] = 0;
-
-	//now check if we got the data in base64
-	char *p = strstr(buff, "<base64>");
-	if (p){
-		p += strlen("<base64>"); //skip past the tag
-		char *r =  strchr(p, '<'); //find the end
-		if (r){
-			*r = 0; //terminate the base64 at the end tag
-			int len =  (strlen(p) * 6)/8;
-			b64_decode(p, result);
-			result[len] = 0;
-		}
-	}
-	//maybe it is not base64 encoded
-	else if (p = strstr(buff, "<value>")){
-		p += strlen("<value>");
-		char *r = strchr(p, '<');
-		if (r){
-			*r = 0;
-			strcpy(result, p);
-		} 
-	}
-	else
-		strcpy(result, buff);
-  close(fldigi_socket);
-
-	return 0;
-}
-
-
-/*******************************************************
-**********      Modem dispatch routines          *******
-********************************************************/
 int fldigi_in_tx = 0;
 static int rx_poll_count = 0;
 static int sps, deci, s_timer ;
 
+//on the fldigi thread, with the text received since the last poll
+static void fldigi_on_data(char *text){
+	if (strlen(text)){
+		if (text[0] != '<' )
+			text[1] = 0;
+		write_console(FONT_FLDIGI_RX, text);
+	}
+}
 
+//the polls don't wait, the text is written as it comes back
 void fldigi_read(){
-	char buffer[10000];
-
 	//poll only every 250msec
 	if (fldigi_retry_at > millis())
 		return;
 
-	if(!fldigi_call("rx.get_data", "", buffer)){		
-		if (strlen(buffer)){
-				if (buffer[0] != '<' )
-					buffer[1] = 0;
-				write_console(FONT_FLDIGI_RX, buffer);
-//				printf("fldigi rx.get_data{%s}\n", buffer);
-		}
-	}
+	fldigi_send("rx.get_data", "", fldigi_on_data);
 	fldigi_retry_at = millis() + 250;
 }
 
+//rare enough to wait for, the mode is only taken as set once fldigi says so
 void fldigi_set_mode(char *mode){
 	char buffer[1000];
 	if (strcmp(fldigi_mode, mode)){
@@ -355,16 +112,16 @@ void fldigi_set_mode(char *mode){
 void fldigi_tx_more_data(){
 	char c;
 	if (get_tx_data_byte(&c)){
-		char buff[10], resp[1000];
+		char buff[10];
 		buff[0] = c;
 		buff[1] = 0;
-		fldigi_call("text.add_tx", buff, resp);
+		fldigi_send("text.add_tx", buff, NULL);
 		write_console(FONT_FLDIGI_TX, buff);
 	}
 }
 
 static int fldigi_tx_stop(){	
-	char buffer[10000];
+	char buffer[1000];
 
 	if (!fldigi_call("main.rx", "", buffer)){
 		fldigi_in_tx = 0;
@@ -376,10 +133,7 @@ static int fldigi_tx_stop(){
 }
 
 void modem_set_pitch(int pitch){
-	char response[1000];
-
-	fldigi_call_i("modem.set_carrier", pitch, response);
-//		puts("fldigi modem.set_carrier error");
+	fldigi_send_i("modem.set_carrier", pitch, NULL);
 }
 
 
@@ -390,8 +144,10 @@ void modem_rx(int mode, int32_t *samples, int count){
 	FILE *pf;
 	char buff[10000];
 
-	if (get_pitch() != last_pitch && (mode == MODE_CW || mode == MODE_CWR))
-		modem_set_pitch(get_pitch());
+	if (get_pitch() != last_pitch && (mode == MODE_CW || mode == MODE_CWR)){
+		last_pitch = get_pitch();
+		modem_set_pitch(last_pitch);
+	}
 
 	s = samples;
 	switch(mode){
@@ -435,11 +191,8 @@ void modem_poll(int mode, int ticks){
 		//flush out the past decodes
 		//printf("modem_poll set to %d\n", mode);
 		current_mode = mode;
-		int l;
-		do{
-			int e = fldigi_call("rx.get_data", "", buffer);	
-			l = strlen(buffer);
-		}while(l > 0);
+		//a single rx.get_data takes all that fldigi has
+		fldigi_send("rx.get_data", "", NULL);
 
 		//clear the text buffer	
 		abort_tx();
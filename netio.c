@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "netio.h"
+
+/*
+	The control sockets: hamlib (rigctld), the telnet remote and wsjtx.
+	They used to be polled from the ui_tick() with one client each.
+	Now a single thread sleeps in epoll_wait() on all of them and
+	handles each line as soon as it arrives. Each service can have
+	several clients, each with its own line buffer.
+
+	The handlers run on this thread. They must not touch the gtk; the
+	commands that change the radio go through remote_execute() to the
+	gtk thread. A line handler can return NETIO_LATER to leave the line
+	in its buffer. It is offered again after a millisecond. The hamlib
+	uses this to hold back a query until the commands it queued earlier
+	have been carried out.
+*/
+
+#define NETIO_SERVICES 8
+#define NETIO_CLIENTS 32
+#define NETIO_LINE 1000
+
+struct netio_service {
+	char *name;
+	int fd;
+	void (*on_open)(int client);
+	int (*on_line)(int client, char *line);
+	void (*on_datagram)(char *data, int length, struct sockaddr_in *from);
+};
+
+struct netio_client {
+	int fd;
+	int service;
+	int later;	//a line is waiting to be handled again
+	int paused;	//the held back lines fill the buffer, not reading
+	int length;
+	char data[NETIO_LINE];
+};
+
+static struct netio_service services[NETIO_SERVICES];
+static int n_services = 0;
+static struct netio_client clients[NETIO_CLIENTS];
+static int epoll_fd = -1;
+static pthread_t netio_thread;
+static pthread_mutex_t netio_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//the epoll data is the service index for the listeners,
+//NETIO_SERVICES + slot for the clients
+static int netio_watch(int fd, int id){
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = id;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+//stops or resumes reading from a client
+static void netio_pause(int client, int pause){
+	struct netio_client *c = clients + client;
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = pause ? 0 : EPOLLIN;
+	ev.data.u32 = NETIO_SERVICES + client;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->paused = pause;
+}
+
+static void netio_init(){
+	if (epoll_fd != -1)
+		return;
+	for (int i = 0; i < NETIO_CLIENTS; i++)
+		clients[i].fd = -1;
+	epoll_fd = epoll_create1(0);
+}
+
+static int netio_service_add(char *name, int fd){
+	if (n_services == NETIO_SERVICES){
+		printf("*Error: too many network services, %s is not started\n", name);
+		return -1;
+	}
+	netio_init();
+
+	struct netio_service *s = services + n_services;
+	memset(s, 0, sizeof(*s));
+	s->name = name;
+	s->fd = fd;
+	if (netio_watch(fd, n_services)){
+		printf("*Error: %s can't be watched: %s\n", name, strerror(errno));
+		return -1;
+	}
+	return n_services++;
+}
+
+static int netio_socket(char *name, int type, char *address, int port){
+	struct sockaddr_in addr;
+	int one = 1;
+
+	int fd = socket(AF_INET, type | SOCK_NONBLOCK, 0);
+	if (fd < 0){
+		printf("*Error: %s socket: %s\n", name, strerror(errno));
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	//the datagrams to a multicast group stay on the local network
+	if (type == SOCK_DGRAM)
+		setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = address ? inet_addr(address) : INADDR_ANY;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))){
+		printf("*Error: %s can't bind to port %d: %s\n", name, port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int netio_listen(char *name, char *address, int port,
+	void (*on_open)(int client), int (*on_line)(int client, char *line)){
+
+	int fd = netio_socket(name, SOCK_STREAM, address, port);
+	if (fd < 0)
+		return -1;
+	if (listen(fd, 5)){
+		printf("*Error: %s listen(): %s\n", name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	pthread_mutex_lock(&netio_lock);
+	int service = netio_service_add(name, fd);
+	if (service >= 0){
+		services[service].on_open = on_open;
+		services[service].on_line = on_line;
+	}
+	pthread_mutex_unlock(&netio_lock);
+	return service;
+}
+
+int netio_udp(char *name, char *address, int port,
+	void (*on_datagram)(char *data, int length, struct sockaddr_in *from)){
+
+	int fd = netio_socket(name, SOCK_DGRAM, address, port);
+	if (fd < 0)
+		return -1;
+
+	pthread_mutex_lock(&netio_lock);
+	int service = netio_service_add(name, fd);
+	if (service >= 0)
+		services[service].on_datagram = on_datagram;
+	pthread_mutex_unlock(&netio_lock);
+	return service;
+}
+
+/* these are called with the netio_lock held */
+
+static void netio_drop(int client){
+	struct netio_client *c = clients + client;
+
+	if (c->fd < 0)
+		return;
+	printf("%s client %d disconnected\n", services[c->service].name, client);
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	c->later = 0;
+	c->paused = 0;
+	c->length = 0;
+}
+
+//a client that can't keep up with its replies is dropped
+static int netio_write(int client, char *data, int length){
+	struct netio_client *c = clients + client;
+
+	if (c->fd < 0)
+		return -1;
+	int e = send(c->fd, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (e != length){
+		netio_drop(client);
+		return -1;
+	}
+	return 0;
+}
+
+static void netio_accept(int service){
+	struct netio_service *s = services + service;
+	int fd, i;
+
+	while ((fd = accept(s->fd, NULL, NULL)) >= 0){
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		for (i = 0; i < NETIO_CLIENTS; i++)
+			if (clients[i].fd < 0)
+				break;
+		if (i == NETIO_CLIENTS){
+			printf("*Error: %s is refused, too many clients\n", s->name);
+			close(fd);
+			continue;
+		}
+		clients[i].fd = fd;
+		clients[i].service = service;
+		clients[i].later = 0;
+		clients[i].paused = 0;
+		clients[i].length = 0;
+		netio_watch(fd, NETIO_SERVICES + i);
+		printf("%s client %d connected\n", s->name, i);
+		if (s->on_open)
+			s->on_open(i);
+	}
+}
+
+//hands over each complete line, stops if the handler wants it later
+static void netio_lines(int client){
+	struct netio_client *c = clients + client;
+	struct netio_service *s = services + c->service;
+	char line[NETIO_LINE];
+	int start = 0;
+
+	c->later = 0;
+	for (int i = 0; i < c->length && c->fd >= 0; i++){
+		if (c->data[i] != '\n')
+			continue;
+		int n = i - start;
+		memcpy(line, c->data + start, n);
+		if (n > 0 && line[n-1] == '\r')
+			n--;
+		line[n] = 0;
+		if (s->on_line(client, line) == NETIO_LATER){
+			c->later = 1;
+			break;
+		}
+		start = i + 1;
+	}
+	if (c->fd < 0)
+		return;
+	c->length -= start;
+	memmove(c->data, c->data + start, c->length);
+}
+
+static void netio_read(int client){
+	struct netio_client *c = clients + client;
+
+	int n = recv(c->fd, c->data + c->length, sizeof(c->data) - c->length, 0);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)){
+		netio_drop(client);
+		return;
+	}
+	if (n < 0)
+		return;
+	c->length += n;
+	if (!c->later)
+		netio_lines(client);
+	if (c->fd < 0 || c->length < (int)sizeof(c->data))
+		return;
+	//a line longer than the buffer is junk
+	if (!memchr(c->data, '\n', c->length))
+		c->length = 0;
+	//complete lines are waiting, read no more till they are handled
+	else
+		netio_pause(client, 1);
+}
+
+static void netio_datagrams(int service){
+	struct netio_service *s = services + service;
+	struct sockaddr_in from;
+	socklen_t from_length;
+	char buff[2048];
+	int n;
+
+	from_length = sizeof(from);
+	while ((n = recvfrom(s->fd, buff, sizeof(buff), 0,
+		(struct sockaddr *)&from, &from_length)) >= 0){
+		s->on_datagram(buff, n, &from);
+		from_length = sizeof(from);
+	}
+}
+
+static void *netio_thread_function(void *ptr){
+	struct epoll_event events[16];
+	int timeout = -1;
+
+	while (1){
+		int n = epoll_wait(epoll_fd, events, 16, timeout);
+		if (n < 0 && errno != EINTR){
+			printf("*Error: epoll_wait: %s\n", strerror(errno));
+			sleep(1);
+			continue;
+		}
+
+		pthread_mutex_lock(&netio_lock);
+		for (int i = 0; i < n; i++){
+			int id = events[i].data.u32;
+			if (id >= NETIO_SERVICES)
+				netio_read(id - NETIO_SERVICES);
+			else if (services[id].on_datagram)
+				netio_datagrams(id);
+			else
+				netio_accept(id);
+		}
+
+		//offer again the lines that were held back
+		timeout = -1;
+		for (int i = 0; i < NETIO_CLIENTS; i++)
+			if (clients[i].fd >= 0 && clients[i].later){
+				netio_lines(i);
+				if (clients[i].later)
+					timeout = 1;
+				if (clients[i].fd >= 0 && clients[i].paused
+					&& clients[i].length < (int)sizeof(clients[i].data))
+					netio_pause(i, 0);
+			}
+		pthread_mutex_unlock(&netio_lock);
+	}
+	return NULL;
+}
+
+void netio_start(){
+	pthread_mutex_lock(&netio_lock);
+	netio_init();
+	pthread_mutex_unlock(&netio_lock);
+	pthread_create(&netio_thread, NULL, netio_thread_function, NULL);
+}
+
+/* only from the handlers, they already hold the lock */
+
+int netio_send(int client, char *text){
+	return netio_write(client, text, strlen(text));
+}
+
+void netio_close(int client){
+	netio_drop(client);
+}
+
+/* from any thread, the handlers too, a datagram socket needs no lock */
+
+int netio_sendto(int service, char *data, int length, struct sockaddr_in *to){
+	if (service < 0 || service >= n_services)
+		return -1;
+	return sendto(services[service].fd, data, length, MSG_DONTWAIT, 
+		(struct sockaddr *)to, sizeof(*to));
+}
+
+/* from any other thread */
+
+void netio_broadcast(int service, char *text){
+	int length = strlen(text);
+
+	if (service < 0)
+		return;
+	pthread_mutex_lock(&netio_lock);
+	for (int i = 0; i < NETIO_CLIENTS; i++)
+		if (clients[i].fd >= 0 && clients[i].service == service)
+			netio_write(i, text, length);
+	pthread_mutex_unlock(&netio_lock);
+}
+
+/* an echo server on port 7000, try it with a few telnet sessions
+static int echo_line(int client, char *line){
+	netio_send(client, line);
+	netio_send(client, "\n");
+	return 0;
+}
+
+void main(int argc, char **argv){
+	int echo = netio_listen("echo", NULL, 7000, NULL, echo_line);
+	netio_start();
+	while (1){
+		sleep(5);
+		netio_broadcast(echo, "tick\n");
+	}
+}
+*/
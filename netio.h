@@ -0,0 +1,15 @@
+#define NETIO_LATER 1 //returned by a line handler to be offered the line again
+
+int netio_listen(char *name, char *address, int port,
+	void (*on_open)(int client), int (*on_line)(int client, char *line));
+int netio_udp(char *name, char *address, int port,
+	void (*on_datagram)(char *data, int length, struct sockaddr_in *from));
+void netio_start();
+
+//these are only for the handlers, on the netio thread
+int netio_send(int client, char *text);
+void netio_close(int client);
+
+//these can be called from any thread
+void netio_broadcast(int service, char *text);
+int netio_sendto(int service, char *data, int length, struct sockaddr_in *to);
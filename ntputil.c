@@ -1,8 +1,11 @@
 #include <ctype.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/timex.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <arpa/inet.h>
@@ -12,12 +15,12 @@
 #include <time.h>
 #include <wiringPi.h>
 #include "sdr_ui.h"
-#include  "i2cbb.h"
+#include  "i2c.h"
 // This is a simple NTP client implimentation for the sBitx that will check the current computer time against the defined ntp server pool and adjust 
 // the local time on the machine accordingly if it is +/- 1 second out of sync.
 // 6/30/24 W2JON
 
-static uint32_t time_delta = 0;
+static int64_t time_delta = 0;	//msecs from millis() to UTC, 0 without an RTC
 #define DS3231_I2C_ADD 0x68
 #define NTP_TIMESTAMP_DELTA (2208988800ull)
 
@@ -50,11 +53,117 @@ static uint8_t bcd2dec(uint8_t val){
 	return ((val/16 * 10) + (val %16));
 }
 
+static double time_sbitx_exact();
+
+//the same clock as the time base, so the slots agree with timebase_tx()
 time_t time_sbitx(){
-	if (!time_delta)
-		return time(NULL);
-	else
-		return time_delta + (long)(millis()/1000l);
+	return (time_t)floor(time_sbitx_exact());
+}
+
+/* the sample clock
+	time_sbitx() only ticks in whole seconds, too coarse to cut the FT8
+	slots on. The sound card counts its samples on its own crystal, that
+	is a much finer clock, but it drifts from UTC by some ppm.
+	Each block read from the card is stamped with the wall clock and a
+	second order loop locks the sample count to it. The phase term follows
+	the wall clock slowly enough to smooth out the wake up jitter of the
+	sound thread, the frequency term learns the crystal's error. After
+	a second or so, any sample's UTC time is known to well under a msec.
+	A jump larger than TB_STEP (an overrun of the card or the clock being
+	set) restarts the loop from the next block.
+
+	The blocks are stamped from the sound thread, the modems read the
+	time base from the same thread as they process the samples.
+*/
+
+#define TB_STEP 0.25
+#define TB_KP (1.0/32)
+#define TB_KI (1.0/2048)
+#define TB_PPM 500
+
+static int64_t tb_count = 0;	//samples read so far
+static double tb_time = 0;		//when the last sample of the block was read
+static double tb_period = 0;	//seconds per sample, as measured
+static int tb_rate = 0;
+static int tb_block = 0;			//samples in the current block
+static int tb_delay = 0;			//samples ahead of us in the play queue
+
+/* the time_sbitx() with the fraction of the second.
+	A system clock kept by ntp is better than the RTC, which is only
+	timed to the msec at its seconds edge by rtc_read() */
+static double time_sbitx_exact(){
+	struct timespec ts;
+	struct timex tx;
+
+	memset(&tx, 0, sizeof(tx));
+	int state = adjtimex(&tx);
+	if (time_delta && (state == TIME_ERROR || (tx.status & STA_UNSYNC)))
+		return (time_delta + millis()) / 1000.0;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* count is the number of samples just read, queued are the samples 
+	still left in the capture buffer after them and delay is
+	the number of samples waiting to be played out */
+void timebase_block(int count, int rate, int queued, int delay){
+	if (count <= 0)
+		return;
+	if (queued < 0)
+		queued = 0;
+
+	double now = time_sbitx_exact() - (double)queued / rate;
+	tb_count += count;
+	tb_block = count;
+	tb_delay = delay > 0 ? delay : 0;
+
+	double expected = tb_time + count * tb_period;
+	double error = now - expected;
+	if (rate != tb_rate || fabs(error) > TB_STEP){
+		tb_rate = rate;
+		tb_period = 1.0 / rate;
+		tb_time = now;
+		return;
+	}
+
+	tb_time = expected + TB_KP * error;
+	tb_period += TB_KI * error / count;
+
+	//no crystal is that far off, the wall clock was slewed
+	double nominal = 1.0 / rate;
+	if (tb_period > nominal * (1 + TB_PPM / 1e6))
+		tb_period = nominal * (1 + TB_PPM / 1e6);
+	if (tb_period < nominal * (1 - TB_PPM / 1e6))
+		tb_period = nominal * (1 - TB_PPM / 1e6);
+}
+
+//changes with every block read, the sound thread's block sequence
+int64_t timebase_count(){
+	return tb_count;
+}
+
+//when the i-th sample of the current block was captured, 0 if unknown
+double timebase_rx(int i){
+	if (!tb_rate)
+		return 0;
+	return tb_time - (tb_block - 1 - i) * tb_period;
+}
+
+//when the i-th sample written out in the current block will be played
+double timebase_tx(int i){
+	if (!tb_rate)
+		return 0;
+	return tb_time + (tb_delay + i + 1) * tb_period;
+}
+
+//the first sample of the current block captured at or after utc, -1 if none
+int timebase_rx_sample(double utc){
+	if (!tb_rate)
+		return -1;
+	double i = ceil((utc - timebase_rx(0)) / tb_period);
+	if (i < 0 || i >= tb_block)
+		return -1;
+	return (int)i;
 }
 
 void rtc_write_ntp(int year, int month, int day, int hours, int minutes, int seconds){
@@ -71,27 +180,40 @@ void rtc_write_ntp(int year, int month, int day, int hours, int minutes, int sec
 	printf("Updating the RTC with network time\n");
 	
 	for (uint8_t i = 0; i < 7; i++){
-  	int e = i2cbb_write_byte_data(DS3231_I2C_ADD, i, rtc_time[i]);
+  	int e = i2c_write_byte_data(DS3231_I2C_ADD, i, rtc_time[i]);
 		if (e)
 			printf("rtc_write: error writing DS3231 register at %d index\n", i);
 	}
 }
 
 void rtc_read(){
-	uint8_t rtc_time[10];
+	uint8_t rtc_time[10], next[10];
 	char buff[100];
 	struct tm t;
 	time_t gm_now;
 
-	i2cbb_write_i2c_block_data(DS3231_I2C_ADD, 0, 0, NULL);
-
-	int e =  i2cbb_read_i2c_block_data(DS3231_I2C_ADD, 0, 8, rtc_time);
+	uint8_t reg = 0;
+	int e =  i2c_write_read(DS3231_I2C_ADD, &reg, 1, rtc_time, 8);
 	if (e <= 0){
 		printf("RTC not detected\n");
 		//go with the system time
 		time_delta = 0; // this forces time_sbitx() to return the system time
 		return;
 	}
+
+	//the seconds register turns over at the start of the second, 
+	//wait for it so that the time is known to the msec, not the second
+	unsigned int start = millis(), edge = start;
+	while (millis() - start < 1100){
+		delay(1);
+		if (i2c_write_read(DS3231_I2C_ADD, &reg, 1, next, 8) <= 0)
+			break;
+		if (next[0] != rtc_time[0]){
+			edge = millis();
+			memcpy(rtc_time, next, 8);
+			break;
+		}
+	}
 	for (int i = 0; i < 7; i++)
 		rtc_time[i] = bcd2dec(rtc_time[i]);
 
@@ -111,7 +233,7 @@ void rtc_read(){
 	t.tm_mon -= 1;
 	setenv("TZ", "UTC", 1);	
 	gm_now = mktime(&t);
-	time_delta =(long)gm_now -(((long)millis())/1000l);
+	time_delta = (int64_t)gm_now * 1000 - edge;
 }
 
 long getaddress(const char* host) {
@@ -226,3 +348,37 @@ int sync_sbitx_time(const char* ntp_server) {
 	printf("Time synchronized with the network.\n");
 	return 0;
 }
+
+/* time base test, a card with a crystal 80 ppm fast and a sound thread
+	that wakes up a msec late on the average. Comment out the 
+	time_sbitx_exact() above and link with -lm
+
+static double sim_now;
+static double time_sbitx_exact(){
+	return sim_now;
+}
+
+void main(int argc, char **argv){
+	double period = (1 + 80e-6) / 96000, start = 1700000000.123456;
+	double worst = 0, sum = 0;
+	int64_t n = 0;
+	int count = 0;
+
+	for (int b = 0; b < 120 * 96000 / 1024; b++){
+		n += 1024;
+		double late = -log((rand() + 1.0) / RAND_MAX) * 0.001;
+		sim_now = start + (n - 1) * period + late;
+		timebase_block(1024, 96000, 0, 2048);
+
+		//after the first second
+		if (b < 100)
+			continue;
+		double error = timebase_rx(0) - (start + (n - 1024) * period);
+		if (fabs(error) > worst)
+			worst = fabs(error);
+		sum += error * error;
+		count++;
+	}
+	printf("rms %.3f msec, worst %.3f msec\n", sqrt(sum / count) * 1e3, worst * 1e3);
+}
+*/
@@ -1,9 +1,15 @@
 #ifndef NTPUTIL_H
 #define NTPUTIL_H
+#include <stdint.h>
 
 // Function declarations
 int sync_sbitx_time(const char* ntp_server);
 void rtc_write_ntp(int year, int month, int day, int hours, int minutes, int seconds);
 void rtc_read();
+void timebase_block(int count, int rate, int queued, int delay);
+int64_t timebase_count();
+double timebase_rx(int i);
+double timebase_tx(int i);
+int timebase_rx_sample(double utc);
 #endif  // NTPUTIL_H
 
@@ -1,3 +1,2 @@
 void remote_write(char *message);
 void remote_start();
-void remote_slice();
@@ -1,5 +1,10 @@
 #include <stdint.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <complex.h>
+#include <fftw3.h>
+#include "sdr.h"
+#include "resampler.h"
 
 
 void resample(int32_t *in, int in_count, int32_t *out, int out_count){
@@ -8,7 +13,7 @@ void resample(int32_t *in, int in_count, int32_t *out, int out_count){
 	int length = in_count * out_count;
 	int sample;
 
-	printf("Resampling from %d to %d\n", in_count, out_count);
+	//printf("Resampling from %d to %d\n", in_count, out_count);
 	out_sample = 0;
 	in_sample = 0;
 
@@ -30,6 +35,90 @@ void resample(int32_t *in, int in_count, int32_t *out, int out_count){
 	}
 }
 
+/* 
+	The adaptive resampler
+	This streams samples out of a queue that is filled by another sound card
+	(like the loopback from fldigi), running on its own clock. The two clocks
+	drift apart by a few parts in ten thousand. The ratio of input to output 
+	samples is trimmed by a PI controller that holds the queue at a target 
+	length. The interpolation is a four point cubic (Catmull-Rom), it is
+	cheap and good enough for the audio that goes to the transmit filter.
+*/
+
+#define RS_MAX_TRIM (0.005) //the clocks are never 0.5% apart
+
+void rs_init(struct resampler *r, int in_rate, int out_rate, int target){
+	r->nominal = (1.0 * in_rate) / out_rate;
+	r->ratio = r->nominal;
+	r->phase = 0;
+	r->target = target;
+	r->integral = 0;
+	r->kp = 0.00002;
+	r->ki = 0.0000002;
+	for (int i = 0; i < 4; i++)
+		r->history[i] = 0;
+	r->underflow = 0;
+}
+
+static inline double rs_cubic(double *y, double t){
+	double a = -0.5*y[0] + 1.5*y[1] - 1.5*y[2] + 0.5*y[3];
+	double b = y[0] - 2.5*y[1] + 2.0*y[2] - 0.5*y[3];
+	double c = -0.5*y[0] + 0.5*y[2];
+	return ((a*t + b)*t + c)*t + y[1];
+}
+
+/* call it once per block, before rs_read(), 
+it returns -1 if the queue is still filling up */
+int rs_update(struct resampler *r, struct Queue *q, int out_count){
+	int fill = q_length(q);
+
+	//wait for the queue to fill up to the target before starting
+	if (q->stall){
+		if (fill < r->target)
+			return -1;
+		q->stall = 0;
+		r->integral = 0;
+	}
+
+	//not enough for this block, start all over again
+	if (fill < (int)(out_count * r->ratio) + 2){
+		q->stall = 1;
+		r->underflow++;
+		return -1;
+	}
+
+	double error = fill - r->target;
+	r->integral += error;
+	double trim = (r->kp * error) + (r->ki * r->integral);
+
+	//clamp the trim and stop the integrator from winding up
+	if (trim > RS_MAX_TRIM){
+		trim = RS_MAX_TRIM;
+		r->integral -= error;
+	}
+	else if (trim < -RS_MAX_TRIM){
+		trim = -RS_MAX_TRIM;
+		r->integral -= error;
+	}
+	r->ratio = r->nominal * (1.0 + trim);
+	return 0;
+}
+
+void rs_read(struct resampler *r, struct Queue *q, int32_t *out, int out_count){
+	for (int i = 0; i < out_count; i++){
+		while (r->phase >= 1.0){
+			r->history[0] = r->history[1];
+			r->history[1] = r->history[2];
+			r->history[2] = r->history[3];
+			r->history[3] = q_read(q);
+			r->phase -= 1.0;
+		}
+		out[i] = rs_cubic(r->history, r->phase);
+		r->phase += r->ratio;
+	}
+}
+
+/*
 int32_t in_samples[] = 
 {0,10,20,30,40,50,60,50,40,30,20,10,0,-10,-20,-30,-40,-50,-60,-50,-40,-30,-20,-10,0,10,20,30,
 40,50,60,50,30,20,10,0};
@@ -40,3 +129,29 @@ void main(int argc, char **argv){
 	for (int i = 0; i < 24; i++)
 		printf("%d: %d : %d\n", i, in_samples[i], out_samples[i]);
 }
+*/
+
+/* simulate a 48000 sample producer that runs 300 ppm fast 
+into a 96000 consumer, the queue should settle at the target
+void main(int argc, char **argv){
+	struct Queue q;
+	struct resampler r;
+	int32_t out[1024];
+	double produced = 0;
+
+	q_init(&q, 10240);
+	rs_init(&r, 48000, 96000, 2048);
+	for (int block = 0; block < 3000; block++){
+		produced += 512 * 1.0003;
+		while (produced >= 1.0){
+			q_write(&q, 0);
+			produced -= 1.0;
+		}
+		if (rs_update(&r, &q, 1024) == 0)
+			rs_read(&r, &q, out, 1024);
+		if (block % 100 == 0)
+			printf("%d: queue %d, ratio %.7f, underflows %d\n", 
+				block, q_length(&q), r.ratio, r.underflow);
+	}
+}
+*/
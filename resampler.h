@@ -0,0 +1,15 @@
+struct resampler {
+	double nominal;		//input samples per output sample, without the trim
+	double ratio;			//input samples per output sample, as trimmed
+	double phase;			//position between history[1] and history[2]
+	int target;				//queue length to hold
+	double integral;
+	double kp, ki;
+	double history[4];
+	int underflow;
+};
+
+void resample(int32_t *in, int in_count, int32_t *out, int out_count);
+void rs_init(struct resampler *r, int in_rate, int out_rate, int target);
+int rs_update(struct resampler *r, struct Queue *q, int out_count);
+void rs_read(struct resampler *r, struct Queue *q, int32_t *out, int out_count);
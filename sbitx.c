@@ -18,7 +18,7 @@
 #include "sdr.h"
 #include "sdr_ui.h"
 #include "sound.h"
-#include "i2cbb.h"
+#include "i2c.h"
 #include "si5351.h"
 #include "ini.h"
 int set_field(char *, char *);  // This should be moved to a .h file
@@ -47,6 +47,7 @@ FILE *pf_debug = NULL;
 #define SBITX_V4 (4)
 
 int sbitx_version = -1;
+static char i2c_bus[100] = "bitbang"; //or /dev/i2c-N, see i2c.c
 int fwdpower, vswr;
 float fft_bins[MAX_BINS]; // spectrum ampltiudes  
 int spectrum_plot[MAX_BINS];
@@ -93,7 +94,7 @@ static double alc_level = 1.0;
 static int tr_relay = 0;
 static int rx_pitch = 700; //used only to offset the lo for CW,CWR
 static int bridge_compensation = 100;
-static double voice_clip_level = 0.1;
+static double voice_clip_level = 0;
 static int in_calibration = 1; // this turns off alc, clipping et al
 static int mode_in_tune = MODE_USB;
 static int in_tune_tx = 0;
@@ -136,6 +137,25 @@ struct power_settings band_power[] ={
 
 struct Queue qremote;
 
+/* Digital-first tuning
+The 96 KHz slice that rx_linear() gets is much wider than the 
+passband. Small tuning steps (like spinning the tuning knob) are 
+done by moving the tuned_bin within the slice, each bin is 46.875 Hz. 
+The tuned_bin only moves in steps of two bins: the fft advances by
+half its length each block, so an odd rotation would flip the sign
+of every other block. The remainder, up to a bin either way, is taken
+out by a complex mixer on the baseband. The si5351 is reprogrammed only when the 
+frequency moves out of DIGITAL_TUNE_WINDOW from where the 
+lo was last set, or when we transmit.
+*/
+#define BIN_HZ (96000.0/MAX_BINS)
+#define DIGITAL_TUNE_WINDOW (4000)
+#define DIGITAL_TUNE_BINS ((int)(DIGITAL_TUNE_WINDOW/BIN_HZ) + 1)
+
+static int lo_freq = -1;	//the frequency the si5351 is actually tuned to
+static double fine_offset = 0;	// residual offset in hz, up to a bin
+static double complex fine_osc = 1.0;
+
 void radio_tune_to(u_int32_t f){
 	printf("radio_tune_t %d\n", f);
 	if (rx_list->mode == MODE_CW)
@@ -145,9 +165,31 @@ void radio_tune_to(u_int32_t f){
 	else
   	si5351bx_setfreq(2, f + bfo_freq - 24000 + TUNING_SHIFT);
 
+	//the lo is now centered on f, no digital offset
+	lo_freq = f;
+	rx_list->tuned_bin = MAX_BINS/4;
+	fine_offset = 0;
+
 //  printf("Setting radio rx_pitch %d\n", rx_pitch);
 }
 
+/* returns -1 if f is too far from the lo to be tuned 
+in the slice, the caller has to retune the lo */
+static int radio_tune_digital(int f){
+	if (lo_freq == -1 || in_tx)
+		return -1;
+
+	int offset = f - lo_freq;
+	if (offset > DIGITAL_TUNE_WINDOW || offset < -DIGITAL_TUNE_WINDOW)
+		return -1;
+
+	// a signal moving up in frequency moves up in the bins too
+	int bins = 2 * (int)floor((offset / (2 * BIN_HZ)) + 0.5);
+	rx_list->tuned_bin = MAX_BINS/4 + bins;
+	fine_offset = offset - (bins * BIN_HZ);
+	return 0;
+}
+
 void fft_init(){
 	// int mem_needed;
 
@@ -235,7 +277,8 @@ void spectrum_update(){
 
 	// this has been hand optimized to lower
 	//the inordinate cpu usage
-	for (int i = 1269; i < 1803; i++){
+	//the extra bins on either side cover the digital tuning window
+	for (int i = 1269 - DIGITAL_TUNE_BINS; i < 1803 + DIGITAL_TUNE_BINS; i++){
 
 		fft_bins[i] = ((1.0 - spectrum_speed) * fft_bins[i]) + 
 			(spectrum_speed * cabs(fft_spectrum[i]));
@@ -291,12 +334,90 @@ int calculate_s_meter() {
 	return (s_units * 100) + additional_db;
 }
 
-int remote_audio_output(int16_t *samples){
-	int length = q_length(&qremote);
-	for (int i = 0; i < length; i++){
-		samples[i] = q_read(&qremote) / 32786;
+/* The remote audio is decimated from 96000 to 8000, 12000 or 16000 
+samples/sec through a blackman windowed sinc lowpass. The filter is only 
+computed at the output samples. The taps scale with the decimation, so the 
+transition band is always about 5.5 * 96000/taps wide and ends at the
+new nyquist frequency, everything above it is down by 73 db or more */
+
+#define REMOTE_TAPS_PER_FACTOR 48
+#define REMOTE_MAX_TAPS (REMOTE_TAPS_PER_FACTOR * 12)
+
+static int remote_rate = 0;
+static int remote_rate_request = 16000;
+static int remote_factor;
+static int remote_taps;
+static int remote_phase;
+static float remote_coeff[REMOTE_MAX_TAPS];
+static float remote_history[REMOTE_MAX_TAPS + MAX_BINS/2];
+
+static void remote_filter_design(int rate){
+	remote_factor = 96000/rate;
+	remote_taps = REMOTE_TAPS_PER_FACTOR * remote_factor;
+	float transition = 5.5 * 96000.0/remote_taps;
+	float fc = (rate/2 - transition/2)/96000.0;
+	float sum = 0;
+
+	for (int i = 0; i < remote_taps; i++){
+		float t = i - (remote_taps - 1)/2.0;
+		float sinc = t == 0 ? 2 * fc : sin(2 * M_PI * fc * t)/(M_PI * t);
+		remote_coeff[i] = sinc * (0.42 - 0.5 * cos(2 * M_PI * i/(remote_taps - 1))
+			+ 0.08 * cos(4 * M_PI * i/(remote_taps - 1)));
+		sum += remote_coeff[i];
+	}
+	for (int i = 0; i < remote_taps; i++)
+		remote_coeff[i] /= sum;
+
+	memset(remote_history, 0, sizeof(remote_history));
+	remote_phase = 0;
+	remote_rate = rate;
+}
+
+//called from the dsp thread with each block of the speaker output
+static void remote_audio_input(int32_t *samples, int n){
+	int i;
+
+	if (remote_rate != remote_rate_request)
+		remote_filter_design(remote_rate_request);
+
+	//the history holds the last taps - 1 samples, followed by the block
+	float *x = remote_history + remote_taps - 1;
+	for (i = 0; i < n; i++)
+		x[i] = samples[i];
+
+	for (i = remote_phase; i < n; i += remote_factor){
+		float y = 0;
+		float *p = x + i;
+		for (int t = 0; t < remote_taps; t++)
+			y += remote_coeff[t] * p[-t];
+		q_write(&qremote, (int32_t)y);
+	}
+	remote_phase = i - n;
+	memmove(remote_history, remote_history + n, (remote_taps - 1) * sizeof(float));
+}
+
+//requests 8000, 12000 or 16000 samples/sec, returns the rate in use
+//a rate of 0 just returns the present rate
+int remote_audio_rate(int rate){
+	if (rate == 8000 || rate == 12000 || rate == 16000)
+		remote_rate_request = rate;
+	return remote_rate_request;
+}
+
+//reads exactly count samples of remote audio, or none if not yet available
+//a count of 0 discards whatever is queued
+int remote_audio_output(int16_t *samples, int count){
+	if (count == 0){
+		//only the reader's end moves, the dsp thread is still writing
+		while (q_length(&qremote) > 0)
+			q_read(&qremote);
+		return 0;
 	}
-	return length;
+	if (q_length(&qremote) < count)
+		return 0;
+	for (int i = 0; i < count; i++)
+		samples[i] = q_read(&qremote) / 32786;
+	return count;
 }
 
 static int prev_lpf = -1;
@@ -346,7 +467,8 @@ void set_rx1(int frequency){
 	last_frequency = frequency;
 	if (frequency == freq_hdr)
 		return;
-	radio_tune_to(frequency);
+	if (radio_tune_digital(frequency) == -1)
+		radio_tune_to(frequency);
 	freq_hdr = frequency;
 	if (sbitx_version  < 4) 
 		set_lpf_40mhz(frequency);
@@ -427,12 +549,15 @@ int32_t	out_i[MAX_BINS];
 int32_t out_q[MAX_BINS];
 short is_ready = 0;
 
+static void sp_init();
+
 void tx_init(int frequency, short mode, int bpf_low, int bpf_high){
 
 	//we assume that there are 96000 samples / sec, giving us a 48khz slice
 	//the tuning can go up and down only by 22 KHz from the center_freq
 
 	tx_filter = filter_new(1024, 1025);
+	sp_init();
 //	filter_tune(tx_filter, (1.0 * bpf_low)/96000.0, (1.0 * bpf_high)/96000.0 , 5);
 }
 
@@ -660,9 +785,10 @@ void rx_linear(int32_t *input_rx,  int32_t *input_mic,
 	struct rx *r = rx_list;
 
 	//STEP 4: we rotate the bins around by r-tuned_bin
+	//on AM, we demodulate at the IF, only the digital tuning offset is taken out
 	int shift = r->tuned_bin;
 	if (r->mode == MODE_AM)
-		shift = 0;
+		shift = r->tuned_bin - MAX_BINS/4;
 	for (i = 0; i < MAX_BINS; i++){
 		int b =  i + shift;
 		if (b >= MAX_BINS)
@@ -694,6 +820,17 @@ void rx_linear(int32_t *input_rx,  int32_t *input_mic,
 	//STEP 7: convert back to time domain	
 	my_fftw_execute(r->plan_rev);
 
+	//STEP 7B: mix out the part of the tuning offset that is less than a bin
+	//the oscillator runs continuously across the blocks to avoid clicks
+	if (fine_offset != 0 && r->mode != MODE_AM){
+		double complex fine_step = cexp(-I * 2 * M_PI * fine_offset / 96000.0);
+		for (i = MAX_BINS/2; i < MAX_BINS; i++){
+			r->fft_time[i] *= fine_osc;
+			fine_osc *= fine_step;
+		}
+		fine_osc /= cabs(fine_osc);
+	}
+
 	//STEP 8 : AGC
 	agc2(r);
 	
@@ -718,9 +855,8 @@ void rx_linear(int32_t *input_rx,  int32_t *input_mic,
 				output_tx[i] = 0;
 			}
 
-		//push the samples to the remote audio queue, decimated to 16000 samples/sec
-		for (i = 0; i < MAX_BINS/2; i += 6)
-			q_write(&qremote, output_speaker[i]);
+		//push the samples to the remote audio queue
+		remote_audio_input(output_speaker, MAX_BINS/2);
 
 	}
 
@@ -741,7 +877,7 @@ void read_power(){
 
 	if (!in_tx)
 		return;
-	if(i2cbb_read_i2c_block_data(0x8, 0, 4, response) == -1)
+	if(i2c_read_block(0x8, 4, response) == -1)
 		return;
 
 	vfwd = vref = 0;
@@ -773,13 +909,229 @@ void read_power(){
 
 static int tx_process_restart = 0;
 
+/*
+	The speech processor, for the ssb voice modes
+	The mic spectrum from the forward fft is compressed in a few bands.
+	Each band is pulled up towards the loudest band (tracked as sp_ref),
+	tx_compress sets how hard (0 is off, 100 is nearly flat).
+	After the inverse fft, the envelope of the ssb signal is clipped 
+	voice_clip_level below its slowly decaying peak and made up back to
+	the peak. Clipping the envelope instead of the audio keeps most of 
+	the distortion inside the channel, what splatters out is removed by 
+	a bandpass at the IF. The clipper runs whenever CLIP is above zero, 
+	the compressor whenever COMP is.
+	The post clip filter has to be sharp, the splatter lands just outside
+	the channel. It is a 1025 tap kaiser windowed fir (about 500 Hz 
+	transition, 80 db down), too long to run in the time domain on the 
+	pi, so it is convolved by overlap-save with its own fft pair.
+*/
+
+#define SP_BANDS 6
+#define SP_MAX_GAIN 4.0
+#define SP_BETA 8
+
+static int sp_band_hz[SP_BANDS + 1] = {300, 600, 1000, 1400, 1900, 2400, 3000};
+static double sp_env[SP_BANDS];
+static double sp_ref = 0;
+static double sp_peak = 0;
+static double sp_mag[MAX_BINS/2];
+static struct filter *sp_usb = NULL, *sp_lsb = NULL;
+static fftw_complex *sp_time, *sp_freq;
+static fftw_plan sp_plan_fwd, sp_plan_rev;
+
+//the filters for both sidebands are made once, at the IF
+static void sp_init(){
+	sp_usb = filter_new(MAX_BINS/2, MAX_BINS/2 + 1);
+	filter_tune(sp_usb, (24000.0 + 300)/96000.0, (24000.0 + 3000)/96000.0, SP_BETA);
+	sp_lsb = filter_new(MAX_BINS/2, MAX_BINS/2 + 1);
+	filter_tune(sp_lsb, (24000.0 - 3000)/96000.0, (24000.0 - 300)/96000.0, SP_BETA);
+
+	sp_time = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * MAX_BINS);
+	sp_freq = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * MAX_BINS);
+	sp_plan_fwd = fftw_plan_dft_1d(MAX_BINS, sp_time, sp_freq, FFTW_FORWARD, WISDOM_MODE);
+	sp_plan_rev = fftw_plan_dft_1d(MAX_BINS, sp_freq, sp_time, FFTW_BACKWARD, WISDOM_MODE);
+	memset(sp_time, 0, sizeof(fftw_complex) * MAX_BINS);
+}
+
+static void sp_reset(){
+	if (sp_time)
+		memset(sp_time, 0, sizeof(fftw_complex) * MAX_BINS);
+	memset(sp_env, 0, sizeof(sp_env));
+	sp_ref = 0;
+	sp_peak = 0;
+}
+
+static void tx_speech_compress(){
+	double gain[SP_BANDS], center[SP_BANDS];
+	double amount = tx_compress / 125.0;	// 0.8 at most
+	double loudest = 0;
+	int b, i;
+
+	for (b = 0; b < SP_BANDS; b++){
+		int from = sp_band_hz[b] / BIN_HZ;
+		int to = sp_band_hz[b + 1] / BIN_HZ;
+		double p = 0;
+		for (i = from; i < to; i++)
+			p += creal(fft_out[i]) * creal(fft_out[i]) + cimag(fft_out[i]) * cimag(fft_out[i]);
+		p /= (to - from);
+
+		//fast attack, slow release
+		if (p > sp_env[b])
+			sp_env[b] = (0.7 * sp_env[b]) + (0.3 * p);
+		else
+			sp_env[b] = (0.97 * sp_env[b]) + (0.03 * p);
+		if (sp_env[b] > loudest)
+			loudest = sp_env[b];
+		center[b] = (sp_band_hz[b] + sp_band_hz[b + 1]) / 2;
+	}
+
+	//the reference jumps up to the loudest band and decays over a few seconds
+	if (loudest > sp_ref)
+		sp_ref = loudest;
+	else
+		sp_ref *= 0.998;
+
+	//the envelopes are in power, the gains are in amplitude
+	for (b = 0; b < SP_BANDS; b++){
+		gain[b] = 1.0;
+		if (sp_env[b] > 0)
+			gain[b] = pow(sp_ref / sp_env[b], amount / 2);
+		if (gain[b] > SP_MAX_GAIN)
+			gain[b] = SP_MAX_GAIN;
+	}
+
+	//the gains are interpolated between the band centers, a stepped 
+	//gain would ring in time. the mic is real, so both halves get the same gain
+	b = 0;
+	for (i = 1; i < MAX_BINS/2; i++){
+		double hz = i * BIN_HZ;
+		double g;
+		while (b < SP_BANDS - 1 && hz > center[b + 1])
+			b++;
+		if (hz <= center[0])
+			g = gain[0];
+		else if (b == SP_BANDS - 1)
+			g = gain[SP_BANDS - 1];
+		else
+			g = gain[b] + ((gain[b + 1] - gain[b]) * (hz - center[b])) / (center[b + 1] - center[b]);
+		fft_out[i] *= g;
+		fft_out[MAX_BINS - i] *= g;
+	}
+}
+
+static void tx_speech_clip(struct rx *r){
+	double peak = 0;
+	int i;
+
+	for (i = 0; i < MAX_BINS/2; i++){
+		sp_mag[i] = cabs(r->fft_time[i + (MAX_BINS/2)]);
+		if (sp_mag[i] > peak)
+			peak = sp_mag[i];
+	}
+	if (peak > sp_peak)
+		sp_peak = peak;
+	else
+		sp_peak *= 0.999;
+
+	double level = sp_peak * (1.0 - voice_clip_level);
+	if (level <= 0)
+		return;
+	double makeup = 1.0 / (1.0 - voice_clip_level);
+	for (i = 0; i < MAX_BINS/2; i++){
+		if (sp_mag[i] > level)
+			r->fft_time[i + (MAX_BINS/2)] *= (level / sp_mag[i]);
+		r->fft_time[i + (MAX_BINS/2)] *= makeup;
+	}
+}
+
+/* overlap-save, the previous block and this one go through the fft.
+	The ssb at the IF is complex and the bandpass is one sided, so the
+	complex samples are filtered and the real part taken on the way out */
+static void tx_post_clip_filter(struct rx *r, int32_t *output_tx, double scale){
+	struct filter *f = r->mode == MODE_LSB ? sp_lsb : sp_usb;
+	int i;
+
+	for (i = 0; i < MAX_BINS/2; i++){
+		sp_time[i] = sp_time[i + (MAX_BINS/2)];
+		sp_time[i + (MAX_BINS/2)] = r->fft_time[i + (MAX_BINS/2)];
+	}
+	fftw_execute(sp_plan_fwd);
+	for (i = 0; i < MAX_BINS; i++)
+		sp_freq[i] *= f->fir_coeff[i];
+	fftw_execute(sp_plan_rev);
+
+	//only the second half is free of the circular wrap
+	for (i = 0; i < MAX_BINS/2; i++)
+		output_tx[i] = creal(sp_time[i + (MAX_BINS/2)]) * scale;
+
+	//the input, not the filtered output, is the next block's overlap
+	for (i = 0; i < MAX_BINS/2; i++)
+		sp_time[i + (MAX_BINS/2)] = r->fft_time[i + (MAX_BINS/2)];
+}
+
+/* 
+	The transmit kernels
+	Each of these fills tx_block with one block of baseband samples for
+	a particular mode and writes the sidetone to the speaker. The mode is 
+	checked once per block in tx_process(), not for every sample.
+*/
+
+static double tx_block[MAX_BINS/2];
+
+static void tx_voice(int32_t *input_mic, int32_t *output_speaker, int n){
+	for (int i = 0; i < n; i++)
+		tx_block[i] = input_mic[i] / 2000000000.0;
+	//don't echo the voice modes
+	memset(output_speaker, 0, n * sizeof(int32_t));
+}
+
+//the digital modes from an external app echo the line input
+static void tx_digital(int32_t *input_mic, int32_t *output_speaker, int n){
+	for (int i = 0; i < n; i++){
+		tx_block[i] = input_mic[i] / 2000000000.0;
+		output_speaker[i] = input_mic[i]/1000 * sidetone;
+	}
+}
+
+static void tx_am(int32_t *input_mic, int32_t *output_speaker, int n){
+	for (int i = 0; i < n; i++){
+		double modulation = input_mic[i] / 200000000.0;
+		if (modulation < -1.0)
+			modulation = -1.0;
+		double i_carrier = vfo_read(&am_carrier) / 50000000000.0; 
+		tx_block[i] = (1.0 + modulation) * i_carrier;
+	}
+	memset(output_speaker, 0, n * sizeof(int32_t));
+}
+
+static void tx_two_tone(int32_t *output_speaker, int n){
+	for (int i = 0; i < n; i++)
+		tx_block[i] = (1.0 * (vfo_read(&tone_a) + vfo_read(&tone_b))) / 50000000000.0;
+	memset(output_speaker, 0, n * sizeof(int32_t));
+}
+
+//a single tone, for tuning and for the power calibration 
+static void tx_tone(double divisor, int32_t *output_speaker, int n){
+	for (int i = 0; i < n; i++)
+		tx_block[i] = vfo_read(&tone_a) / divisor;
+	memset(output_speaker, 0, n * sizeof(int32_t));
+}
+
+//cw and ft8 are generated by the modems
+static void tx_modem(int mode, int32_t *output_speaker, int n){
+	for (int i = 0; i < n; i++){
+		double i_sample = modem_next_sample(mode) / 3;
+		tx_block[i] = i_sample;
+		output_speaker[i] = (int)(i_sample * 20000000.0) * sidetone;
+	}
+}
+
 void tx_process(
 	int32_t *input_rx, int32_t *input_mic, 
 	int32_t *output_speaker, int32_t *output_tx, 
 	int n_samples)
 {
 	int i;
-	double i_sample, q_sample, i_carrier;
 	
   //uncomment this to test a simple audio loop of mic to speaker
 	//memcpy(output_speaker, input_mic, sizeof(int32_t) * n_samples);
@@ -793,6 +1145,7 @@ void tx_process(
 	//fix the burst at the start of transmission
 	if (tx_process_restart){
     fft_reset_m_bins();
+		sp_reset();
 		tx_process_restart = 0;
 	} 
 
@@ -801,71 +1154,47 @@ void tx_process(
 		memset(input_mic, 0, n_samples * sizeof(int32_t));
 		mute_count--;
 	}
-	//first add the previous M samples
-	for (i = 0; i < MAX_BINS/2; i++)
-		fft_in[i]  = fft_m[i];
-
-	int m = 0;
-	int j = 0;
-
-	//double max = -10.0, min = 10.0;
-	//gather the samples into a time domain array 
-	for (i= MAX_BINS/2; i < MAX_BINS; i++){
-		if (r->mode == MODE_2TONE)
-			i_sample = (1.0 * (vfo_read(&tone_a) 
-										+ vfo_read(&tone_b) )) / 50000000000.0;
-		else if (r->mode == MODE_TUNE)
-			i_sample = (1.0 * vfo_read(&tone_a)) / 50000000000.0;
-		else if (r->mode == MODE_CALIBRATE)
-			i_sample = (1.0 * (vfo_read(&tone_a))) / 30000000000.0;
-		else if (r->mode == MODE_CW || r->mode == MODE_CWR || r->mode == MODE_FT8)
-			i_sample = modem_next_sample(r->mode) / 3;
-		else if (r->mode == MODE_AM){
-	  	double modulation = (1.0 * input_mic[j]) / 200000000.0;
-			if (modulation < -1.0)
-				modulation = -1.0;
-			i_carrier= (1.0  * vfo_read(&am_carrier))/ 50000000000.0 ; 
-	  		i_sample =  (1.0 + modulation) * i_carrier;
-		}
-		else 
-	  		i_sample = (1.0 * input_mic[j]) /2000000000.0;
-	
-		//don't echo the voice modes
-		switch(r->mode){
-			case MODE_USB:
-			case MODE_LSB:
-			case MODE_AM:
-			case MODE_NBFM:
-				output_speaker[j] = 0;
-				break;
-			case MODE_CW:
-			case MODE_CWR:
-			case MODE_FT8:
-				output_speaker[j] = (int)(i_sample * 20000000.0) * sidetone;
-				break;
-			case MODE_DIGITAL:
-				output_speaker[j] = input_mic[j]/1000 * sidetone;
-				break;
-		}
-		
-  	q_sample = 0;
-
-	  	j++;
 
-	  	__real__ fft_m[m] = i_sample;
-	  	__imag__ fft_m[m] = q_sample;
+	//generate a block of samples for the mode 
+	switch(r->mode){
+		case MODE_2TONE:
+			tx_two_tone(output_speaker, MAX_BINS/2);
+			break;
+		case MODE_TUNE:
+			tx_tone(50000000000.0, output_speaker, MAX_BINS/2);
+			break;
+		case MODE_CALIBRATE:
+			tx_tone(30000000000.0, output_speaker, MAX_BINS/2);
+			break;
+		case MODE_CW:
+		case MODE_CWR:
+		case MODE_FT8:
+			tx_modem(r->mode, output_speaker, MAX_BINS/2);
+			break;
+		case MODE_AM:
+			tx_am(input_mic, output_speaker, MAX_BINS/2);
+			break;
+		case MODE_DIGITAL:
+			tx_digital(input_mic, output_speaker, MAX_BINS/2);
+			break;
+		default:
+			tx_voice(input_mic, output_speaker, MAX_BINS/2);
+			break;
+	}
 
-	  	__real__ fft_in[i]  = i_sample;
-	  	__imag__ fft_in[i]  = q_sample;
-	  	m++;
+	//the previous M samples followed by the new block, 
+	//the new block is also saved as the next M samples
+	for (i = 0; i < MAX_BINS/2; i++){
+		fft_in[i] = fft_m[i];
+		fft_m[i] = tx_block[i];
+		fft_in[i + MAX_BINS/2] = tx_block[i];
 	}
 
 	//if (pf_debug)
 	//	fwrite(output_speaker, sizeof(int32_t), MAX_BINS/2, pf_debug); 	
 
-	//push the samples to the remote audio queue, decimated to 16000 samples/sec
-	for (i = 0; i < MAX_BINS/2; i += 6)
-		q_write(&qremote, output_speaker[i]);
+	//push the samples to the remote audio queue
+	remote_audio_input(output_speaker, MAX_BINS/2);
 
 	//convert to frequency
 	fftw_execute(plan_fwd);
@@ -874,58 +1203,44 @@ void tx_process(
 	// incoming mic samples 
 	// the naming is unfortunate
 
-	// apply the filter
-	for (i = 0; i < MAX_BINS; i++)
-		fft_out[i] *= tx_filter->fir_coeff[i];
+	int ssb = r->mode == MODE_USB || r->mode == MODE_LSB;
+	int speech_clip = ssb && voice_clip_level > 0;
+	if (ssb && tx_compress > 0)
+		tx_speech_compress();
 
 	// the usb extends from 0 to MAX_BINS/2 - 1, 
 	// the lsb extends from MAX_BINS - 1 to MAX_BINS/2 (reverse direction)
-	// zero out the other sideband
+	// only the wanted sideband is filtered and rotated to the tx_bin,
+	// the rest of the bins are zeroed out
 
 	// TBD: Something strange is going on, this should have been the otherway
 
-	if (r->mode == MODE_LSB || r->mode == MODE_CWR)
-		// zero out the LSB
-		for (i = 0; i < MAX_BINS/2; i++){
-			__real__ fft_out[i] = 0;
-			__imag__ fft_out[i] = 0;	
-		}
-	else if (r->mode != MODE_AM)
-		// zero out the USB
-		for (i = MAX_BINS/2; i < MAX_BINS; i++){
-			__real__ fft_out[i] = 0;
-			__imag__ fft_out[i] = 0;	
-		}
-
-	//now rotate to the tx_bin 
 	//rememeber the AM is already a carrier modulated at 24 KHz
 	int shift = tx_shift;
-	if (r->mode == MODE_AM)
+	int from = 0, to = MAX_BINS/2;
+	if (r->mode == MODE_LSB || r->mode == MODE_CWR){
+		from = MAX_BINS/2;
+		to = MAX_BINS;
+	}
+	else if (r->mode == MODE_AM){
 		shift = 0;
-	for (i = 0; i < MAX_BINS; i++){
-		int b = i + shift;
-		if (b >= MAX_BINS)
-			b = b - MAX_BINS;
-		if (b < 0)
-			b = b + MAX_BINS;
-		r->fft_freq[b] = fft_out[i];
+		to = MAX_BINS;
 	}
 
+	memset(r->fft_freq, 0, sizeof(fftw_complex) * MAX_BINS);
+	for (i = from; i < to; i++)
+		r->fft_freq[(i + shift) & (MAX_BINS - 1)] = fft_out[i] * tx_filter->fir_coeff[i];
 
 	//convert back to time domain	
 	fftw_execute(r->plan_rev);
-	int min = 10000000;
-	int max = -10000000;
-	float scale = volume;
-	for (i= 0; i < MAX_BINS/2; i++){
-		double s = creal(r->fft_time[i+(MAX_BINS/2)]);
-		output_tx[i] = s * scale * tx_amp * alc_level;
-/*		if (min > output_tx[i])
-			min = output_tx[i];
-		if (max < output_tx[i])
-			max = output_tx[i];	*/
-			//output_tx[i] = 0;
+	double scale = volume * tx_amp * alc_level;
+	if (speech_clip){
+		tx_speech_clip(r);
+		tx_post_clip_filter(r, output_tx, scale);
 	}
+	else
+		for (i= 0; i < MAX_BINS/2; i++)
+			output_tx[i] = creal(r->fft_time[i+(MAX_BINS/2)]) * scale;
 
 	if (sbitx_version < 4)
 		read_power();
@@ -1032,6 +1347,10 @@ static int hw_settings_handler(void* user, const char* section,
 		si570_xtal = atoi(value);
 	if (!strcmp(name, "hw"))
 		sbitx_version = atoi(value);
+	if (!strcmp(name, "i2c")){
+		strncpy(i2c_bus, value, sizeof(i2c_bus)-1);
+		i2c_bus[sizeof(i2c_bus)-1] = 0;
+	}
 }
 
 static void read_hw_ini(){
@@ -1128,7 +1447,8 @@ static void save_hw_settings(){
 		return;
 	}
 
-	fprintf(f, "bfo_freq=%d\n\n", bfo_freq);
+	fprintf(f, "bfo_freq=%d\n", bfo_freq);
+	fprintf(f, "i2c=%s\n\n", i2c_bus);
 	//now save the band stack
 	for (int i = 0; i < sizeof(band_power)/sizeof(struct power_settings); i++){
 		fprintf(f, "[tx_band]\nf_start=%d\nf_stop=%d\nscale=%g\n\n", 
@@ -1349,6 +1669,10 @@ void tr_switch_v4(int tx_on){
 }
 
 void tr_switch(int tx_on){
+	//the transmitter has no digital tuning, bring the lo to the dial
+	if (tx_on && lo_freq != freq_hdr)
+		radio_tune_to(freq_hdr);
+
 	switch(sbitx_version){
 		case SBITX_DE:
 			tr_switch_de(tx_on);
@@ -1369,6 +1693,7 @@ void setup(char *audio_output_device){
 	printf("Audio Output Device is: %s\n", audio_output_device);
 
 	read_hw_ini();
+	i2c_init(i2c_bus);
 
 	//setup the LPF and the gpio pins
 	pinMode(TX_LINE, OUTPUT);
@@ -1401,7 +1726,7 @@ void setup(char *audio_output_device){
 	//detect the version of sbitx if not read from hw_settings
 	if (sbitx_version == -1){
 		uint8_t response[4];
-		if(i2cbb_read_i2c_block_data(0x8, 0, 4, response) == -1)
+		if(i2c_read_block(0x8, 4, response) == -1)
 			sbitx_version = SBITX_DE;
 		else
 			sbitx_version = SBITX_V2;
@@ -1511,12 +1836,13 @@ void sdr_request(char *request, char *response){
 				5);
 		}
 	
-		//we need to nudge the oscillator to adjust 
+		//we need to reprogram the oscillator to adjust 
 		//to cw offset. setting it to the already tuned freq
-		//doesnt recalculte the offsets
+		//doesnt recalculte the offsets, neither does a digital retune
 
 		int f = freq_hdr;
-		set_rx1(f-10);
+		freq_hdr = -1;
+		radio_tune_to(f);
 		set_rx1(f);
 	
 		//printf("mode set to %d\n", rx_list->mode);
@@ -1607,6 +1933,105 @@ void sdr_request(char *request, char *response){
 		tx_cal();
 	else if (!strcmp(cmd, "tx_compress"))
 		tx_compress = atoi(value); 
+	else if (!strcmp(cmd, "tx_clip")){ //between 0 and 90
+		int clip = atoi(value);
+		if (0 <= clip && clip <= 90)
+			voice_clip_level = clip / 100.0;
+	}
   /* else
 		printf("*Error request[%s] not accepted\n", request); */
 }
+
+/* tx benchmark, it times tx_process() over each of the transmit kernels.
+to run it, uncomment this, comment out the main() of sbitx_gtk.c
+and build as usual
+void main(int argc, char **argv){
+	int32_t input_rx[MAX_BINS/2], input_mic[MAX_BINS/2], 
+		output_speaker[MAX_BINS/2], output_tx[MAX_BINS/2];
+	int modes[] = {MODE_USB, MODE_LSB, MODE_AM, MODE_2TONE, MODE_TUNE, MODE_CW, MODE_DIGITAL};
+	char *mode_names[] = {"USB", "LSB", "AM", "2TONE", "TUNE", "CW", "DIGI"};
+	struct timespec start, stop;
+
+	fft_init();
+	vfo_init_phase_table();
+	vfo_start(&tone_a, 700, 0);
+	vfo_start(&tone_b, 1900, 0);
+	vfo_start(&am_carrier, 24000, 0);
+	add_tx(7000000, MODE_USB, -3000, -300);
+	tx_init(7000000, MODE_USB, -3000, 3000);
+	q_init(&qremote, 8000);
+	tx_amp = 1.0;
+
+	for (int i = 0; i < MAX_BINS/2; i++)
+		input_mic[i] = sin(i * 2 * M_PI * 1000/96000.0) * 200000000;
+
+	for (int m = 0; m < sizeof(modes)/sizeof(int); m++){
+		tx_list->mode = modes[m];
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < 2000; i++){
+			tx_process(input_rx, input_mic, output_speaker, output_tx, MAX_BINS/2);
+			q_empty(&qremote);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		double usecs = (stop.tv_sec - start.tv_sec) * 1000000.0 
+			+ (stop.tv_nsec - start.tv_nsec)/1000.0;
+		printf("%s: %.1f usec per block\n", mode_names[m], usecs/2000);
+	}
+}
+*/
+
+/* speech processor test, it measures the peak to average power ratio 
+of the transmit output with the processor off and on. The voice is a 
+buzz of harmonics of 140 Hz, shaped like a vowel and chopped into syllables.
+to run it, uncomment this, comment out the main() of sbitx_gtk.c
+and build as usual
+void papr_add(int32_t *samples, int n, double *peak, double *power){
+	for (int i = 0; i < n; i++){
+		double s = samples[i];
+		if (s * s > *peak)
+			*peak = s * s;
+		*power += s * s;
+	}
+}
+
+void main(int argc, char **argv){
+	int32_t input_rx[MAX_BINS/2], input_mic[MAX_BINS/2], 
+		output_speaker[MAX_BINS/2], output_tx[MAX_BINS/2];
+	int settings[] = {0, 30, 60, 90};
+	double clips[] = {0.1, 0.3, 0.5};
+	long t;
+
+	fft_init();
+	add_tx(7000000, MODE_USB, 300, 3000);
+	tx_init(7000000, MODE_USB, 300, 3000);
+	filter_tune(tx_filter, 300/96000.0, 3000/96000.0, 5);
+	q_init(&qremote, 8000);
+	tx_amp = 1.0;
+
+	for (int c = 0; c < sizeof(clips)/sizeof(double); c++)
+	for (int s = 0; s < sizeof(settings)/sizeof(int); s++){
+		double peak = 0, power = 0;
+		tx_compress = settings[s];
+		voice_clip_level = clips[c];
+		tx_process_restart = 1;
+		t = 0;
+		for (int block = 0; block < 400; block++){
+			for (int i = 0; i < MAX_BINS/2; i++, t++){
+				double syllable = fabs(sin(2 * M_PI * 3 * t / 96000.0));
+				double v = 0;
+				for (int h = 1; h < 20; h++)
+					v += sin(2 * M_PI * 140 * h * t / 96000.0 + h * h) 
+						* (h == 4 || h == 8 ? 1.0 : 0.3) / h;
+				input_mic[i] = v * syllable * 400000000;
+			}
+			tx_process(input_rx, input_mic, output_speaker, output_tx, MAX_BINS/2);
+			q_empty(&qremote);
+			if (block > 50)
+				papr_add(output_tx, MAX_BINS/2, &peak, &power);
+		}
+		power /= 349 * (MAX_BINS/2);
+		printf("tx_compress %d, clip %g: papr %.1f db, average power %.1f db\n", 
+			settings[s], voice_clip_level, 10 * log10(peak/power), 10 * log10(power));
+	}
+}
+*/
@@ -19,6 +19,7 @@ The initial sync between the gui values, the core radio values, settings, et al
 #include <sys/ioctl.h>
 #include <ncurses.h>
 #include <time.h>
+#include <pthread.h>
 #include <glib.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
@@ -40,13 +41,16 @@ The initial sync between the gui values, the core radio values, settings, et al
 #include "ini.h"
 #include "hamlib.h"
 #include "remote.h"
+#include "netio.h"
 #include "modem_ft8.h"
-#include "i2cbb.h"
+#include "i2c.h"
 #include "webserver.h"
 #include "logbook.h"
 #include "oled.h"
 #include "hist_disp.h"
 #include "ntputil.h"
+#include "spots.h"
+#include "wsjtx.h"
 
 #define FT8_START_QSO 1
 #define FT8_CONTINUE_QSO 0
@@ -221,6 +225,7 @@ void zbitx_poll(int all);
 void zbitx_pipe(int style, char *text);
 void zbitx_get_spectrum(char *buff);
 void zbitx_write(int style, char *text);
+void zbitx_link_status(char *buff);
 
 // event ids, some of them are mapped from gtk itself
 #define FIELD_DRAW 0
@@ -375,9 +380,13 @@ struct field {
   int step;
 	int 	section;
 	char is_dirty;
-	char update_remote;
+	unsigned int update_remote;	//remote_version when it last changed
 	unsigned int updated_at;
 	void *data;
+	char watched;								//has change callbacks, see field_watch()
+	char int_cached;						//value_int is valid at int_version
+	int value_int;
+	unsigned int int_version;
 };
 
 #define STACK_DEPTH 4
@@ -490,6 +499,43 @@ int do_bandwidth(struct field *f, cairo_t *gfx, int event, int a, int b, int c);
 int do_tune_tx(struct field *f, cairo_t *gfx, int event, int a, int b, int c);
 
 struct field *active_layout = NULL;
+
+/* The field change journal. Every change of a field is stamped with the
+next remote_version and logged in a ring. Each remote consumer (the web 
+sessions, the zbitx front panel) keeps the version it has seen upto and
+walks only the changes after it. A consumer that falls more than 
+FIELD_JOURNAL changes behind has to do a full scan instead */
+#define FIELD_JOURNAL 256
+static struct field *field_journal[FIELD_JOURNAL];
+static unsigned int remote_version = 0;
+
+static void field_notify(struct field *f);
+
+static void field_changed(struct field *f){
+	unsigned int v = remote_version + 1;
+	field_journal[v % FIELD_JOURNAL] = f;
+	f->update_remote = v;
+	remote_version = v;
+	if (f->watched)
+		field_notify(f);
+}
+
+static int field_journal_lost(unsigned int cursor){
+	return remote_version - cursor >= FIELD_JOURNAL;
+}
+
+//returns the next field that changed after the cursor (upto the version
+//'upto') and moves the cursor past it, a field that changed again
+//later is only returned for its latest change
+static struct field *field_journal_next(unsigned int *cursor, unsigned int upto){
+	while ((int)(upto - *cursor) > 0){
+		unsigned int v = ++*cursor;
+		struct field *f = field_journal[v % FIELD_JOURNAL];
+		if (f && f->update_remote == v)
+			return f;
+	}
+	return NULL;
+}
 char settings_updated = 0;
 #define LAYOUT_KBD 0
 #define LAYOUT_MACROS 1
@@ -590,6 +636,8 @@ struct field main_controls[] = {
 
 	{ "tx_compress", NULL, 600, -350, 50, 50, "COMP", 40, "0", FIELD_NUMBER, FONT_FIELD_VALUE, 
 		"ON/OFF", 0,100,10, VOICE_CONTROL},
+	{ "tx_clip", NULL, 600, -350, 50, 50, "CLIP", 40, "0", FIELD_NUMBER, FONT_FIELD_VALUE, 
+		"", 0,90,5, VOICE_CONTROL},
 	{ "#tx_wpm", NULL, 650, -350, 50, 50, "WPM", 40, "12", FIELD_NUMBER, FONT_FIELD_VALUE, 
 		"", 1, 50, 1, CW_CONTROL},
 	{ "rx_pitch", do_pitch, 700, -350, 50, 50, "PITCH", 40, "600", FIELD_NUMBER, FONT_FIELD_VALUE, 
@@ -641,6 +689,8 @@ struct field main_controls[] = {
 		"", 4,6,1,0},
 	{"#passkey", NULL, 1000, -1000, 400, 149, "PASSKEY", 70, "123", FIELD_TEXT, FONT_SMALL, 
 		"", 0,32,1,0},
+	{"#wsjtx_udp", NULL, 1000, -1000, 400, 149, "WSJTX_UDP", 70, "127.0.0.1:2237", FIELD_TEXT, FONT_SMALL, 
+		"", 0,64,1,0},
 
 	//moving global variables into fields 	
   { "#vfo_a_freq", NULL, 1000, -1000, 50, 50, "VFOA", 40, "14000000", FIELD_NUMBER, FONT_FIELD_VALUE,
@@ -796,6 +846,8 @@ struct field main_controls[] = {
 
 
 struct field *get_field(const char *cmd);
+struct field *get_field_by_label(const char *label);
+static int field_value_int(struct field *f);
 void update_field(struct field *f);
 void tx_on();
 void tx_off();
@@ -804,13 +856,156 @@ void tx_off();
 //char *console_lines[MAX_CONSOLE_LINES];
 int last_log = 0;
 
+/* The field registry. The fields are looked up by cmd and label many 
+times on each tick, so they are hashed into two open addressed tables, 
+built once for each layout. The labels are matched without case, as 
+always. Where two fields share a name, the first one wins, as it did with
+the linear search */
+
+#define FIELD_HASH 1024		// a power of 2, at least twice the fields 
+static struct field *fields_by_cmd[FIELD_HASH];
+static struct field *fields_by_label[FIELD_HASH];
+static struct field *registry_layout = NULL;
+
+static unsigned int field_hash(const char *key, int fold){
+	unsigned int h = 2166136261u;	// FNV-1a
+	while (*key){
+		h ^= fold ? tolower(*key) : *key;
+		h *= 16777619u;
+		key++;
+	}
+	return h;
+}
+
+static void field_register(struct field **table, struct field *f, const char *key, int fold){
+	unsigned int h = field_hash(key, fold);
+	while (table[h & (FIELD_HASH - 1)]){
+		struct field *g = table[h & (FIELD_HASH - 1)];
+		if (fold ? !strcasecmp(g->label, key) : !strcmp(g->cmd, key))
+			return;
+		h++;
+	}
+	table[h & (FIELD_HASH - 1)] = f;
+}
+
+static void field_registry_build(){
+	int count = 0;
+
+	memset(fields_by_cmd, 0, sizeof(fields_by_cmd));
+	memset(fields_by_label, 0, sizeof(fields_by_label));
+	for (struct field *f = active_layout; f->cmd[0] > 0; f++){
+		if (++count > FIELD_HASH/2){
+			printf("*Error: too many fields for the registry, raise FIELD_HASH\n");
+			break;
+		}
+		field_register(fields_by_cmd, f, f->cmd, 0);
+		field_register(fields_by_label, f, f->label, 1);
+	}
+	registry_layout = active_layout;
+}
+
+static struct field *field_lookup(struct field **table, const char *key, int fold){
+	if (registry_layout != active_layout)
+		field_registry_build();
+
+	unsigned int h = field_hash(key, fold);
+	struct field *f;
+	while ((f = table[h & (FIELD_HASH - 1)])){
+		if (fold ? !strcasecmp(f->label, key) : !strcmp(f->cmd, key))
+			return f;
+		h++;
+	}
+	return NULL;
+}
+
 struct field *get_field(const char *cmd){
+	return field_lookup(fields_by_cmd, cmd, 0);
+}
+
+/* field lookup benchmark, it times the lookups that ui_tick() and cw_poll() 
+make on every tick, through the registry and through the linear search 
+that it replaced. To run it, uncomment this and call it from main() 
+right after active_layout is set
+
+static struct field *get_field_linear(const char *cmd){
 	for (int i = 0; active_layout[i].cmd[0] > 0; i++)
 		if (!strcmp(active_layout[i].cmd, cmd))
 			return active_layout + i;
 	return NULL;
 }
 
+static struct field *get_field_by_label_linear(const char *label){
+	for (int i = 0; active_layout[i].cmd[0] > 0; i++)
+		if (!strcasecmp(active_layout[i].label, label))
+			return active_layout + i;
+	return NULL;
+}
+
+void field_benchmark(){
+	struct timespec start, stop;
+	int sum = 0;
+
+	for (int pass = 0; pass < 2; pass++){
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < 100000; i++){
+			if (pass == 0){
+				sum += get_field_linear("r1:freq")->x;
+				sum += atoi(get_field_linear("r1:low")->value);
+				sum += atoi(get_field_linear("r1:high")->value);
+				sum += get_field_linear("spectrum")->x + get_field_linear("waterfall")->x;
+				sum += atoi(get_field_by_label_linear("WPM")->value);
+				sum += atoi(get_field_by_label_linear("PITCH")->value);
+				sum += get_field_by_label_linear("MODE")->x;
+			}
+			else {
+				sum += get_field("r1:freq")->x;
+				sum += field_value_int(get_field("r1:low"));
+				sum += field_value_int(get_field("r1:high"));
+				sum += get_field("spectrum")->x + get_field("waterfall")->x;
+				sum += field_int("WPM");
+				sum += field_int("PITCH");
+				sum += get_field_by_label("MODE")->x;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		double nsecs = (stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec);
+		printf("%s: %.0f nsec per tick\n", pass ? "registry" : "linear", nsecs/100000);
+	}
+	printf("(%d)\n", sum);
+}
+*/
+
+/* Change callbacks, the modules that follow a field register here
+instead of polling it. The callback is made at once with the present value
+and then after each change, on the thread that changed the field */
+
+#define FIELD_WATCHERS 16
+static struct {
+	struct field *f;
+	void (*fn)(const char *label, int value);
+} field_watchers[FIELD_WATCHERS];
+static int field_watcher_count = 0;
+
+int field_watch(const char *label, void (*fn)(const char *label, int value)){
+	struct field *f = get_field_by_label(label);
+	if (!f || field_watcher_count == FIELD_WATCHERS){
+		printf("*Error: can't watch field [%s]\n", label);
+		return -1;
+	}
+	field_watchers[field_watcher_count].f = f;
+	field_watchers[field_watcher_count].fn = fn;
+	field_watcher_count++;
+	f->watched = 1;
+	fn(f->label, field_value_int(f));
+	return 0;
+}
+
+static void field_notify(struct field *f){
+	for (int i = 0; i < field_watcher_count; i++)
+		if (field_watchers[i].f == f)
+			field_watchers[i].fn(f->label, field_value_int(f));
+}
+
 void field_init(){
 	for (int i = 0; active_layout[i].cmd[i] > 0; i++)
 		active_layout[i].updated_at= 0;
@@ -894,10 +1089,7 @@ int set_field(const char *id, const char *value){
 }
 
 struct field *get_field_by_label(const char *label){
-	for (int i = 0; active_layout[i].cmd[0] > 0; i++)
-		if (!strcasecmp(active_layout[i].label, label))
-			return active_layout + i;
-	return NULL;
+	return field_lookup(fields_by_label, label, 1);
 }
 
 const char *field_str(char *label){
@@ -908,10 +1100,20 @@ const char *field_str(char *label){
 		return NULL; 
 }
 
+//the number is parsed again only after the field changes
+static int field_value_int(struct field *f){
+	if (!f->int_cached || f->int_version != f->update_remote){
+		f->value_int = atoi(f->value);
+		f->int_version = f->update_remote;
+		f->int_cached = 1;
+	}
+	return f->value_int;
+}
+
 int field_int(char *label){
 	struct field *f = get_field_by_label(label);
 	if (f){
-		return atoi(f->value);
+		return field_value_int(f);
 	}
 	else {
 		printf("field_int: %s not found\n", label);
@@ -944,8 +1146,40 @@ int get_field_value_by_label(char *label, char *value){
 }
 
 
+unsigned int remote_field_version(){
+	return remote_version;
+}
+
+int remote_updates_lost(unsigned int cursor){
+	return field_journal_lost(cursor);
+}
+
+/* batches the fields changed after the cursor as "UPDATES " followed by
+"label value" records separated by RS (0x1e). It stops short of max
+and leaves the cursor at the last change it took, so it is called until
+it returns 0 */
+int remote_updates(unsigned int *cursor, char *buff, int max){
+	unsigned int upto = remote_version;
+	struct field *f;
+	int n = 0, count = 0;
+
+	strcpy(buff, "UPDATES");
+	n = strlen(buff);
+	while ((f = field_journal_next(cursor, upto))){
+		int l = strlen(f->label) + strlen(f->value) + 2;
+		if (n + l >= max){
+			(*cursor)--;
+			break;
+		}
+		n += sprintf(buff + n, "%c%s %s", count ? 0x1e : ' ', f->label, f->value);
+		count++;
+	}
+	return count ? n : 0;
+}
+
 //prepares to send the latest value of a field to the remote head
-int remote_update_field(int i, char *text){
+//returns 1 if the field changed after the version 'since'
+int remote_update_field(int i, char *text, unsigned int since){
 	struct field * f = active_layout + i;
 
 	if (f->cmd[0] == 0)
@@ -964,8 +1198,7 @@ int remote_update_field(int i, char *text){
 	strcpy(text, f->label);
 	strcat(text, " ");
 	strcat(text, f->value);
-	int update = f->update_remote;
-	f->update_remote = 0;
+	int update = f->update_remote > since;
 
 	//debug on
 //	if (!strcmp(f->cmd, "#text_in") && strlen(f->value))
@@ -1487,12 +1720,18 @@ void enter_qso(){
 		printf("Duplicate log entry not accepted for %s within two minutes of last entry of %s.\n", callsign, callsign);
 		return;
 	}	
-	logbook_add(get_field("#contact_callsign")->value, 
+	char buff[100];
+	if (logbook_add(get_field("#contact_callsign")->value, 
 		get_field("#rst_sent")->value, 
 		get_field("#exchange_sent")->value, 
 		get_field("#rst_received")->value, 
-		get_field("#exchange_received")->value);
-	char buff[100];
+		get_field("#exchange_received")->value)){
+		sprintf(buff, "*Not logged: %s, the log could not be written\n", 
+			field_str("CALL"));
+		write_console(FONT_LOG, buff);
+		return;
+	}
+	wsjtx_logged();
 	sprintf(buff, "Logged: %s %s-%s %s-%s\n", 
 		field_str("CALL"), field_str("SENT"), field_str("NR"), 
 		field_str("RECV"), field_str("EXCH"));
@@ -1815,6 +2054,28 @@ void draw_tx_meters(struct field *f, cairo_t *gfx){
 	draw_text(gfx, f->x + 200 , f->y + 5 , meter_str, FONT_FIELD_LABEL);
 }
 
+//the calls decoded in the last two ft8 slots, over their traces
+static void draw_waterfall_spots(struct field *f, cairo_t *gfx){
+	struct spot list[60];
+	const char *mode = get_field("r1:mode")->value;
+
+	if (strcmp(mode, "FT8") && strcmp(mode, "FT4"))
+		return;
+	//the upper half of the display is the audio from 0 to span/2
+	int span_hz = atof(get_field("#span")->value) * 500;
+	int n = spot_near(span_hz/2, span_hz/2, list, 60);
+	int line = font_table[FONT_SMALL].height;
+	time_t now = time_sbitx();
+	for (int i = 0; i < n; i++){
+		if (now - list[i].when > 30)
+			continue;
+		int x = f->x + f->width/2 + (list[i].freq_hz * (f->width/2))/span_hz;
+		if (x + measure_text(gfx, list[i].call, FONT_SMALL) > f->x + f->width)
+			continue;
+		draw_text(gfx, x, f->y + (i % 3) * line, list[i].call, FONT_SMALL);
+	}
+}
+
 void draw_waterfall(struct field *f, cairo_t *gfx){
 
 	if (in_tx){
@@ -1860,6 +2121,7 @@ void draw_waterfall(struct field *f, cairo_t *gfx){
 	gdk_cairo_set_source_pixbuf(gfx, waterfall_pixbuf, f->x, f->y);		
 	cairo_paint(gfx);
 	cairo_fill(gfx);
+	draw_waterfall_spots(f, gfx);
 }
 
 void draw_smeter(struct field *f_spectrum, cairo_t *gfx){
@@ -2064,8 +2326,9 @@ void draw_spectrum(struct field *f_spectrum, cairo_t *gfx){
 
 	int n_bins = (int)((1.0 * spectrum_span) / 46.875);
 	//the center frequency is at the center of the lower sideband,
-	//i.e, three-fourth way up the bins.
-	int starting_bin = (3 *MAX_BINS)/4 - n_bins/2;
+	//i.e, three-fourth way up the bins, moved by any digital tuning.
+	//the lower sideband mirrors the tuned_bin at MAX_BINS - tuned_bin 
+	int starting_bin = (MAX_BINS - rx_list->tuned_bin) - n_bins/2;
 	int ending_bin = starting_bin + n_bins; 
 
 	float x_step = (1.0 * f->width )/n_bins;
@@ -2126,7 +2389,9 @@ void draw_spectrum(struct field *f_spectrum, cairo_t *gfx){
   }
 	//draw the needle
 	for (struct rx *r = rx_list; r; r = r->next){
-		int needle_x  = (f->width*(MAX_BINS/2 - r->tuned_bin))/(MAX_BINS/2);
+		//the display is centered on the first receiver's tuned_bin
+		int needle_x  = (f->width*(MAX_BINS/2 - MAX_BINS/4 
+			- (r->tuned_bin - rx_list->tuned_bin)))/(MAX_BINS/2);
 		fill_rect(gfx, f->x + needle_x, f->y, 1, grid_height,  SPECTRUM_NEEDLE);
 	}
 
@@ -2191,10 +2456,11 @@ void draw_dial(struct field *f, cairo_t *gfx){
 	fill_rect(gfx, f->x, f->y, f->width,f->height, COLOR_BACKGROUND);
 
 	//update the vfos
-	if (vfo->value[0] == 'A')
-			strcpy(vfo_a->value, f->value);
-	else
-			strcpy(vfo_b->value, f->value);
+	struct field *vfo_now = vfo->value[0] == 'A' ? vfo_a : vfo_b;
+	if (strcmp(vfo_now->value, f->value)){
+		strcpy(vfo_now->value, f->value);
+		field_changed(vfo_now);
+	}
 
   if (!strcmp(rit->value, "ON")){
     if (!in_tx){
@@ -2407,6 +2673,8 @@ static void layout_ui(){
 			field_move("HIGH", 160, y1, 95, 45);
 			field_move("TX", 260, y1, 95, 45);
 			field_move("RX", 360, y1, 95, 45);
+			field_move("COMP", 460, y1, 45, 45);
+			field_move("CLIP", 510, y1, 45, 45);
 		break;
 		default:
 			field_move("CONSOLE", 5, y1, 350, y2-y1-110);
@@ -2500,7 +2768,7 @@ static gboolean on_resize(GtkWidget *widget, GdkEventConfigure *event, gpointer
 void update_field(struct field *f){
 	if (f->y >= 0)
 		f->is_dirty = 1;
-	f->update_remote = 1;
+	field_changed(f);
 	f->updated_at = millis();
 } 
 
@@ -2524,9 +2792,11 @@ static void edit_field(struct field *f, int action){
 
 	if (f->fn){
 		f->is_dirty = 1;
-	 	f->update_remote = 1;
 		f->updated_at = millis();
-		if (f->fn(f, NULL, FIELD_EDIT, action, 0, 0))
+		int handled = f->fn(f, NULL, FIELD_EDIT, action, 0, 0);
+		//stamp it after the edit, so the new value is what gets out
+	 	field_changed(f);
+		if (handled)
 			return;
 	}
 	
@@ -2607,7 +2877,7 @@ static void edit_field(struct field *f, int action){
 	sprintf(buff, "%s %s", f->label, f->value);
 	do_control_action(buff);
 	f->is_dirty = 1;
-	f->update_remote = 1;
+	field_changed(f);
 	f->updated_at = millis();
 //	update_field(f);
 	settings_updated++;
@@ -2752,12 +3022,45 @@ int do_waterfall(struct field *f, cairo_t *gfx, int event, int a, int b, int c){
 	return 0;	
 }
 
-void remote_execute(char *cmd){
-	if (q_remote_commands.overflow)
+/* the commands come in from the web, the zbitx panel and the netio
+threads and are carried out on the gtk thread in the ui_tick(). the lock
+keeps the commands from getting mixed up or being read half written.
+each command is queued after its source. remote_commands_pending[] 
+counts the commands of each source that are not carried out yet */
+static pthread_mutex_t remote_commands_lock = PTHREAD_MUTEX_INITIALIZER;
+static int remote_commands_pending[REMOTE_SOURCES];
+
+void remote_execute_from(int source, char *cmd){
+	pthread_mutex_lock(&remote_commands_lock);
+	if (q_remote_commands.overflow){
 		q_empty(&q_remote_commands);
+		memset(remote_commands_pending, 0, sizeof(remote_commands_pending));
+	}
+	q_write(&q_remote_commands, source);
 	while (*cmd)
 		q_write(&q_remote_commands, *cmd++);
 	q_write(&q_remote_commands, 0);
+	remote_commands_pending[source]++;
+	pthread_mutex_unlock(&remote_commands_lock);
+}
+
+void remote_execute(char *cmd){
+	remote_execute_from(REMOTE_OTHER, cmd);
+}
+
+//true until all the commands queued so far by the source have been carried out
+int remote_pending(int source){
+	pthread_mutex_lock(&remote_commands_lock);
+	int pending = remote_commands_pending[source] > 0;
+	pthread_mutex_unlock(&remote_commands_lock);
+	return pending;
+}
+
+static void remote_executed(int source){
+	pthread_mutex_lock(&remote_commands_lock);
+	if (remote_commands_pending[source] > 0)
+		remote_commands_pending[source]--;
+	pthread_mutex_unlock(&remote_commands_lock);
 }
 
 
@@ -2864,10 +3167,13 @@ int do_status(struct field *f, cairo_t *gfx, int event, int a, int b, int c){
 			tmp->tm_year + 1900, tmp->tm_mon + 1, tmp->tm_mday, tmp->tm_hour, tmp->tm_min, tmp->tm_sec); 
 		int width = measure_text(gfx, buff, FONT_FIELD_LABEL);
 		int line_height = font_table[f->font_index].height; 	
-		strcpy(f->value, buff);
+		//the status redraws often, log it only when the second ticks
+		if (strcmp(f->value, buff)){
+			strcpy(f->value, buff);
+			field_changed(f);
+			f->updated_at = millis();
+		}
 		f->is_dirty = 1;
-		f->update_remote = 1;
-		f->updated_at = millis();
 		sprintf(buff, "sBitx %s %s %04d/%02d/%02d %02d:%02d:%02dZ",  
 			get_field("#mycallsign")->value, get_field("#mygrid")->value,
 			tmp->tm_year + 1900, tmp->tm_mon + 1, tmp->tm_mday, tmp->tm_hour, tmp->tm_min, tmp->tm_sec); 
@@ -2917,7 +3223,7 @@ int do_text(struct field *f, cairo_t *gfx, int event, int a, int b, int c){
 			f->value[l] = 0;
 		}
 		f->is_dirty = 1;
-		f->update_remote = 1;
+		field_changed(f);
 		f->updated_at = millis();
 		f_last_text = f; 
 		return 1;
@@ -3811,7 +4117,7 @@ void query_swr(){
 
 	if (!in_tx)
 		return;
-	if(i2cbb_read_i2c_block_data(0x8, 0, 4, response) == -1)
+	if(i2c_read_block(0x8, 4, response) == -1)
 		return;
 
 	vfwd = vref = 0;
@@ -3926,8 +4232,8 @@ void web_get_spectrum(char *buff){
 
   int n_bins = (int)((1.0 * spectrum_span) / 46.875);
   //the center frequency is at the center of the lower sideband,
-  //i.e, three-fourth way up the bins.
-  int starting_bin = (3 *MAX_BINS)/4 - n_bins/2;
+  //i.e, three-fourth way up the bins, moved by any digital tuning.
+  int starting_bin = (MAX_BINS - rx_list->tuned_bin) - n_bins/2;
   int ending_bin = starting_bin + n_bins;
 
   int j = 3;
@@ -3960,6 +4266,119 @@ void web_get_spectrum(char *buff){
   return;
 }
 
+/* The binary spectrum frame, little endian :
+	0	WEB_FRAME_SPECTRUM
+	1	WEB_FRAME_VERSION
+	2	flags, bit 0 is set on transmit (the bins are the modulation display)
+	3	encoding, SPECTRUM_RAW or SPECTRUM_DELTA
+	4	16-bit number of bins
+	6	16-bit reserved
+	8	32-bit center frequency in Hz
+	12	32-bit span in Hz
+	16	32-bit timestamp in msec
+	20	bins, lowest frequency first, one byte per bin in dB above the floor
+
+	A delta frame codes each bin against the same bin of the previous frame
+	sent on that connection, as a string of bytes :
+	1rrrrrrr	r + 1 unchanged bins
+	01dddddd	one bin changed by d - 32 dB
+	00aaabbb	two bins changed by a - 4 and b - 4 dB
+	prev holds the previous frame's bins, prev_n is zero to force a raw frame.
+	Returns the length of the frame. */
+
+#define SPECTRUM_RAW 0
+#define SPECTRUM_DELTA 1
+#define SPECTRUM_HEADER 20
+
+static void frame_put16(uint8_t *p, int v){
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void frame_put32(uint8_t *p, uint32_t v){
+	frame_put16(p, v & 0xffff);
+	frame_put16(p + 2, v >> 16);
+}
+
+static int spectrum_delta(uint8_t *out, uint8_t *bins, uint8_t *prev, int n){
+	int j = 0;
+
+	for (int i = 0; i < n;){
+		int d = bins[i] - prev[i];
+		int d2 = i + 1 < n ? bins[i+1] - prev[i+1] : 99;
+		if (!d && !d2){
+			int run = 0;
+			while (i < n && run < 128 && bins[i] == prev[i]){
+				run++;
+				i++;
+			}
+			out[j++] = 0x80 | (run - 1);
+		}
+		else if (d >= -4 && d <= 3 && d2 >= -4 && d2 <= 3){
+			out[j++] = ((d + 4) << 3) | (d2 + 4);
+			i += 2;
+		}
+		else if (d >= -32 && d <= 31){
+			out[j++] = 0x40 | (d + 32);
+			i++;
+		}
+		else
+			return -1;
+		//not worth it
+		if (j >= n)
+			return -1;
+	}
+	return j;
+}
+
+int web_get_spectrum_frame(uint8_t *frame, uint8_t *prev, int *prev_n){
+	uint8_t bins[WEB_SPECTRUM_MAX];
+	int n = 0;
+	int span = 0;
+
+	if (in_tx){
+		for (int i = 0; i < MOD_MAX; i++){
+			int y = (2 * mod_display[i]) + 32;
+			bins[n++] = y < 0 ? 0 : (y > 255 ? 255 : y);
+		}
+	}
+	else {
+		int n_bins = (int)((1.0 * spectrum_span) / 46.875);
+		int starting_bin = (MAX_BINS - rx_list->tuned_bin) - n_bins/2;
+
+		//the bins run down in frequency, the frame runs up
+		for (int i = starting_bin + n_bins; i >= starting_bin && n < WEB_SPECTRUM_MAX; i--){
+			int y = spectrum_plot[i] + waterfall_offset;
+			bins[n++] = y < 0 ? 0 : (y > 255 ? 255 : y);
+		}
+		span = (int)(n_bins * 46.875);
+	}
+
+	frame[0] = WEB_FRAME_SPECTRUM;
+	frame[1] = WEB_FRAME_VERSION;
+	frame[2] = in_tx ? 1 : 0;
+	frame_put16(frame + 4, n);
+	frame_put16(frame + 6, 0);
+	frame_put32(frame + 8, field_int("FREQ"));
+	frame_put32(frame + 12, span);
+	frame_put32(frame + 16, millis());
+
+	int len = -1;
+	if (*prev_n == n)
+		len = spectrum_delta(frame + SPECTRUM_HEADER, bins, prev, n);
+	if (len < 0){
+		frame[3] = SPECTRUM_RAW;
+		memcpy(frame + SPECTRUM_HEADER, bins, n);
+		len = n;
+	}
+	else
+		frame[3] = SPECTRUM_DELTA;
+
+	memcpy(prev, bins, n);
+	*prev_n = n;
+	return SPECTRUM_HEADER + len;
+}
+
 void set_radio_mode(char *mode){
 	char umode[10], request[100], response[100];
 	int i;
@@ -4015,8 +4434,12 @@ void zbitx_write(int style, char *text){
 	}
 	sprintf(buffer, "%d %s", style, text);
 	char *p = buffer;		
-	if (q_zbitx_console.overflow)
-		q_empty(&q_zbitx_console);
+	//the panel thread owns the tail of the queue, if it has fallen 
+	//behind, the line is dropped rather than emptying the queue under it
+	if (q_length(&q_zbitx_console) + strlen(buffer) + 1 >= q_zbitx_console.max_q){
+		printf("*zbitx console is backed up\n");
+		return;
+	}
 	while (*p)
 		q_write(&q_zbitx_console, *p++);
 	q_write(&q_zbitx_console, 0);
@@ -4027,8 +4450,8 @@ void zbitx_get_spectrum(char *buff){
 
   int n_bins = (int)((1.0 * spectrum_span) / 46.875);
   //the center frequency is at the center of the lower sideband,
-  //i.e, three-fourth way up the bins.
-  int starting_bin = (3 *MAX_BINS)/4 - n_bins/2;
+  //i.e, three-fourth way up the bins, moved by any digital tuning.
+  int starting_bin = (MAX_BINS - rx_list->tuned_bin) - n_bins/2;
   int ending_bin = starting_bin + n_bins;
 
   int j;
@@ -4037,8 +4460,9 @@ void zbitx_get_spectrum(char *buff){
 		j = strlen(buff);
 		float step = MOD_MAX/250.0;
 		//printf("wf on tx %d / %d", step, MOD_MAX);
-		for (float i = 0; i < MOD_MAX; i+= step){
-      int y = (2 * mod_display[(int)i]) + 32;
+		//exactly 250 points, the float steps can round to one more
+		for (int k = 0; k < 250; k++){
+      int y = (2 * mod_display[(int)(k * step)]) + 32;
       if (y > 127)
         buff[j] = 127;
 			else if (y < 32)
@@ -4052,16 +4476,14 @@ void zbitx_get_spectrum(char *buff){
     strcpy(buff, "WF ");
 		j = strlen(buff);
 		float step = (1.0  * (ending_bin - starting_bin))/250.0;
-		float i = 1.0 * starting_bin;
-    while(i <= (int) ending_bin){
-      int y = spectrum_plot[(int)i] + waterfall_offset;
+		for (int k = 0; k < 250; k++){
+      int y = spectrum_plot[starting_bin + (int)(k * step)] + waterfall_offset;
       if (y > 95)
         buff[j++] = 127;
       else if(y >= 0 )
         buff[j++] = y + 32;
       else
         buff[j++] = ' ';
-			i += step;
     }
   }
 
@@ -4071,126 +4493,275 @@ void zbitx_get_spectrum(char *buff){
   return;
 }
 
-static void zbitx_logs(){
-	char logbook_path[200];
-	char row_response[1000], row[1000];
-	char query[100];
-	char args[100];
-	int	row_id;
+/*
+	The zBitx front panel shares the bit-banged I2C with the Si5351. 
+	Each byte takes about a hundred microseconds on the wire and a full
+	refresh of the fields used to hold up the GTK thread for hundreds
+	of milliseconds. Now all the panel traffic goes through a thread 
+	of its own, zbitx_poll() only wakes it up.
+
+	Each pass of the thread goes through these lanes, in order:
+	1. IN_TX and the console lines, these always go out
+	2. the fields changed since the last pass, each field goes out once
+		with its latest value (see field_journal_next())
+	3. the spectrum, only if the pass is still within its time budget,
+		a late spectrum is just dropped
+	4. the log rows, when the panel has asked for them
+	The fields and the log rows go out a few blocks per pass, the rest 
+	wait for the next pass. This keeps each pass, and hence the IN_TX 
+	and the console, within a bounded time no matter how many fields change.
+
+	Each message goes in an I2C block of its own and is paced as it 
+	always was, the panel's firmware expects nothing else.
+*/
 
-	printf("Sending the last 50 log entries to zbitx\n");	
-	query[0] = 0;
-	row_id = -1;
-	logbook_query(NULL, row_id, logbook_path);
-	FILE *pf = fopen(logbook_path, "r");
-	if (!pf)
-		return;
-	while(fgets(row, sizeof(row), pf)){
-		sprintf(row_response, "QSO %s}", row);
-		//printf(row_response);
-		i2cbb_write_i2c_block_data(ZBITX_I2C_ADDRESS, '{', strlen(row_response), row_response);
-	}
-	fclose(pf);
-}
+#define ZBITX_BLOCK_MAX 255 		//the block length goes out as a byte
+#define ZBITX_LANE_BLOCKS 4			//blocks of fields or log rows per pass
+#define ZBITX_SPECTRUM_MS 60		//drop the spectrum if the pass is this late
+#define ZBITX_FIELD_GAP 10			//msecs for the panel to digest a field
 
-void zbitx_poll(int all){
-	char buff[3000];
-	static unsigned int last_update = 0;
-	static int wf_update = 1;
+struct zbitx_block {
+	int count;	//blocks sent in this pass
+};
 
-	int count = 0;
-	int e = 0;
-	int retry;
-	unsigned int this_time = millis();
+static struct {
+	unsigned long bytes, blocks, retries, failures;
+	unsigned long spectrum_sent, spectrum_dropped;
+	unsigned long passes, busy_usec, worst_pass_usec;
+} zbitx_link;
 
-	for (int i = 0; active_layout[i].cmd[0] > 0; i++){
-		struct field *f = active_layout+i;
-		if (!strcmp(f->label, "WATERFALL") || !strcmp(f->label, "SPECTRUM"))
-			continue;
-		if (all || f->updated_at >  last_update){
-			sprintf(buff, "%s %s}", f->label, f->value);
-			retry = 3;
-			do {
-				e = i2cbb_write_i2c_block_data(ZBITX_I2C_ADDRESS, '{', strlen(buff), buff);
-				if (!e){
-					if (retry < 3)
-						printf("Sucess on %d\n", retry);
-					break;
-				}
-				delay(3);
-				printf("Retrying I2C %d\n", retry);
-			}while(retry--);
-			f->update_remote = 0;
-			count++;
-			delay(10);
-		}
+static pthread_t zbitx_thread;
+static pthread_mutex_t zbitx_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zbitx_wake = PTHREAD_COND_INITIALIZER;
+static int zbitx_kick = 0;
+static int zbitx_refresh = 0;
+static int zbitx_wf_update = 1;
+
+static unsigned long zbitx_usec(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
+//sends a '}' terminated message as a block, then waits gap msecs
+static int zbitx_send(struct zbitx_block *b, const char *msg, int gap){
+	int e, retry = 3;
+	int len = strlen(msg);
+
+	if (len > ZBITX_BLOCK_MAX){
+		printf("*zbitx: message is oversized %.20s\n", msg);
+		return -1;
 	}
-	last_update = this_time;
-	
-	//check if the console q has any new updates
-	while (q_length(&q_zbitx_console) > 0){
-		char remote_cmd[1000];
-		int c, i;
 
-		i = 0;
-		while(i < sizeof(remote_cmd)-3 && (c = q_read(&q_zbitx_console)) >= ' ')
-			remote_cmd[i++] = c;
-		remote_cmd[i++] = '}';
-		remote_cmd[i++] = 0;
- 	
-		e = i2cbb_write_i2c_block_data(ZBITX_I2C_ADDRESS, '{', 
-			strlen(remote_cmd), remote_cmd);
-	}
-
-	if (wf_update){
-		zbitx_get_spectrum(buff);
-		strcat(buff, "}"); //terminate the block
-		//spectrum can be lost mometarily, it is alright	
+	unsigned long start = zbitx_usec();
+	while ((e = i2c_write_block(ZBITX_I2C_ADDRESS, '{', len, msg)) 
+		&& retry--){
+		zbitx_link.retries++;
 		delay(1);
-		i2cbb_write_i2c_block_data(0x0a, '{', strlen(buff), buff);
 	}
-	//transmit in_tx
+	zbitx_link.busy_usec += zbitx_usec() - start;
+
+	if (!e){
+		zbitx_link.bytes += len + 1;
+		zbitx_link.blocks++;
+	}
+	else {
+		zbitx_link.failures++;
+		printf("*zbitx: lost a block of %d bytes\n", len);
+	}
+	b->count++;
+	if (gap)
+		delay(gap);
+	return e;
+}
+
+static void zbitx_urgent(struct zbitx_block *b){
+	char buff[300];
+	int c, i;
+
 	sprintf(buff, "IN_TX %d}", in_tx);
-	delay(1);
-	i2cbb_write_i2c_block_data(0x0a, '{', strlen(buff), buff);
+	zbitx_send(b, buff, 1);
+
+	while (q_length(&q_zbitx_console) > 0){
+		i = 0;
+		while(i < ZBITX_BLOCK_MAX - 1 && (c = q_read(&q_zbitx_console)) >= ' ')
+			buff[i++] = c;
+		buff[i++] = '}';
+		buff[i] = 0;
+		zbitx_send(b, buff, 0);
+	}
+}
+
+static void zbitx_send_field(struct zbitx_block *b, struct field *f){
+	char buff[200];
+
+	if (!strcmp(f->label, "WATERFALL") || !strcmp(f->label, "SPECTRUM"))
+		return;
+	snprintf(buff, sizeof(buff)-1, "%s %s", f->label, f->value);
+	strcat(buff, "}");
+	zbitx_send(b, buff, ZBITX_FIELD_GAP);
+}
+
+static void zbitx_fields(struct zbitx_block *b, int refresh){
+	static unsigned int zbitx_version = 0;
+	static struct field *refresh_layout = NULL;
+	static int refresh_at = -1;	//the next field of a full refresh
+	int budget = b->count + ZBITX_LANE_BLOCKS;
+	struct field *f;
+
+	//the journal may have moved on, a full refresh then
+	if (refresh || field_journal_lost(zbitx_version) 
+		|| (refresh_at >= 0 && refresh_layout != active_layout)){
+		refresh_layout = active_layout;
+		refresh_at = 0;
+		zbitx_version = remote_version;
+	}
+
+	while (refresh_at >= 0 && b->count < budget){
+		if (active_layout[refresh_at].cmd[0] == 0)
+			refresh_at = -1;
+		else
+			zbitx_send_field(b, active_layout + refresh_at++);
+	}
+
+	unsigned int upto = remote_version;
+	while (b->count < budget && (f = field_journal_next(&zbitx_version, upto)))
+		zbitx_send_field(b, f);
+}
+
+static void zbitx_spectrum(struct zbitx_block *b, unsigned long pass_start){
+	char buff[1000];
+
+	if (!zbitx_wf_update)
+		return;
+	if (zbitx_usec() - pass_start > ZBITX_SPECTRUM_MS * 1000){
+		zbitx_link.spectrum_dropped++;
+		return;
+	}
+	zbitx_get_spectrum(buff);
+	strcat(buff, "}"); //terminate the block
+	zbitx_send(b, buff, 1);
+	zbitx_link.spectrum_sent++;
+}
+
+/* the log rows go out over as many passes as it takes. The last 50 QSOs
+	are paged out of the log a row at a time, the cursor is the id of the
+	last row sent */
+static int zbitx_log_cursor = 0;
+
+static void zbitx_log_row(void *context, int id, char *text){
+	char row_response[1000];
+
+	snprintf(row_response, sizeof(row_response), "QSO %s}", text);
+	zbitx_send((struct zbitx_block *)context, row_response, 0);
+	zbitx_log_cursor = id;
+}
 
-	if(update_logs){
-		zbitx_logs();
+static void zbitx_logs(struct zbitx_block *b){
+	static int rows_left = 0;
+	int budget = b->count + ZBITX_LANE_BLOCKS;
+
+	if (update_logs){
 		update_logs = 0;
+		printf("Sending the last 50 log entries to zbitx\n");	
+		zbitx_log_cursor = 0;
+		rows_left = 50;
 	}
 
+	while (rows_left > 0 && b->count < budget){
+		if (!logbook_rows(NULL, zbitx_log_cursor, 1, LOGBOOK_PIPE, zbitx_log_row, b))
+			rows_left = 0;
+		else
+			rows_left--;
+	}
+}
+
+static void zbitx_reply(){
+	char buff[300];
 	int  reply_length;
 
-	if ((reply_length = i2cbb_read_rll(0xa, buff)) != -1){
+	if ((reply_length = i2c_read_rll(ZBITX_I2C_ADDRESS, buff)) == -1)
+		return;
+
 	//zero terminate the reply
-		buff[reply_length] = 0;
-
-		if(!strncmp(buff, "FT8 ", 4)){
-			char ft8_message[100];
-			hd_strip_decoration(ft8_message, buff);
-			//ft8_process(ft8_message, FT8_START_QSO);
-			remote_execute(ft8_message);
-			printf("FT8 processing from zbitx\n");
-		}
-		else if (!strcmp(buff, "WF ON"))
-			wf_update = 1;
-		else if (!strcmp(buff, "WF OFF"))
-			wf_update = 0;
-		else{
-			if (!strncmp(buff, "OPEN", 4)){
-				update_logs = 1;
-				printf("<<<< refresh the log >>>>>\n");
-			}
-			remote_execute(buff);
+	buff[reply_length] = 0;
+
+	if(!strncmp(buff, "FT8 ", 4)){
+		char ft8_message[100];
+		hd_strip_decoration(ft8_message, buff);
+		//ft8_process(ft8_message, FT8_START_QSO);
+		remote_execute(ft8_message);
+		printf("FT8 processing from zbitx\n");
+	}
+	else if (!strcmp(buff, "WF ON"))
+		zbitx_wf_update = 1;
+	else if (!strcmp(buff, "WF OFF"))
+		zbitx_wf_update = 0;
+	else{
+		if (!strncmp(buff, "OPEN", 4)){
+			update_logs = 1;
+			printf("<<<< refresh the log >>>>>\n");
 		}
+		remote_execute(buff);
+	}
+}
+
+static void *zbitx_thread_function(void *ptr){
+	struct zbitx_block b;
+
+	while (1){
+		pthread_mutex_lock(&zbitx_lock);
+		while (!zbitx_kick)
+			pthread_cond_wait(&zbitx_wake, &zbitx_lock);
+		zbitx_kick = 0;
+		int refresh = zbitx_refresh;
+		zbitx_refresh = 0;
+		pthread_mutex_unlock(&zbitx_lock);
+
+		unsigned long start = zbitx_usec();
+		b.count = 0;
+
+		zbitx_urgent(&b);
+		zbitx_fields(&b, refresh);
+		zbitx_spectrum(&b, start);
+		zbitx_logs(&b);
+		zbitx_reply();
+
+		unsigned long took = zbitx_usec() - start;
+		zbitx_link.passes++;
+		if (took > zbitx_link.worst_pass_usec)
+			zbitx_link.worst_pass_usec = took;
 	}
-	last_update = this_time;
+}
+
+//called from the ui_tick(), wakes up the panel thread for a pass
+void zbitx_poll(int all){
+	pthread_mutex_lock(&zbitx_lock);
+	zbitx_kick = 1;
+	if (all)
+		zbitx_refresh = 1;
+	pthread_cond_signal(&zbitx_wake);
+	pthread_mutex_unlock(&zbitx_lock);
+}
+
+void zbitx_link_status(char *buff){
+	unsigned long busy = zbitx_link.busy_usec ? zbitx_link.busy_usec : 1;
+
+	sprintf(buff, "zbitx link: %lu bytes in %lu blocks, %lu bytes/sec, "
+		"%lu retries, %lu lost, spectrum %lu sent %lu dropped, "
+		"%lu passes, worst %lu msec\n",
+		zbitx_link.bytes, zbitx_link.blocks, 
+		(unsigned long)(zbitx_link.bytes * 1000000.0 / busy),
+		zbitx_link.retries, zbitx_link.failures,
+		zbitx_link.spectrum_sent, zbitx_link.spectrum_dropped,
+		zbitx_link.passes, zbitx_link.worst_pass_usec / 1000);
 }
 
 void zbitx_init(){
 	char buff[100];
 	sprintf(buff, "9 %s}", VER_STR);
- 	int e = i2cbb_write_i2c_block_data (ZBITX_I2C_ADDRESS, '{', 
+ 	int e = i2c_write_block(ZBITX_I2C_ADDRESS, '{', 
 		strlen(buff), buff);
 
 
@@ -4199,7 +4770,7 @@ void zbitx_init(){
 		zbitx_available = 1;
 
 
- 		e = i2cbb_write_i2c_block_data (ZBITX_I2C_ADDRESS, '{', 
+ 		e = i2c_write_block(ZBITX_I2C_ADDRESS, '{', 
 		strlen(VER_STR), VER_STR);
 
 		FILE *pf = popen("hostname -I", "r");
@@ -4212,10 +4783,11 @@ void zbitx_init(){
 			if (p){
 				*p = 0;
 				sprintf(buff, "9 \nzBitx on http://%s\n}", ip_str);
- 				i2cbb_write_i2c_block_data (ZBITX_I2C_ADDRESS, '{', 
+ 				i2c_write_block(ZBITX_I2C_ADDRESS, '{', 
 					strlen(buff), buff);
 			}
 		}
+		pthread_create(&zbitx_thread, NULL, zbitx_thread_function, NULL);
 	}
 }
 
@@ -4240,10 +4812,13 @@ gboolean ui_tick(gpointer gook){
 	while (q_length(&q_remote_commands) > 0){
 		//read each command until the 
 		char remote_cmd[1000];
-		int c, i;
+		int c, i, source;
+		pthread_mutex_lock(&remote_commands_lock);
+		source = q_read(&q_remote_commands);
 		for (i = 0; i < sizeof(remote_cmd)-2 &&  (c = q_read(&q_remote_commands)) >= ' '; i++){
 			remote_cmd[i] = c;
 		}
+		pthread_mutex_unlock(&remote_commands_lock);
 		remote_cmd[i] = 0;
 
 		//echo the keystrokes for chatty modes like cw/rtty/psk31/etc
@@ -4254,6 +4829,8 @@ gboolean ui_tick(gpointer gook){
 			cmd_exec(remote_cmd);
 			settings_updated = 1; //save the settings
 		}
+		if (source >= 0 && source < REMOTE_SOURCES)
+			remote_executed(source);
 	}
 
 	//the Gtk invalidations can only be done from this thread, so..
@@ -4320,6 +4897,7 @@ gboolean ui_tick(gpointer gook){
 			zbitx_poll(0);
 
 		try_ntp();
+		wsjtx_poll();
 
 		if(in_tx){
 			char buff[10];
@@ -4361,8 +4939,8 @@ gboolean ui_tick(gpointer gook){
 
     // check if low and high settings are stepping on each other
     char new_value[20];
-    while (atoi(get_field("r1:low")->value) > atoi(get_field("r1:high")->value)){
-      sprintf(new_value, "%d", atoi(get_field("r1:high")->value)+get_field("r1:high")->step);
+    while (field_value_int(get_field("r1:low")) > field_value_int(get_field("r1:high"))){
+      sprintf(new_value, "%d", field_value_int(get_field("r1:high"))+get_field("r1:high")->step);
       set_field("r1:high",new_value);
     }
 
@@ -4391,8 +4969,6 @@ gboolean ui_tick(gpointer gook){
   }
 	//update_field(get_field("#text_in")); //modem might have extracted some text
 
-  hamlib_slice();
-	remote_slice();
 	save_user_settings(0);
 
  
@@ -4485,7 +5061,7 @@ int get_tx_data_byte(char *c){
 			f->value[i] = f->value[i+1];
 	}
 	f->is_dirty = 1;
-	f->update_remote = 1;
+	field_changed(f);
 	f->updated_at = millis();
 	//update_field(f);
 	return length;
@@ -4569,6 +5145,7 @@ void change_band(char *request){
 
 	struct field *bandswitch = get_field_by_label(band_stack[new_band].name);
 	sprintf(bandswitch->value, "%d", band_stack[new_band].index+1);
+	field_changed(bandswitch);
 	set_field("#selband", buff);
 	q_empty(&q_web);// inserted by llh 
   console_init(); // inserted by llh 
@@ -4704,6 +5281,7 @@ void do_control_action(char *cmd){
 		if (!strcmp(vfo->value, "B")){
 			//vfo_a_freq = atoi(f->value);
 			strcpy(vfo_a->value, f->value);
+			field_changed(vfo_a);
 			//sprintf(buff, "%d", vfo_b_freq);
 			set_field("r1:freq", vfo_b->value);
 			settings_updated++;
@@ -4718,6 +5296,7 @@ void do_control_action(char *cmd){
 		if (!strcmp(vfo->value, "A")){
 		//	vfo_b_freq = atoi(f->value);
 			strcpy(vfo_b->value, f->value);
+			field_changed(vfo_b);
 	//		sprintf(buff, "%d", vfo_a_freq);
 			set_field("r1:freq", vfo_a->value);
 			settings_updated++;
@@ -4992,6 +5571,8 @@ void cmd_exec(char *cmd){
 		logbook_delete(atoi(args));
 		update_logs = 1;
 	}
+	else if (!strcmp(exec, "adif_import"))
+		logbook_import_adif(args);
 	else if (!strcmp(exec, "power")){
 		set_field("#fwdpower", args);
 	}
@@ -5002,10 +5583,25 @@ void cmd_exec(char *cmd){
 	else if (!strcmp(exec, "metercal")){
 		meter_calibrate();
 	}
-	else if (!strcmp(exec, "abort"))
-		abort_tx();
+	else if (!strcmp(exec, "abort")){
+		//abort auto stops the ft8 sequence, the transmission is finished
+		if (!strcmp(args, "auto"))
+			ft8_halt();
+		else
+			abort_tx();
+	}
 	else if (!strcmp(exec, "rtc"))
 		rtc_read();
+	else if (!strcmp(exec, "i2c")){
+		char status[300];
+		i2c_stats(status);
+		write_console(FONT_LOG, status);
+	}
+	else if (!strcmp(exec, "zbitx")){
+		char status[300];
+		zbitx_link_status(status);
+		write_console(FONT_LOG, status);
+	}
 	else if (!strcmp(exec, "txcal")){
 		char response[10];
 		sdr_request("txcal=", response);
@@ -5107,6 +5703,8 @@ void cmd_exec(char *cmd){
 		tx_on(TX_SOFT);
 	else if (!strcmp(exec, "r"))
 		tx_off();
+	else if (!strcmp(exec, "ptt"))
+		hamlib_tx(atoi(args));
 // added rtx for web remote tx function coming soon
         else if (!strcmp(exec, "rtx")) {
                 tx_on(TX_SOFT);
@@ -5293,7 +5891,9 @@ int main( int argc, char* argv[] ) {
 	// you don't want to save the recently loaded settings
 	settings_updated = 0;
   hamlib_start();
+	wsjtx_start();
 	remote_start();
+	netio_start();
 
 	rtc_read();
 	zbitx_init();
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <alsa/asoundlib.h>
 #include <pthread.h>
 #include <complex.h>
@@ -8,6 +9,8 @@
 #include "sound.h"
 #include "wiringPi.h"
 #include "sdr.h"
+#include "resampler.h"
+#include "ntputil.h"
 
 // Set the DEBUG define to 1 to compile in the debugging messages.
 // Set the DEBUG define to 2 to compile in detailed error reporting debugging messages.
@@ -176,6 +179,11 @@ unsigned long sound_millis = 0;
 
 struct Queue qloop;
 
+//the loopback is read at 48000, the sound card runs at 96000 on its own clock
+//qloop is held at about 40 msec of samples to ride over the jitter
+#define LOOPBACK_TARGET (2048)
+static struct resampler rs_loop;
+
 /* this function should be called just once in the application process.
 Calling it frequently will result in more allocation of hw_params memory blocks
 without releasing them.
@@ -739,6 +747,12 @@ int sound_loop(){
 		printf("Delta Time: %d, Available output sample storage: %d\n", delta_time, snd_pcm_avail(pcm_play_handle));
 #endif		
 		samples_read += pcmreturn;
+
+		//stamp the block for the modems that keep to the UTC second
+		snd_pcm_sframes_t play_delay = 0;
+		if (snd_pcm_delay(pcm_play_handle, &play_delay) < 0)
+			play_delay = 0;
+		timebase_block(pcmreturn, rate, pcm_read_avail - pcmreturn, play_delay);
 		
 		i = 0; 
 		j = 0;
@@ -751,27 +765,20 @@ int sound_loop(){
 		if (use_virtual_cable)
 		{
 			//printf(" we have %d in qloop, writing now\n", q_length(&qloop));
-			// if don't we have enough to last two iterations loop back...
-			if (q_length(&qloop) < pcmreturn)
-			{
-#if DEBUG > -1
-				puts(" skipping\n");
+			// resample the 48000 loopback to our rate, the resampler
+			// keeps pace with the loopback clock. Until the queue fills up
+			// we send silence instead of dropping the block
+			if (rs_update(&rs_loop, &qloop, ret_card) == 0)
+				rs_read(&rs_loop, &qloop, input_q, ret_card);
+			else{
+#if DEBUG > 0
+				printf(" qloop filling %d\n", q_length(&qloop));
 #endif
-				continue;
-			}
-	
-			//copy 1024 samples from the queue.
-			i = 0;
-			j = 0;
-
-			for (int samples  = 0; samples < 1024; samples++)
-			{
-				int32_t s = q_read(&qloop);
-				input_i[j] = input_q[j] = s;
-				j++; 
+				memset(input_q, 0, ret_card * sizeof(int32_t));
 			}
+			memcpy(input_i, input_q, ret_card * sizeof(int32_t));
 			//fwrite(input_q, 1024, 4, pf);
-			played_samples += 1024;
+			played_samples += ret_card;
 		}  // end for use_virtual_cable test
 		else 
 		{
@@ -986,17 +993,17 @@ int loopback_loop(){
 		//fill up a local buffer, take only the left channel	
 		// i = 0; 
 		// j = 0;	
+		//the sound thread resamples these to 96000
 		for (i = 0; i < pcmreturn; i++){
-			q_write(&qloop, data_in[j]);
 			q_write(&qloop, data_in[j]);
 			j += 2;
 		}
-		nsamples += j;
+		nsamples += i;
 
 		clock_gettime(CLOCK_MONOTONIC, &gettime_now);
 		if (gettime_now.tv_sec != last_sec){
 			//if(use_virtual_cable)
-			//	printf("######sampling rate %d/%d\n", played_samples, nsamples);
+			//	printf("######sampling rate %d/%d ratio %g\n", played_samples, nsamples, rs_loop.ratio);
 			last_sec = gettime_now.tv_sec;
 			nsamples = 0;
 			played_samples = 0;
@@ -1097,6 +1104,7 @@ void *loopback_thread_function(void *ptr){
 int sound_thread_start(char *device){
 	q_init(&qloop, 10240);
  	qloop.stall = 1;
+	rs_init(&rs_loop, 48000, 96000, LOOPBACK_TARGET);
 
 	pthread_create( &sound_thread, NULL, sound_thread_function, (void*)device);
 	sleep(1);
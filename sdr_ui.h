@@ -7,18 +7,35 @@ int field_set(const char *label, const char *new_value);
 int get_field_value(char *id, char *value);
 int get_field_value_by_label(char *label, char *value);
 extern int spectrum_plot[];
+#define REMOTE_OTHER 0		//the web, the zbitx panel, telnet and wsjtx
+#define REMOTE_HAMLIB 1
+#define REMOTE_SOURCES 2
 void remote_execute(char *command);
-int remote_update_field(int i, char *text);
+void remote_execute_from(int source, char *command);
+int remote_pending(int source);
+int remote_update_field(int i, char *text, unsigned int since);
+unsigned int remote_field_version();
+int remote_updates_lost(unsigned int cursor);
+int remote_updates(unsigned int *cursor, char *buff, int max);
 void web_get_spectrum(char *buff);
+int web_get_spectrum_frame(uint8_t *frame, uint8_t *prev, int *prev_n);
 int web_get_console(char *buff, int max);
-int remote_audio_output(int16_t *samples);
+int remote_audio_output(int16_t *samples, int count);
+int remote_audio_rate(int rate);
 const char *field_str(char *label);
 int field_int(char *label);
+int field_watch(const char *label, void (*fn)(const char *label, int value));
 int is_in_tx();
 void abort_tx();
 void enter_qso();
 extern int display_freq;
 
+//binary websocket frames are tagged by their first two bytes
+#define WEB_FRAME_SPECTRUM 'S'
+#define WEB_FRAME_AUDIO 'A'
+#define WEB_FRAME_VERSION 1
+#define WEB_SPECTRUM_MAX 2048
+
 #define FONT_FIELD_LABEL 0
 #define FONT_FIELD_VALUE 1
 #define FONT_LARGE_FIELD 2
@@ -2,12 +2,9 @@
 #include <linux/types.h>
 #include <stdint.h>
 #include <wiringPi.h>
-#include "i2cbb.h"
+#include "i2c.h"
 #include "si5351.h"
 
-#define SDA 23 
-#define SCL 22
-
 #define SI_CLK0_CONTROL  16      // Register definitions
 #define SI_CLK1_CONTROL 17
 #define SI_CLK2_CONTROL 18
@@ -53,16 +50,77 @@ static int i2c_error_count = 0;       // counts I2C Errors
 
 /*
 void i2cSendRegister(uint8_t reg, uint8_t* data, uint8_t n){
-  i2cbb_write_i2c_block_data (SI5351_ADDR, reg, n, data); 
+  i2c_write_block (SI5351_ADDR, reg, n, data); 
 }
 */
 
-void i2cSendRegister(uint8_t reg, uint8_t val){ 
-  while (i2cbb_write_byte_data(SI5351_ADDR, reg, val) < 0)
+/* 
+  The register shadow
+  Every register we write is remembered in si_shadow. A new configuration
+  is compared against it and only the registers that have changed are
+  sent, as burst writes (the si5351 auto-increments the register address).
+  A tuning step usually changes just two or three of the pll fraction
+  registers instead of the seventeen that make up a full clock setup.
+  si_bytes counts the bytes on the i2c bus, including the address and 
+  the register bytes of each burst.
+*/
+
+static uint8_t si_shadow[256];
+static uint8_t si_known[256];   // set when the shadow matches the chip
+static int si_bytes = 0;        // bytes sent since the last si5351bx_setfreq
+static int si_bytes_total = 0;
+
+static void si_burst(uint8_t reg, uint8_t n, const uint8_t *data){
+  while (i2c_write_block(SI5351_ADDR, reg, n, data) < 0)
   {
     printf("Repeating I2C #%d\n",i2c_error_count++);  // reports number of I2C repeats caused by errors
     delay(1);
   }
+  si_bytes += n + 2; // address + register + data
+  si_bytes_total += n + 2;
+  for (int i = 0; i < n; i++){
+    si_shadow[reg + i] = data[i];
+    si_known[reg + i] = 1;
+  }
+}
+
+/* writes the registers from reg onwards that differ from the shadow.
+  changed registers separated by a single unchanged one are sent in the
+  same burst, it costs less than starting another transaction */
+static int si_write_regs(uint8_t reg, const uint8_t *data, int n){
+  int i = 0, changed = 0;
+
+  while (i < n){
+    if (si_known[reg + i] && si_shadow[reg + i] == data[i]){
+      i++;
+      continue;
+    }
+    int start = i, end = i;
+    while (i < n){
+      if (!si_known[reg + i] || si_shadow[reg + i] != data[i]){
+        end = i;
+        changed++;
+      }
+      else if (i - end > 1)
+        break;
+      i++;
+    }
+    si_burst(reg + start, end - start + 1, data + start);
+  }
+  return changed;
+}
+
+void i2cSendRegister(uint8_t reg, uint8_t val){ 
+  si_burst(reg, 1, &val);
+}
+
+// returns the bytes sent on the i2c bus by the last si5351bx_setfreq()
+int si5351_tune_bytes(){
+  return si_bytes;
+}
+
+int si5351_total_bytes(){
+  return si_bytes_total;
 }
 
 void si5351_reset(){
@@ -72,7 +130,8 @@ void si5351_reset(){
 void si5351a_clkoff(uint8_t clk)
 {
   //i2c_init();
-  i2cSendRegister(clk, 0x80);   // Refer to SiLabs AN619 to see bit values - 0x80 turns off the output stage
+  uint8_t off = 0x80;
+  si_write_regs(clk, &off, 1);   // Refer to SiLabs AN619 to see bit values - 0x80 turns off the output stage
 
   //i2c_exit();
 }
@@ -102,14 +161,16 @@ static void setup_pll(uint8_t pll, uint8_t mult, uint32_t num, uint32_t denom)
     P2 = (uint32_t)(128 * num - denom * P2);
     P3 = denom;
   }
-  i2cSendRegister(pll + 0, (P3 & 0x0000FF00) >> 8);
-  i2cSendRegister(pll + 1, (P3 & 0x000000FF));
-  i2cSendRegister(pll + 2, (P1 & 0x00030000) >> 16);
-  i2cSendRegister(pll + 3, (P1 & 0x0000FF00) >> 8);
-  i2cSendRegister(pll + 4, (P1 & 0x000000FF));
-  i2cSendRegister(pll + 5, ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16));
-  i2cSendRegister(pll + 6, (P2 & 0x0000FF00) >> 8);
-  i2cSendRegister(pll + 7, (P2 & 0x000000FF));
+  uint8_t regs[8];
+  regs[0] = (P3 & 0x0000FF00) >> 8;
+  regs[1] = (P3 & 0x000000FF);
+  regs[2] = (P1 & 0x00030000) >> 16;
+  regs[3] = (P1 & 0x0000FF00) >> 8;
+  regs[4] = (P1 & 0x000000FF);
+  regs[5] = ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16);
+  regs[6] = (P2 & 0x0000FF00) >> 8;
+  regs[7] = (P2 & 0x000000FF);
+  si_write_regs(pll, regs, 8);
 }
 
 static void setup_multisynth(uint8_t clk, uint8_t pllSource, uint32_t divider,  uint32_t num, uint32_t denom, uint32_t rdiv,  uint8_t drive_strength){
@@ -167,14 +228,16 @@ static void setup_multisynth(uint8_t clk, uint8_t pllSource, uint32_t divider,
     P3 = denom;
   }
 
-  i2cSendRegister(synth + 0,   (P3 & 0x0000FF00) >> 8);
-  i2cSendRegister(synth + 1,   (P3 & 0x000000FF));
-  i2cSendRegister(synth + 2,   ((P1 & 0x00030000) >> 16) | div4 | rdiv);
-  i2cSendRegister(synth + 3,   (P1 & 0x0000FF00) >> 8);
-  i2cSendRegister(synth + 4,   (P1 & 0x000000FF));
-  i2cSendRegister(synth + 5,   ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16));
-  i2cSendRegister(synth + 6,   (P2 & 0x0000FF00) >> 8);
-  i2cSendRegister(synth + 7,   (P2 & 0x000000FF));
+  uint8_t regs[8];
+  regs[0] = (P3 & 0x0000FF00) >> 8;
+  regs[1] = (P3 & 0x000000FF);
+  regs[2] = ((P1 & 0x00030000) >> 16) | div4 | rdiv;
+  regs[3] = (P1 & 0x0000FF00) >> 8;
+  regs[4] = (P1 & 0x000000FF);
+  regs[5] = ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16);
+  regs[6] = (P2 & 0x0000FF00) >> 8;
+  regs[7] = (P2 & 0x000000FF);
+  si_write_regs(synth, regs, 8);
 
 /* clock control register
  *  |    7    |    6    |    5    |    4    |   3    |  2   |   1   |  0   |
@@ -187,7 +250,7 @@ static void setup_multisynth(uint8_t clk, uint8_t pllSource, uint32_t divider,
     dat |= SI_CLK_SRC_PLL_B;
   if (num == 0)
     dat |= SI5351_CLK_INTEGER_MODE;
-  i2cSendRegister(control, dat);
+  si_write_regs(control, &dat, 1);
 }
 
 
@@ -219,6 +282,16 @@ static void set_freq_fixeddiv(int clk, int pll, uint32_t frequency, int divider,
   Serial.println(divider); */
   setup_pll(pll, multi, num, denom);
   setup_multisynth(clk, pll, divider, 0, 1, SI_R_DIV_1, drive_strength);
+
+  /* the pll is reset only when the integer multiplier or the divider
+  changes (like on a band change). Tuning steps only move the pll 
+  fraction and the pll follows that without a reset (and a click) */
+  static int32_t last_multi[3] = {-1, -1, -1}, last_divider[3] = {-1, -1, -1};
+  if (last_multi[clk] != multi || last_divider[clk] != divider){
+    i2cSendRegister(SI_PLL_RESET, pll == SI_SYNTH_PLL_B ? 0x80 : 0x20);
+    last_multi[clk] = multi;
+    last_divider[clk] = divider;
+  }
 }
 
 
@@ -226,6 +299,7 @@ void si5351bx_setfreq(uint8_t clk, uint32_t frequency){
   int pll;
 
 	//printf("si5351: clk %d is on %d\n", clk, frequency);
+  si_bytes = 0;
   if (clk == 1)
     pll = SI_SYNTH_PLL_B;
   else
@@ -258,7 +332,6 @@ void si5351_set_calibration(int32_t cal){
 }
 
 void si5351bx_init(){ 
-  i2cbb_init(SDA, SCL);
 	delay(10);
   si5351_reset();
 	delay(10);
@@ -276,3 +349,21 @@ void main(int argc, char **argv){
   si5351bx_setfreq(1, 10000000);
 }
 */
+
+/* test the register shadow on the mock i2c bus, no hardware needed
+void main(int argc, char **argv){
+  i2c_init("mock");
+  si5351bx_setfreq(1, 40035000);
+  printf("bfo: %d bytes\n", si5351_tune_bytes());
+  for (int f = 7074000; f < 7075000; f += 100){
+    si5351bx_setfreq(2, f + 40035000 - 24000);
+    printf("%d: %d bytes, pll a [%02x %02x %02x]\n", f, si5351_tune_bytes(),
+      i2c_mock_register(SI5351_ADDR, SI_SYNTH_PLL_A + 5),
+      i2c_mock_register(SI5351_ADDR, SI_SYNTH_PLL_A + 6),
+      i2c_mock_register(SI5351_ADDR, SI_SYNTH_PLL_A + 7));
+  }
+  si5351bx_setfreq(2, 14074000 + 40035000 - 24000);
+  printf("band change: %d bytes\n", si5351_tune_bytes());
+  printf("total %d bytes\n", si5351_total_bytes());
+}
+*/
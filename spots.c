@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "sdr_ui.h"
+#include "spots.h"
+
+/*
+	The stations heard lately.
+	Each decode from the FT8 and the CW decoders is kept here against the
+	callsign that sent it, so that 'who is calling me', 'what was the
+	last report from K1ABC' and 'who is near 1500 Hz' are answered without
+	going back to the console text or the messages table.
+
+	The spots are in an open addressed hash table on the callsign. A
+	station that is heard again takes its old slot. Every audio frequency
+	bucket of 50 Hz keeps the slots of the last few stations heard there.
+	The table is swept every few seconds, the spots older than SPOT_AGE
+	are dropped and the rest are hashed into a fresh table. Nothing is
+	deleted in between, so a slot number stays good till the next sweep.
+
+	The decoders add from their threads, the gtk and the web server read
+	from theirs, so all of it is under the spot_lock. The lookups copy
+	the spots out.
+*/
+
+#define SPOT_SLOTS 1024		//must be a power of 2
+#define SPOT_MAX (SPOT_SLOTS/2)
+#define SPOT_AGE 120			//seconds, that is eight ft8 slots
+#define SPOT_SWEEP 10
+#define SPOT_BUCKET_HZ 50
+#define SPOT_BUCKETS 80		//up to 4 KHz
+#define SPOT_PER_BUCKET 4
+#define SPOT_CALLERS 16
+
+static struct spot spots[SPOT_SLOTS], swept[SPOT_SLOTS];
+static int spot_used = 0;
+static time_t spot_swept = 0;
+//the slots are stored plus one, zero is an empty entry
+static short buckets[SPOT_BUCKETS][SPOT_PER_BUCKET];
+static int bucket_next[SPOT_BUCKETS];
+static char callers[SPOT_CALLERS][12];
+static int callers_next = 0;
+static pthread_mutex_t spot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int spot_hash(const char *call){
+	unsigned int h = 2166136261u;
+
+	while (*call){
+		h ^= (unsigned char)*call++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+//the slot with the call or the empty slot where it would go
+static int spot_slot(const char *call){
+	int i = spot_hash(call) & (SPOT_SLOTS - 1);
+
+	while (spots[i].call[0] && strcmp(spots[i].call, call))
+		i = (i + 1) & (SPOT_SLOTS - 1);
+	return i;
+}
+
+static int spot_live(struct spot *s, time_t now){
+	return s->call[0] && now - s->when < SPOT_AGE;
+}
+
+static int spot_bucket(int freq_hz){
+	int b = freq_hz / SPOT_BUCKET_HZ;
+
+	if (b < 0)
+		return 0;
+	if (b >= SPOT_BUCKETS)
+		return SPOT_BUCKETS - 1;
+	return b;
+}
+
+static void spot_bucket_add(int slot){
+	int b = spot_bucket(spots[slot].freq_hz);
+
+	for (int i = 0; i < SPOT_PER_BUCKET; i++)
+		if (buckets[b][i] == slot + 1)
+			return;
+	buckets[b][bucket_next[b]] = slot + 1;
+	bucket_next[b] = (bucket_next[b] + 1) % SPOT_PER_BUCKET;
+}
+
+static void spot_caller_add(const char *call){
+	for (int i = 0; i < SPOT_CALLERS; i++)
+		if (!strcmp(callers[i], call))
+			return;
+	strcpy(callers[callers_next], call);
+	callers_next = (callers_next + 1) % SPOT_CALLERS;
+}
+
+//keeps the spots younger than age
+static void spot_sweep(time_t now, int age){
+	memcpy(swept, spots, sizeof(spots));
+	memset(spots, 0, sizeof(spots));
+	memset(buckets, 0, sizeof(buckets));
+	memset(bucket_next, 0, sizeof(bucket_next));
+	spot_used = 0;
+
+	for (int i = 0; i < SPOT_SLOTS; i++){
+		if (!swept[i].call[0] || now - swept[i].when >= age)
+			continue;
+		int slot = spot_slot(swept[i].call);
+		spots[slot] = swept[i];
+		spot_bucket_add(slot);
+		spot_used++;
+	}
+	spot_swept = now;
+}
+
+void spot_add(const char *mode, int freq_hz, int snr, const char *call,
+	const char *to, const char *grid, const char *message, int to_me){
+	time_t now = time_sbitx();
+
+	if (!call[0] || strlen(call) >= sizeof(spots[0].call))
+		return;
+
+	pthread_mutex_lock(&spot_lock);
+	if (now - spot_swept >= SPOT_SWEEP || spot_used >= SPOT_MAX)
+		spot_sweep(now, SPOT_AGE);
+	//a very busy band, keep only the latest
+	if (spot_used >= SPOT_MAX)
+		spot_sweep(now, SPOT_AGE / 4);
+	int slot = spot_slot(call);
+	struct spot *s = spots + slot;
+	if (!s->call[0]){
+		if (spot_used >= SPOT_MAX){
+			pthread_mutex_unlock(&spot_lock);
+			return;
+		}
+		spot_used++;
+		strcpy(s->call, call);
+		s->grid[0] = 0;
+	}
+	//a reply doesn't have the grid, remember it from the cq
+	if (grid && grid[0])
+		snprintf(s->grid, sizeof(s->grid), "%s", grid);
+	snprintf(s->to, sizeof(s->to), "%s", to ? to : "");
+	snprintf(s->mode, sizeof(s->mode), "%s", mode);
+	snprintf(s->message, sizeof(s->message), "%s", message);
+	s->freq_hz = freq_hz;
+	s->snr = snr;
+	s->to_me = to_me;
+	s->when = now;
+	spot_bucket_add(slot);
+	if (to_me)
+		spot_caller_add(call);
+	pthread_mutex_unlock(&spot_lock);
+}
+
+static int spot_is_grid(const char *t){
+	return strlen(t) == 4 && t[0] >= 'A' && t[0] <= 'R' && t[1] >= 'A' && t[1] <= 'R'
+		&& isdigit(t[2]) && isdigit(t[3]) && strcmp(t, "RR73");
+}
+
+//hashed calls come as <K1ABC>
+static char *spot_unbracket(char *t){
+	if (*t == '<'){
+		t++;
+		char *p = strchr(t, '>');
+		if (p)
+			*p = 0;
+	}
+	return t;
+}
+
+/* an ft8 or ft4 message is one of
+	CQ K1ABC FN42, CQ DX K1ABC FN42, CQ POTA K1ABC
+	or VU2ESE K1ABC FN42, VU2ESE K1ABC -10, VU2ESE K1ABC RR73 ... */
+void spot_ft8(const char *mode, int freq_hz, int snr, const char *message,
+	const char *mycall){
+	char buff[100], *t[4], *save;
+	char *call, *to = "", *grid = "";
+	int n = 0;
+
+	snprintf(buff, sizeof(buff), "%s", message);
+	for (char *p = strtok_r(buff, " ", &save); p && n < 4; p = strtok_r(NULL, " ", &save))
+		t[n++] = spot_unbracket(p);
+	if (n < 2)
+		return;
+
+	if (!strcmp(t[0], "CQ")){
+		if (n == 4){
+			call = t[2];
+			grid = t[3];
+		}
+		else if (n == 3 && !spot_is_grid(t[2]))
+			call = t[2];
+		else {
+			call = t[1];
+			grid = n == 3 ? t[2] : "";
+		}
+	}
+	else {
+		to = t[0];
+		call = t[1];
+		if (n >= 3 && spot_is_grid(t[2]))
+			grid = t[2];
+	}
+	if (!strcmp(call, "...") || (grid[0] && !spot_is_grid(grid)))
+		return;
+	spot_add(mode, freq_hz, snr, call, to, grid, message,
+		mycall && mycall[0] && !strcmp(to, mycall));
+}
+
+/* the lookups */
+
+int spot_find(const char *call, struct spot *s){
+	char key[12];
+	int i, found = 0;
+
+	for (i = 0; call[i] && i < sizeof(key) - 1; i++)
+		key[i] = toupper(call[i]);
+	key[i] = 0;
+
+	pthread_mutex_lock(&spot_lock);
+	struct spot *p = spots + spot_slot(key);
+	if (spot_live(p, time_sbitx())){
+		*s = *p;
+		found = 1;
+	}
+	pthread_mutex_unlock(&spot_lock);
+	return found;
+}
+
+//the stations heard within span_hz of the freq_hz
+int spot_near(int freq_hz, int span_hz, struct spot *list, int max){
+	time_t now = time_sbitx();
+	int n = 0;
+
+	pthread_mutex_lock(&spot_lock);
+	for (int b = spot_bucket(freq_hz - span_hz); b <= spot_bucket(freq_hz + span_hz); b++)
+		for (int i = 0; i < SPOT_PER_BUCKET && n < max; i++){
+			if (!buckets[b][i])
+				continue;
+			struct spot *s = spots + buckets[b][i] - 1;
+			//a station that has moved is in its new bucket
+			if (spot_live(s, now) && spot_bucket(s->freq_hz) == b
+				&& abs(s->freq_hz - freq_hz) <= span_hz)
+				list[n++] = *s;
+		}
+	pthread_mutex_unlock(&spot_lock);
+	return n;
+}
+
+//the stations that are calling us, the latest first
+int spot_callers(struct spot *list, int max){
+	time_t now = time_sbitx();
+	int n = 0;
+
+	pthread_mutex_lock(&spot_lock);
+	for (int i = 1; i <= SPOT_CALLERS && n < max; i++){
+		char *call = callers[(callers_next - i + SPOT_CALLERS) % SPOT_CALLERS];
+		if (!call[0])
+			continue;
+		struct spot *s = spots + spot_slot(call);
+		if (spot_live(s, now) && s->to_me)
+			list[n++] = *s;
+	}
+	pthread_mutex_unlock(&spot_lock);
+	return n;
+}
+
+int spot_all(struct spot *list, int max){
+	time_t now = time_sbitx();
+	int n = 0;
+
+	pthread_mutex_lock(&spot_lock);
+	for (int i = 0; i < SPOT_SLOTS && n < max; i++)
+		if (spot_live(spots + i, now))
+			list[n++] = spots[i];
+	pthread_mutex_unlock(&spot_lock);
+	return n;
+}
+
+//as a json array, the spots that don't fit are left out
+int spot_json(struct spot *list, int n, char *buff, int max){
+	int length = 1;
+	char item[200];
+
+	strcpy(buff, "[");
+	for (int i = 0; i < n; i++){
+		struct spot *s = list + i;
+		int e = snprintf(item, sizeof(item),
+			"%s{\"call\":\"%s\",\"to\":\"%s\",\"grid\":\"%s\",\"mode\":\"%s\","
+			"\"freq\":%d,\"snr\":%d,\"time\":%ld,\"message\":\"",
+			length > 1 ? "," : "", s->call, s->to, s->grid, s->mode,
+			s->freq_hz, s->snr, (long)s->when);
+		for (char *p = s->message; *p && e < sizeof(item) - 3; p++)
+			if (*p != '"' && *p != '\\' && *p >= ' ')
+				item[e++] = *p;
+		strcpy(item + e, "\"}");
+		e += 2;
+		if (length + e + 2 > max)
+			break;
+		strcpy(buff + length, item);
+		length += e;
+	}
+	strcpy(buff + length, "]");
+	return length + 1;
+}
+
+//the cw decoder only spots a word after a CQ or a DE that looks like a call
+int spot_is_call(const char *word){
+	int digits = 0, letters = 0, n = strlen(word);
+
+	if (n < 3 || n > 10)
+		return 0;
+	for (const char *p = word; *p; p++)
+		if (isdigit(*p))
+			digits++;
+		else if (isalpha(*p))
+			letters++;
+		else if (*p != '/')
+			return 0;
+	return digits > 0 && letters > 1 && isalpha(word[n-1]);
+}
+
+/* a test, it spots a band full of ft8 stations and times the lookups
+time_t time_sbitx(){
+	return time(NULL);
+}
+
+void main(int argc, char **argv){
+	struct spot s, list[50];
+	struct timespec start, stop;
+	char message[100];
+
+	for (int i = 0; i < 400; i++){
+		sprintf(message, i % 3 ? "CQ K%dABC FN42" : "VU2ESE K%dABC -10", i);
+		spot_ft8("FT8", 200 + (i * 7) % 2800, -10, message, "VU2ESE");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int found = 0;
+	for (int i = 0; i < 100000; i++){
+		sprintf(message, "K%dABC", i % 500);
+		found += spot_find(message, &s);
+		found += spot_near(1500, 100, list, 50) > 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	printf("%d found, %.2f usec per lookup pair\n", found,
+		((stop.tv_sec - start.tv_sec) * 1e6 + (stop.tv_nsec - start.tv_nsec)/1e3)/100000);
+	printf("%d callers, %d near 1500\n", spot_callers(list, 50),
+		spot_near(1500, 100, list, 50));
+	spot_find("K0ABC", &s);
+	printf("%s %s %s %d\n", s.call, s.grid, s.message, s.freq_hz);
+}
+*/
@@ -0,0 +1,24 @@
+/* the stations heard lately, see spots.c */
+
+struct spot {
+	char call[12];
+	char to[12];			//who they were calling, empty for a CQ
+	char grid[8];
+	char mode[6];
+	char message[40];
+	int freq_hz;			//the audio frequency
+	int snr;
+	int to_me;
+	time_t when;
+};
+
+void spot_add(const char *mode, int freq_hz, int snr, const char *call,
+	const char *to, const char *grid, const char *message, int to_me);
+void spot_ft8(const char *mode, int freq_hz, int snr, const char *message,
+	const char *mycall);
+int spot_find(const char *call, struct spot *s);
+int spot_near(int freq_hz, int span_hz, struct spot *list, int max);
+int spot_callers(struct spot *list, int max);
+int spot_all(struct spot *list, int max);
+int spot_json(struct spot *list, int n, char *buff, int max);
+int spot_is_call(const char *word);
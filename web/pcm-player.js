@@ -135,3 +135,47 @@ PCMPlayer.prototype.flush = function() {
     this.startTime += audioBuffer.duration;
     this.samples = new Float32Array();
 };
+
+/* IMA ADPCM decoder for the audio frames of the sbitx websocket,
+it has to match adpcm.c. The four byte frame header is followed by the
+16-bit predictor, the step index, a reserved byte and then two samples
+per byte, the first one in the lower nibble */
+var adpcm_index_table = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8];
+var adpcm_step_table = [
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767];
+
+function adpcm_decode(buffer) {
+    var view = new DataView(buffer);
+    var predictor = view.getInt16(4, true);
+    var index = view.getUint8(6);
+    var n = (buffer.byteLength - 8) * 2;
+    var out = new Int16Array(n);
+
+    for (var i = 0; i < n; i++) {
+        var b = view.getUint8(8 + (i >> 1));
+        var code = (i & 1) ? b >> 4 : b & 0x0f;
+        var step = adpcm_step_table[index];
+        var diff = step >> 3;
+
+        if (code & 4) diff += step;
+        if (code & 2) diff += step >> 1;
+        if (code & 1) diff += step >> 2;
+        predictor += (code & 8) ? -diff : diff;
+        if (predictor > 32767) predictor = 32767;
+        else if (predictor < -32768) predictor = -32768;
+
+        index += adpcm_index_table[code];
+        if (index < 0) index = 0;
+        else if (index > 88) index = 88;
+        out[i] = predictor;
+    }
+    return out;
+}
@@ -10,50 +10,105 @@
 #include "sdr.h"
 #include "sdr_ui.h"
 #include "logbook.h"
+#include "spots.h"
 #include "hist_disp.h"
+#include "adpcm.h"
 
 static const char *s_listen_on = "ws://0.0.0.0:8080";
 static char s_web_root[1000];
-static char session_cookie[100];
 static struct mg_mgr mgr;  // Event manager
 
-static void web_respond(struct mg_connection *c, char *message){
-	mg_ws_send(c, message, strlen(message), WEBSOCKET_OP_TEXT);
+/* The spectrum and the audio are pushed from a timer on the webserver
+thread rather than polled by the browser. If a connection's send buffer 
+backs up past its limit, frames are dropped for that connection instead 
+of queued, so a slow link never stalls the others or builds up latency */
+
+#define WEB_TICK_MS 10					// resolution of the push timer
+#define WEB_SPECTRUM_MS 100			// default spectrum frame interval
+#define WEB_AUDIO_CHUNK 320			// the most samples in 20 msec of audio
+#define WEB_SPECTRUM_LIMIT 16384	// spectrum is dropped beyond this backlog
+#define WEB_AUDIO_LIMIT 65536		// audio is dropped beyond this backlog
+#define WEB_MAX_SESSIONS 8
+
+//the last binary spectrum frame sent, for the delta coding 
+struct web_spectrum {
+	int n;
+	uint8_t bins[WEB_SPECTRUM_MAX];
+};
+
+/* Each websocket that logs in gets a session of its own, hung off
+c->fn_data. Many browsers can watch the radio at once, each with its 
+own cookie and its own cursor into the field changes */
+struct web_session {
+	char cookie[20];
+	unsigned int field_version;	// remote_field_version() last sent
+	uint32_t next_spectrum;			// mg_millis() when the next frame is due
+	uint16_t spectrum_ms;				// 0 = not streaming the spectrum
+	uint8_t audio;							// 1 = streaming audio
+	uint8_t codec;							// AUDIO_PCM or AUDIO_ADPCM
+	uint8_t binary;							// 1 = binary spectrum frames
+	uint32_t spectrum_dropped;
+	uint32_t audio_dropped;
+	struct web_spectrum prev;
+};
+
+static int session_count = 0;
+
+//the codec byte of the audio frame header
+#define AUDIO_PCM 0
+#define AUDIO_ADPCM 1
+
+static struct web_session *web_session(struct mg_connection *c){
+	if (!c->is_websocket || c->is_draining)
+		return NULL;
+	return (struct web_session *)c->fn_data;
 }
 
-static void get_console(struct mg_connection *c){
-	char buff[2100];
-	int n = web_get_console(buff, 2000);
-	if (!n)
-		return;
-	//char first20 [21]; strncpy(first20, buff, 20); first20[20] = 0;  tlog("get_console", first20, n);
-	mg_ws_send(c, buff, strlen(buff), WEBSOCKET_OP_TEXT);
+static void web_respond(struct mg_connection *c, char *message){
+	mg_ws_send(c, message, strlen(message), WEBSOCKET_OP_TEXT);
 }
 
 static void get_updates(struct mg_connection *c, int all){
 	//send the settings of all the fields to the client
-	char buff[2000];
+	char buff[4000];
 	int i = 0;
+	struct web_session *s = web_session(c);
+	if (!s)
+		return;
 
-	get_console(c);
+	//usually, just what changed since the last time, in one message
+	if (!all && !remote_updates_lost(s->field_version)){
+		int n;
+		while ((n = remote_updates(&s->field_version, buff, sizeof(buff))) > 0)
+			mg_ws_send(c, buff, n, WEBSOCKET_OP_TEXT);
+		return;
+	}
 
+	//fields changed while we are at it will go again the next time
+	unsigned int version = remote_field_version();
 	while(1){
-		int update = remote_update_field(i, buff);
+		int update = remote_update_field(i, buff, 0);
 		// return of -1 indicates the eof fields
 		if (update == -1)
-			return;
-	//send the status anyway
-		if (all || update )
-			mg_ws_send(c, buff, strlen(buff), WEBSOCKET_OP_TEXT); 
+			break;
+		mg_ws_send(c, buff, strlen(buff), WEBSOCKET_OP_TEXT); 
 		i++;
 	}
+	s->field_version = version;
 }
 
-static void do_login(struct mg_connection *c, char *key){
+/* the login carries the passkey, optionally followed by the audio 
+sample rate and the codec ("pcm" or "adpcm") that the client wants */
+static void do_login(struct mg_connection *c, char *args){
 
 	char passkey[20];
+	char *key = args;
+	char *options = NULL;
 	get_field_value("#passkey", passkey);
 
+	if (args && (options = strchr(args, ' ')))
+		*options++ = 0;
+
 	//look for key only on non-local ip addresses
 	if ((!key || strcmp(passkey, key)) && (c->rem.ip != 16777343)){
 		web_respond(c, "login error");
@@ -62,52 +117,239 @@ static void do_login(struct mg_connection *c, char *key){
 		return;
 	}
 
+	struct web_session *s = c->fn_data;
+	if (!s){
+		if (session_count >= WEB_MAX_SESSIONS){
+			web_respond(c, "quit Too many sessions");
+			c->is_draining = 1;
+			printf("Too many web sessions, closing socket\n");
+			return;
+		}
+		s = calloc(1, sizeof(struct web_session));
+		c->fn_data = s;
+		session_count++;
+	}
+
 	hd_createGridList(); // llh: make the list up to date at the beginning of a session
 
-	sprintf(session_cookie, "%x", rand());
+	sprintf(s->cookie, "%08x", rand());
 	char response[100];
-	sprintf(response, "login %s", session_cookie);
+	sprintf(response, "login %s", s->cookie);
 	web_respond(c, response);	
+
+	//the rate is shared by all the listeners, the codec is per connection
+	int rate = remote_audio_rate(0);
+	if (options){
+		char *p = strtok(options, " ");
+		if (p && atoi(p))
+			rate = remote_audio_rate(atoi(p));
+		p = strtok(NULL, " ");
+		s->codec = p && !strcmp(p, "adpcm") ? AUDIO_ADPCM : AUDIO_PCM;
+	}
+	sprintf(response, "audio_format %d %s", rate, 
+		s->codec == AUDIO_ADPCM ? "adpcm" : "pcm");
+	web_respond(c, response);
 	get_updates(c, 1);
+	printf("web session %s started, %d active\n", s->cookie, session_count);
 }
 
-static int16_t remote_samples[10000]; //the max samples are set by the queue lenght in modems.c
+static void end_session(struct mg_connection *c){
+	struct web_session *s = c->fn_data;
+	if (!s)
+		return;
+	if (s->spectrum_dropped || s->audio_dropped)
+		printf("web session %s dropped %u spectrum and %u audio frames\n",
+			s->cookie, s->spectrum_dropped, s->audio_dropped);
+	free(s);
+	c->fn_data = NULL;
+	session_count--;
+}
 
-static void get_spectrum(struct mg_connection *c){
-	char buff[3000];
-	web_get_spectrum(buff);
-	mg_ws_send(c, buff, strlen(buff), WEBSOCKET_OP_TEXT);
-	get_updates(c, 0);
+/* Audio frames, little endian :
+	0	WEB_FRAME_AUDIO
+	1	WEB_FRAME_VERSION
+	2	codec, AUDIO_PCM or AUDIO_ADPCM
+	3	sample rate in KHz
+	4	pcm : 16-bit samples
+		adpcm : 16-bit predictor, 8-bit step index, 8-bit reserved
+			and then two samples per byte, the first in the lower nibble
+	a four byte header keeps the samples aligned */
+static int16_t audio_pcm[2 + WEB_AUDIO_CHUNK];
+static uint8_t audio_adpcm[8 + WEB_AUDIO_CHUNK/2];
+static struct adpcm_state audio_state;
+
+/* subscribes the connection to the spectrum, the args are an optional
+rate (in msec) and "bin" to ask for binary frames instead of text */
+static void get_spectrum(struct mg_connection *c, char *args){
+	struct web_session *s = web_session(c);
+	int ms = args ? atoi(args) : 0;
+
+	if (ms <= 0)
+		ms = WEB_SPECTRUM_MS;
+	else if (ms < 50)
+		ms = 50;
+	else if (ms > 1000)
+		ms = 1000;
+	s->spectrum_ms = ms;
+	s->next_spectrum = (uint32_t)mg_millis();
+
+	s->binary = args && strstr(args, "bin") ? 1 : 0;
+	//the client starts afresh, the next frame has to be raw
+	s->prev.n = 0;
+}
+
+//the audio rides along with the spectrum
+static void get_audio(struct mg_connection *c, char *args){
+	web_session(c)->audio = 1;
+	get_spectrum(c, args);
 }
 
-static void get_audio(struct mg_connection *c){
+/* the text spectrum and the console are built once and fanned out
+to every session, the binary frames are delta coded per session */
+static void push_spectrum(uint32_t now){
 	char buff[3000];
-	web_get_spectrum(buff);
-	mg_ws_send(c, buff, strlen(buff), WEBSOCKET_OP_TEXT);
-	get_updates(c, 0);
+	uint8_t frame[WEB_SPECTRUM_MAX + 32];
+	int len = 0;
 
-	int count = remote_audio_output(remote_samples);		
-	if (count > 0)
-		mg_ws_send(c, remote_samples, count * sizeof(int16_t), WEBSOCKET_OP_BINARY);
+	for (struct mg_connection *c = mgr.conns; c; c = c->next){
+		struct web_session *s = web_session(c);
+		if (!s || !s->spectrum_ms || (int32_t)(now - s->next_spectrum) < 0)
+			continue;
+		s->next_spectrum = now + s->spectrum_ms;
+		if (c->send.len > WEB_SPECTRUM_LIMIT){
+			s->spectrum_dropped++;
+			continue;
+		}
+		if (s->binary){
+			int n = web_get_spectrum_frame(frame, s->prev.bins, &s->prev.n);
+			mg_ws_send(c, frame, n, WEBSOCKET_OP_BINARY);
+		}
+		else {
+			//build the text frame only once per tick, for whoever is due
+			if (!len){
+				web_get_spectrum(buff);
+				len = strlen(buff);
+			}
+			mg_ws_send(c, buff, len, WEBSOCKET_OP_TEXT);
+		}
+		get_updates(c, 0);
+	}
+}
+
+static void push_audio(){
+	int listeners[2] = {0, 0};
+
+	for (struct mg_connection *c = mgr.conns; c; c = c->next){
+		struct web_session *s = web_session(c);
+		if (s && s->audio)
+			listeners[s->codec]++;
+	}
+
+	//nobody is listening, don't let stale audio pile up
+	if (!listeners[AUDIO_PCM] && !listeners[AUDIO_ADPCM]){
+		remote_audio_output(NULL, 0);
+		return;
+	}
+
+	int rate = remote_audio_rate(0);
+	int count = rate/50;
+	uint8_t *header = (uint8_t *)audio_pcm;
+	header[0] = audio_adpcm[0] = WEB_FRAME_AUDIO;
+	header[1] = audio_adpcm[1] = WEB_FRAME_VERSION;
+	header[2] = AUDIO_PCM;
+	audio_adpcm[2] = AUDIO_ADPCM;
+	header[3] = audio_adpcm[3] = rate/1000;
+
+	while (remote_audio_output(audio_pcm + 2, count) > 0){
+		//encode once, for all the adpcm listeners
+		if (listeners[AUDIO_ADPCM]){
+			audio_adpcm[4] = audio_state.predictor & 0xff;
+			audio_adpcm[5] = (audio_state.predictor >> 8) & 0xff;
+			audio_adpcm[6] = audio_state.index;
+			audio_adpcm[7] = 0;
+			adpcm_encode(&audio_state, audio_pcm + 2, audio_adpcm + 8, count);
+		}
+		for (struct mg_connection *c = mgr.conns; c; c = c->next){
+			struct web_session *s = web_session(c);
+			if (!s || !s->audio)
+				continue;
+			if (c->send.len > WEB_AUDIO_LIMIT){
+				s->audio_dropped++;
+				continue;
+			}
+			if (s->codec == AUDIO_ADPCM)
+				mg_ws_send(c, audio_adpcm, 8 + count/2, WEBSOCKET_OP_BINARY);
+			else
+				mg_ws_send(c, audio_pcm, 4 + count * sizeof(int16_t), WEBSOCKET_OP_BINARY);
+		}
+	}
+}
+
+static void push_console(){
+	char buff[2100];
+	int n = web_get_console(buff, 2000);
+	if (!n)
+		return;
+	for (struct mg_connection *c = mgr.conns; c; c = c->next)
+		if (web_session(c))
+			mg_ws_send(c, buff, strlen(buff), WEBSOCKET_OP_TEXT);
+}
+
+static void web_tick(void *arg){
+	uint32_t now = (uint32_t)mg_millis();
+
+	push_audio();
+	push_console();
+	push_spectrum(now);
+	(void) arg;
+}
+
+static void send_log_row(void *context, int id, char *text){
+	char row_response[3100];
+
+	sprintf(row_response, "QSO %s", text);
+	web_respond((struct mg_connection *)context, row_response); 
 }
 
-static void get_logs(struct mg_connection *c, char *args){
-	char logbook_path[200];
-	char row_response[1000], row[1000];
-	char query[100];
+static void send_log_json(void *context, int id, char *text){
+	char row_response[3100];
+
+	sprintf(row_response, "QSO_JSON %s", text);
+	web_respond((struct mg_connection *)context, row_response); 
+}
+
+//the args are the from_id and an optional callsign to search for
+static void get_logs(struct mg_connection *c, char *args, int format){
 	int	row_id;
 
-	query[0] = 0;
 	row_id = atoi(strtok(args, " "));
-	logbook_query(strtok(NULL, " \t\n"), row_id, logbook_path);
-	FILE *pf = fopen(logbook_path, "r");
-	if (!pf)
-		return;
-	while(fgets(row, sizeof(row), pf)){
-		sprintf(row_response, "QSO %s", row);
-		web_respond(c, row_response); 
+	logbook_rows(strtok(NULL, " \t\n"), row_id, 50, format,
+		format == LOGBOOK_JSON ? send_log_json : send_log_row, c);
+}
+
+/* the stations heard lately, the args are one of
+	all, call K1ABC, near 1500 [span] or callers */
+static void get_spots(struct mg_connection *c, char *args){
+	struct spot list[50];
+	char buff[10000];
+	int n = 0;
+
+	char *what = args ? strtok(args, " ") : NULL;
+	char *arg = what ? strtok(NULL, " ") : NULL;
+	if (!what || !strcmp(what, "all"))
+		n = spot_all(list, 50);
+	else if (!strcmp(what, "call") && arg)
+		n = spot_find(arg, list);
+	else if (!strcmp(what, "near") && arg){
+		char *span = strtok(NULL, " ");
+		n = spot_near(atoi(arg), span ? atoi(span) : 100, list, 50);
 	}
-	fclose(pf);
+	else if (!strcmp(what, "callers"))
+		n = spot_callers(list, 50);
+
+	strcpy(buff, "SPOTS ");
+	spot_json(list, n, buff + 6, sizeof(buff) - 6);
+	web_respond(c, buff);
 }
 
 void get_macros_list(struct mg_connection *c){
@@ -156,17 +398,21 @@ static void web_despatcher(struct mg_connection *c, struct mg_ws_message *wm){
 		printf("trying login with passkey : [%s]\n", value);
 		do_login(c, value);
 	}
-	else if (cookie == NULL || strcmp(cookie, session_cookie)){
+	else if (!web_session(c) || strcmp(cookie, web_session(c)->cookie)){
 		web_respond(c, "quit expired");
-		printf("Cookie not found, closing socket %s vs %s\n", cookie, session_cookie);
+		printf("Cookie not found, closing socket %s\n", cookie);
 		c->is_draining = 1;
 	}
 	else if (!strcmp(field, "spectrum"))
-		get_spectrum(c);
+		get_spectrum(c, value);
 	else if (!strcmp(field, "audio"))
-		get_audio(c);
+		get_audio(c, value);
 	else if (!strcmp(field, "logbook"))
-		get_logs(c, value);
+		get_logs(c, value, LOGBOOK_PIPE);
+	else if (!strcmp(field, "logbook_json"))
+		get_logs(c, value, LOGBOOK_JSON);
+	else if (!strcmp(field, "spots"))
+		get_spots(c, value);
 	else if (!strcmp(field, "macros_list"))
 		get_macros_list(c);
 	else if (!strcmp(field, "refresh"))
@@ -191,6 +437,8 @@ static void fn(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
   if (ev == MG_EV_OPEN) {
     // c->is_hexdumping = 1;
 	} else if (ev == MG_EV_ERROR || ev == MG_EV_CLOSE){
+		if (ev == MG_EV_CLOSE)
+			end_session(c);
 //		if (ev == MG_EV_ERROR)
 //			printf("closing with MG_EV_ERROR : ");
 //		if (ev = MG_EV_CLOSE)
@@ -220,7 +468,10 @@ static void fn(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
 void *webserver_thread_function(void *server){
   mg_mgr_init(&mgr);  // Initialise event manager
   mg_http_listen(&mgr, s_listen_on, fn, NULL);  // Create HTTP listener
-  for (;;) mg_mgr_poll(&mgr, 1000);             // Infinite event loop
+	adpcm_init(&audio_state);
+	mg_timer_add(&mgr, WEB_TICK_MS, MG_TIMER_REPEAT, web_tick, NULL);
+	//the poll timeout bounds the timer jitter
+  for (;;) mg_mgr_poll(&mgr, WEB_TICK_MS);      // Infinite event loop
 	printf("exiting webserver thread\n");
 }
 
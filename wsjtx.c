@@ -6,123 +6,427 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <complex.h>
+#include <time.h>
+#include <pthread.h>
+#include "sdr_ui.h"
+#include "netio.h"
+#include "spots.h"
+#include "wsjtx.h"
 
-static int udp_socket = -1;
+/*
+	The WSJT-X UDP protocol.
+	GridTracker, JTAlert and most loggers listen for WSJT-X on UDP port
+	2237. sbitx speaks to them as WSJT-X would: a Heartbeat and a Status
+	every few seconds, a Decode for each FT8 message decoded and a QSO
+	Logged when a QSO is saved. The Reply (a double click on a decode in
+	the other program) and the HaltTx come back to the port we sent from.
+	They are taken only from the destination hosts (or from anywhere if
+	a destination is a multicast group). When all the destinations are 
+	on this machine, as the default 127.0.0.1 is, the socket is bound to
+	127.0.0.1 and the rest of the network can't reach it at all.
+
+	The datagrams go to the addresses in the WSJTX_UDP field, like
+	"127.0.0.1:2237 224.0.0.1:2237". Each one is put together once and
+	the same bytes are sent to all of them.
+
+	The messages are Qt QDataStream, big endian: a magic, the schema, the
+	message type and our id, then the fields of the message. A string is
+	its length followed by the utf-8 bytes. See NetworkMessage.hpp in the
+	WSJT-X sources.
+*/
+
+#define WSJTX_MAGIC 0xadbccbda
+#define WSJTX_SCHEMA 2
+#define WSJTX_ID "sbitx"
+#define WSJTX_DESTS 4
+#define WSJTX_HEARTBEAT 15	//seconds
 
-void write_log(char *line);
+enum {
+	WSJTX_MSG_HEARTBEAT = 0,
+	WSJTX_MSG_STATUS = 1,
+	WSJTX_MSG_DECODE = 2,
+	WSJTX_MSG_CLEAR = 3,
+	WSJTX_MSG_REPLY = 4,
+	WSJTX_MSG_QSO_LOGGED = 5,
+	WSJTX_MSG_CLOSE = 6,
+	WSJTX_MSG_REPLAY = 7,
+	WSJTX_MSG_HALT_TX = 8
+};
 
-void wsjtx_send(char *response){
-    send(udp_socket, response, strlen(response), 0);
+struct wsjtx_packet {
+	char data[1024];
+	int length;
+};
+
+static int wsjtx_service = -1;
+static struct sockaddr_in dests[WSJTX_DESTS];
+static int n_dests = 0;
+static int bound_local = 0;
+static char dests_text[100];
+static pthread_mutex_t wsjtx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* writing */
+
+static void put_bytes(struct wsjtx_packet *p, const void *data, int length){
+	if (p->length + length > sizeof(p->data))
+		length = sizeof(p->data) - p->length;
+	memcpy(p->data + p->length, data, length);
+	p->length += length;
 }
 
-void wsjtx_start(){
-  struct sockaddr_in serverAddr;
-  struct sockaddr_storage serverStorage;
-  socklen_t addr_size;
+static void put_u8(struct wsjtx_packet *p, uint8_t v){
+	put_bytes(p, &v, 1);
+}
 
-  udp_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
-  
-  serverAddr.sin_family = AF_INET;
-  serverAddr.sin_port = htons(2237);
-  serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
-  memset(serverAddr.sin_zero, '\0', sizeof serverAddr.sin_zero);  
+static void put_u32(struct wsjtx_packet *p, uint32_t v){
+	v = htonl(v);
+	put_bytes(p, &v, 4);
+}
+
+static void put_u64(struct wsjtx_packet *p, uint64_t v){
+	put_u32(p, v >> 32);
+	put_u32(p, v & 0xffffffff);
+}
+
+//a qt float goes out as a double
+static void put_double(struct wsjtx_packet *p, double v){
+	uint64_t u;
+
+	memcpy(&u, &v, 8);
+	put_u64(p, u);
+}
 
-  /*---- Bind the address struct to the socket ----*/
-  int e = bind(udp_socket, (struct sockaddr *) &serverAddr, sizeof(serverAddr));
+static void put_string(struct wsjtx_packet *p, const char *s){
+	put_u32(p, strlen(s));
+	put_bytes(p, s, strlen(s));
 }
 
-void wsjtx_slice(){
-  struct sockaddr_in addr;
-  int e, len;
-  char buffer[1024];
+//a QDateTime in UTC: the julian day, the msecs since midnight and the time spec
+static void put_datetime(struct wsjtx_packet *p, time_t t){
+	put_u64(p, t / 86400 + 2440588);
+	put_u32(p, (t % 86400) * 1000);
+	put_u8(p, 1);
+}
 
-	len = sizeof(buffer);
-  e = recvfrom(udp_socket, buffer, sizeof(buffer), 0, (struct sockaddr *)&addr, &len);
-	if (e < 0)
+static void put_header(struct wsjtx_packet *p, int type){
+	p->length = 0;
+	put_u32(p, WSJTX_MAGIC);
+	put_u32(p, WSJTX_SCHEMA);
+	put_u32(p, type);
+	put_string(p, WSJTX_ID);
+}
+
+static void wsjtx_send(struct wsjtx_packet *p){
+	pthread_mutex_lock(&wsjtx_lock);
+	for (int i = 0; i < n_dests; i++)
+		netio_sendto(wsjtx_service, p->data, p->length, dests + i);
+	pthread_mutex_unlock(&wsjtx_lock);
+}
+
+/* reading, the fields are checked against the end of the datagram */
+
+struct wsjtx_reader {
+	char *data;
+	int length;
+	int pos;
+};
+
+static int get_u32(struct wsjtx_reader *r, uint32_t *v){
+	if (r->pos + 4 > r->length)
+		return -1;
+	memcpy(v, r->data + r->pos, 4);
+	*v = ntohl(*v);
+	r->pos += 4;
+	return 0;
+}
+
+static int get_u8(struct wsjtx_reader *r, uint8_t *v){
+	if (r->pos + 1 > r->length)
+		return -1;
+	*v = r->data[r->pos++];
+	return 0;
+}
+
+static int get_double(struct wsjtx_reader *r, double *v){
+	uint32_t hi, lo;
+
+	if (get_u32(r, &hi) || get_u32(r, &lo))
+		return -1;
+	uint64_t u = ((uint64_t)hi << 32) | lo;
+	memcpy(v, &u, 8);
+	return 0;
+}
+
+//a null string has the length 0xffffffff
+static int get_string(struct wsjtx_reader *r, char *s, int size){
+	uint32_t length;
+
+	s[0] = 0;
+	if (get_u32(r, &length))
+		return -1;
+	if (length == 0xffffffff)
+		return 0;
+	if (length > r->length - r->pos)
+		return -1;
+	int n = length < size - 1 ? length : size - 1;
+	memcpy(s, r->data + r->pos, n);
+	s[n] = 0;
+	r->pos += length;
+	return 0;
+}
+
+/* the messages from the other programs */
+
+//a double click on a decode, it starts a qso with the station
+static void wsjtx_reply(struct wsjtx_reader *r){
+	uint32_t msecs, snr, delta_freq;
+	double delta_time;
+	char mode[10], message[100], cmd[200];
+
+	if (get_u32(r, &msecs) || get_u32(r, &snr) || get_double(r, &delta_time)
+		|| get_u32(r, &delta_freq) || get_string(r, mode, sizeof(mode))
+		|| get_string(r, message, sizeof(message)))
 		return;
 
-	int32_t *px;
-	px = (int32_t *) buffer;
-
-	int32_t magic, schema, id, l, i;
-	int32_t hours, minutes, seconds, snr, delta_freq;
-	char utf[1000], message[2000], mode[1000], unique[1000], log[1000];
-
-	magic = ntohl(*px++);
-	schema = ntohl(*px++);
-	id = ntohl(*px++);
-	
-	//printf("\nMsg: %d\n", id);
-	switch(id){
-		case 0:
-			//printf("Hearbeat!\n");
+	int secs = msecs / 1000;
+	//as the ft8 decoder writes it to the console
+	snprintf(cmd, sizeof(cmd), "FT8 %02d%02d%02d %3d %+03d %-4d ~  %s",
+		secs / 3600, (secs / 60) % 60, secs % 60, 0, (int32_t)snr, delta_freq, message);
+	printf("wsjtx reply: %s\n", cmd);
+	remote_execute(cmd);
+}
+
+//the decodes still in the spot table are sent again
+static void wsjtx_replay(){
+	struct spot list[100];
+
+	int n = spot_all(list, 100);
+	for (int i = 0; i < n; i++)
+		if (!strcmp(list[i].mode, "FT8") || !strcmp(list[i].mode, "FT4"))
+			wsjtx_decode(list[i].when - list[i].when % 15, list[i].snr, 0,
+				list[i].freq_hz, list[i].mode, list[i].message);
+}
+
+//the replies are taken only from the hosts we send to
+static int wsjtx_allowed(struct sockaddr_in *from){
+	int allowed = 0;
+
+	pthread_mutex_lock(&wsjtx_lock);
+	for (int i = 0; i < n_dests && !allowed; i++)
+		if (IN_MULTICAST(ntohl(dests[i].sin_addr.s_addr))
+			|| dests[i].sin_addr.s_addr == from->sin_addr.s_addr)
+			allowed = 1;
+	pthread_mutex_unlock(&wsjtx_lock);
+	return allowed;
+}
+
+//on the netio thread, for each datagram from the other programs
+static void wsjtx_datagram(char *buffer, int length, struct sockaddr_in *from){
+	struct wsjtx_reader r = {buffer, length, 0};
+	uint32_t magic, schema, type;
+	uint8_t auto_only;
+	char id[40];
+
+	if (!wsjtx_allowed(from))
+		return;
+	if (get_u32(&r, &magic) || get_u32(&r, &schema) || get_u32(&r, &type)
+		|| get_string(&r, id, sizeof(id)) || magic != WSJTX_MAGIC)
+		return;
+
+	switch(type){
+		case WSJTX_MSG_REPLY:
+			wsjtx_reply(&r);
 			break;
-		case 1:
-			//printf("Status\n");
+		//auto_only stops the sequence, the current transmission goes on
+		case WSJTX_MSG_HALT_TX:
+			if (!get_u8(&r, &auto_only) && auto_only)
+				remote_execute("abort auto");
+			else
+				remote_execute("abort");
 			break;
-		case 2:
-			// count the bytes of the unique string
-			l = ntohl(*px++);
-			char *pt = (char *)px;
-			for (i = 0; i < l; i++)
-				unique[i] = *pt++;
-			unique[i] = 0;
-			//printf("Unique : %s\n", unique);
-			//printf("New: %d\n", (int)(*pt));
-			pt++;
-			px = (int32_t *)pt;
-			int32_t mds = ntohl(*px++);
-			mds = mds/1000; //reduce to only seconds, drop millisecs
-			seconds = mds % 60;
-			hours = mds / 3600;
-			minutes = (mds / 60) % 60;
-			//printf("Time: %d:%d:%d\n", hours, minutes, seconds) ;
-			snr = ntohl(*px++);
-			//printf("SNR: %d\n", snr);
-			//printf("delta time:%g\n", (double *)px);
-			px++;px++;
-			delta_freq = ntohl(*px++); 
-			//printf("delta freq:%u\n", delta_freq);
-			//mode
-			l = ntohl(*px++);
-			pt = (char *)px;
-			//printf("mode(%d):", l);
-			for (i = 0; i < l; i++)
-				mode[i] = *pt++;
-			mode[i] = 0;
-			//printf("mode: %s\n", mode);
-			//message
-			px = (int32_t *)pt;			
-			l = ntohl(*px++);
-			pt = (char *)px;
-			for (i = 0; i < l; i++)
-				message[i] = *pt++;
-			message[i] = 0;	
-			//printf("msg: %s\n", message);
-			sprintf(log, "%02d:%02d:%02d %03d %4d %s %s", hours, minutes, seconds, 
-				snr, delta_freq, mode, message);
-			//append_log(log);
-			write_log(log);
-			puts(log);
+		case WSJTX_MSG_REPLAY:
+			wsjtx_replay();
 			break;
-	}	
+	}
 }
 
-/*
-int main(){
+/* the messages to the other programs */
+
+//slot is the start of the ft8 slot, the mode is FT8 or FT4
+void wsjtx_decode(time_t slot, int snr, float delta_time, int freq_hz,
+	const char *mode, const char *message){
+	struct wsjtx_packet p;
 
-  puts("Starting udp\n");
-  wsjtx_start();
-  puts("Server started\n");
-  while (1){
-    wsjtx_slice();
-    usleep(1000);
-  }
-  return 0;
+	if (!n_dests)
+		return;
+	put_header(&p, WSJTX_MSG_DECODE);
+	put_u8(&p, 1);								//new
+	put_u32(&p, (slot % 86400) * 1000);
+	put_u32(&p, snr);
+	put_double(&p, delta_time);
+	put_u32(&p, freq_hz);
+	put_string(&p, strcmp(mode, "FT4") ? "~" : "+");
+	put_string(&p, message);
+	put_u8(&p, 0);								//low confidence
+	put_u8(&p, 0);								//off air
+	wsjtx_send(&p);
 }
-*/
 
+void wsjtx_logged(){
+	struct wsjtx_packet p;
+	char freq[20];
+	time_t now = time_sbitx();
+
+	if (!n_dests)
+		return;
+	get_field_value("r1:freq", freq);
+	long tx_freq = atol(freq);
+	if (!strcmp(field_str("MODE"), "FT8"))
+		tx_freq += field_int("TX_PITCH");
+
+	put_header(&p, WSJTX_MSG_QSO_LOGGED);
+	put_datetime(&p, now);						//off
+	put_string(&p, field_str("CALL"));
+	put_string(&p, field_str("EXCH"));		//the grid in ft8
+	put_u64(&p, tx_freq);
+	put_string(&p, field_str("MODE"));
+	put_string(&p, field_str("SENT"));
+	put_string(&p, field_str("RECV"));
+	put_string(&p, "");							//power
+	put_string(&p, "");							//comments
+	put_string(&p, "");							//name
+	put_datetime(&p, now);						//on
+	put_string(&p, "");							//operator
+	put_string(&p, field_str("MYCALLSIGN"));
+	put_string(&p, field_str("MYGRID"));
+	put_string(&p, field_str("NR"));
+	put_string(&p, field_str("EXCH"));
+	put_string(&p, "");							//propagation mode
+	wsjtx_send(&p);
+}
+
+static void wsjtx_status(struct wsjtx_packet *p){
+	char freq[20];
+	const char *mode = field_str("MODE");
+
+	get_field_value("r1:freq", freq);
+	put_header(p, WSJTX_MSG_STATUS);
+	put_u64(p, atol(freq));
+	put_string(p, mode);
+	put_string(p, field_str("CALL"));
+	put_string(p, field_str("SENT"));
+	put_string(p, mode);
+	put_u8(p, is_in_tx());						//tx enabled
+	put_u8(p, is_in_tx());						//transmitting
+	put_u8(p, 0);								//decoding
+	put_u32(p, field_int("PITCH"));
+	put_u32(p, field_int("TX_PITCH"));
+	put_string(p, field_str("MYCALLSIGN"));
+	put_string(p, field_str("MYGRID"));
+	put_string(p, field_str("EXCH"));
+	put_u8(p, 0);								//tx watchdog
+	put_string(p, "");							//submode
+	put_u8(p, 0);								//fast mode
+	put_u8(p, 0);								//special operation
+	put_u32(p, 0xffffffff);					//frequency tolerance
+	put_u32(p, 15);								//t/r period
+	put_string(p, "sbitx");						//configuration
+	put_string(p, "");							//tx message
+}
+
+//the destinations are a list of address:port
+static void wsjtx_destinations(const char *text){
+	char buff[100], *save;
+	int n = 0;
+
+	snprintf(buff, sizeof(buff), "%s", text);
+	pthread_mutex_lock(&wsjtx_lock);
+	for (char *p = strtok_r(buff, " ,", &save); p && n < WSJTX_DESTS;
+		p = strtok_r(NULL, " ,", &save)){
+		char *port = strchr(p, ':');
+		if (port)
+			*port++ = 0;
+		memset(dests + n, 0, sizeof(struct sockaddr_in));
+		dests[n].sin_family = AF_INET;
+		dests[n].sin_port = htons(port ? atoi(port) : 2237);
+		if (inet_aton(p, &dests[n].sin_addr))
+			n++;
+		else
+			printf("*Error: wsjtx destination %s is not an address\n", p);
+	}
+	n_dests = n;
+	pthread_mutex_unlock(&wsjtx_lock);
+	snprintf(dests_text, sizeof(dests_text), "%s", text);
+}
+
+//true if all the destinations are on this machine
+static int wsjtx_dests_local(){
+	for (int i = 0; i < n_dests; i++)
+		if ((ntohl(dests[i].sin_addr.s_addr) >> 24) != 127)
+			return 0;
+	return 1;
+}
+
+/* called from the ui_tick() on the gtk thread, a status goes out when
+	anything in it changes and with each heartbeat */
+void wsjtx_poll(){
+	static struct wsjtx_packet last_status;
+	static time_t last_heartbeat = 0;
+	struct wsjtx_packet p;
+
+	if (wsjtx_service < 0)
+		return;
+	if (strcmp(field_str("WSJTX_UDP"), dests_text)){
+		wsjtx_destinations(field_str("WSJTX_UDP"));
+		if (bound_local && !wsjtx_dests_local())
+			printf("*Error: wsjtx is bound to 127.0.0.1, restart to send to %s\n", 
+				dests_text);
+	}
+	if (!n_dests)
+		return;
+
+	time_t now = time(NULL);
+	int beat = now - last_heartbeat >= WSJTX_HEARTBEAT;
+	if (beat){
+		put_header(&p, WSJTX_MSG_HEARTBEAT);
+		put_u32(&p, 3);						//the highest schema we know
+		put_string(&p, VER_STR);
+		put_string(&p, "");
+		wsjtx_send(&p);
+		last_heartbeat = now;
+	}
 
+	wsjtx_status(&p);
+	if (beat || p.length != last_status.length
+		|| memcmp(p.data, last_status.data, p.length)){
+		wsjtx_send(&p);
+		last_status = p;
+	}
+}
+
+//the replies come back to the port we send from
+void wsjtx_start(){
+	wsjtx_destinations(field_str("WSJTX_UDP"));
+	bound_local = wsjtx_dests_local();
+	wsjtx_service = netio_udp("wsjtx", bound_local ? "127.0.0.1" : NULL, 0, 
+		wsjtx_datagram);
+}
+
+/* a test, it sends a decode every 15 seconds, watch them in GridTracker
+const char *field_str(char *label){
+	return !strcmp(label, "WSJTX_UDP") ? "127.0.0.1:2237" : "";
+}
+
+void main(){
+	wsjtx_start();
+	netio_start();
+	while (1){
+		wsjtx_poll();
+		wsjtx_decode(time(NULL), -10, 0.2, 1500, "FT8", "CQ VU2ESE MK97");
+		sleep(15);
+	}
+}
+*/
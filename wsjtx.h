@@ -1,2 +1,5 @@
 void wsjtx_start();
-void wsjtx_slice();
+void wsjtx_poll();
+void wsjtx_decode(time_t slot, int snr, float delta_time, int freq_hz,
+	const char *mode, const char *message);
+void wsjtx_logged();